@@ -11,7 +11,6 @@
 */
 
 #include "Cell.h"
-#include "Vector.h"
 #include <math.h>
 using namespace std;
 
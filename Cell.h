@@ -10,8 +10,7 @@
 #ifndef __CELL_H__
 #define __CELL_H__
 
-#include "Vector.h"
-#include "Particle.h"
+#include "Vec3.h"
 
 class Cell{
    public:
@@ -21,7 +20,7 @@ class Cell{
       int rowCoord;
       int colCoord;
 
-      Vector3d centerPos;	// location in space of center of cell
+      Vec3d centerPos;	// location in space of center of cell
 
       float cellMinX;
       float cellMinY;
@@ -0,0 +1,464 @@
+/*
+* Checkpoint.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* File layout: a fixed header holding every scalar of the model,
+* followed by the arrays, each starting on a 64 byte boundary, in
+* the order of the section enum below. Arrays are written straight
+* from the model's own storage, so a checkpoint costs little more
+* than the bytes it writes. Reading maps the file and copies each
+* section into place. A compressed state section holds a DeltaCodec
+* keyframe of the state quantized against the rest state.
+*/
+
+#include "Checkpoint.h"
+#include "Model.h"
+#include "DeformedMesh.h"
+#include "DeltaCodec.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char CHECKPOINT_MAGIC[8] = {'S', 'S', 'M', 'C', 'K', 'P', 'T', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const uint32_t CHECKPOINT_BYTEORDER = 0x01020304;
+static const uint64_t CHECKPOINT_ALIGN = 64;
+
+enum {STATE_SECTION, ACCEL_SECTION, REST_SECTION, MASS_SECTION, INVMASS_SECTION, PINNED_SECTION,
+      I0_SECTION, I1_SECTION, K_SECTION, D_SECTION, LREST_SECTION, COLOR_SECTION,
+      CELL_SECTION, BINDING_SECTION, NUM_SECTIONS};
+
+struct CheckpointHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byteOrder;
+   int32_t realSize;		// bytes per scalar of the state, particle and strut arrays
+
+   // simulation clock
+   float t, h;
+   int32_t n;
+   int32_t running;
+   int32_t dispinterval;
+
+   // integration
+   int32_t integrator;		// Model::Integrator
+   float errorTolerance;	// Dormand-Prince substep control
+   float substep;
+   float substepError;
+   int32_t accelValid;		// ACCEL_SECTION holds the acceleration carried into the next step
+
+   // lattice configuration
+   int32_t latticePlanes, latticeRows, latticeCols;
+   float strutK, strutD, latticeMass;
+   float bounds[6];		// min x y z, max x y z
+   float cellSize[3];		// width, height, depth
+   double gravity[3];
+
+   // array lengths
+   int32_t numParticles;
+   int32_t numStruts;
+   int32_t numColors;
+   int32_t numCells;
+   int32_t numMeshVertices;	// -1 if no mesh binding was saved
+
+   uint64_t offset[NUM_SECTIONS];
+   uint64_t bytes[NUM_SECTIONS];
+   uint64_t fileSize;
+
+   // state compression
+   int32_t stateCompressed;
+   double stateErrorBound;
+};
+
+// the parts of a Cell that construction sets
+struct CellRecord
+{
+   int32_t vertIndices[8];
+   int32_t coord[3];		// plane, row, column
+   float bounds[6];		// min x y z, max x y z
+};
+
+static uint64_t alignUp(uint64_t n)
+{
+   return (n + CHECKPOINT_ALIGN - 1) & ~(CHECKPOINT_ALIGN - 1);
+}
+
+//-----------------------------------------------------------------
+/*
+Checkpoint::write()
+* PURPOSE : Save the complete simulation state
+* INPUTS :  const char *filename, checkpoint file
+*           Model &model, simulation to save
+*           const DeformedMesh *mesh, mesh bound to the lattice, or NULL
+*           double errorBound, compress the state to this accuracy; 0
+*           saves it exactly
+* OUTPUTS : bool, false if the file could not be written
+*/
+//-----------------------------------------------------------------
+
+bool Checkpoint::write(const char *filename, Model &model, const DeformedMesh *mesh,
+                       double errorBound)
+{
+   int np = model.numParticles;
+   int ns = model.numStruts;
+   const StrutSet &struts = model.strutSet;
+   Lattice &lattice = model.lattice;
+   int ncells = lattice.getNumCells();
+
+   CheckpointHeader hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+   hdr.version = CHECKPOINT_VERSION;
+   hdr.byteOrder = CHECKPOINT_BYTEORDER;
+   hdr.t = model.t;
+   hdr.h = model.h;
+   hdr.n = model.n;
+   hdr.running = model.running;
+   hdr.dispinterval = model.dispinterval;
+   hdr.latticePlanes = model.latticePlanes;
+   hdr.latticeRows = model.latticeRows;
+   hdr.latticeCols = model.latticeCols;
+   hdr.strutK = model.strutK;
+   hdr.strutD = model.strutD;
+   hdr.latticeMass = model.latticeMass;
+   hdr.bounds[0] = model.minX_bound;
+   hdr.bounds[1] = model.minY_bound;
+   hdr.bounds[2] = model.minZ_bound;
+   hdr.bounds[3] = model.maxX_bound;
+   hdr.bounds[4] = model.maxY_bound;
+   hdr.bounds[5] = model.maxZ_bound;
+   hdr.cellSize[0] = lattice.cellWidth;
+   hdr.cellSize[1] = lattice.cellHeight;
+   hdr.cellSize[2] = lattice.cellDepth;
+   hdr.gravity[0] = model.particles.gravity.x;
+   hdr.gravity[1] = model.particles.gravity.y;
+   hdr.gravity[2] = model.particles.gravity.z;
+   hdr.numParticles = np;
+   hdr.numStruts = ns;
+   hdr.numColors = struts.numColors;
+   hdr.numCells = ncells;
+   hdr.numMeshVertices = (mesh != NULL) ? mesh->getNumVertices() : -1;
+   hdr.realSize = sizeof(Real);
+   hdr.integrator = model.integrator;
+   hdr.errorTolerance = model.errorTolerance;
+   hdr.substep = model.substep;
+   hdr.substepError = model.substepError;
+
+   // velocity Verlet and Dormand-Prince reuse the last step's acceleration;
+   // it would not match a compressed state, so is evaluated again then
+   hdr.accelValid = model.accelValid && errorBound <= 0;
+
+   // the cells hold more than construction fills in, so pack what matters
+   CellRecord *cells = new CellRecord[ncells > 0 ? ncells : 1];
+   for (int c = 0; c < ncells; c++){
+      const Cell &cell = lattice.cells[c];
+      memcpy(cells[c].vertIndices, cell.vertIndices, sizeof(cells[c].vertIndices));
+      cells[c].coord[0] = cell.planeCoord;
+      cells[c].coord[1] = cell.rowCoord;
+      cells[c].coord[2] = cell.colCoord;
+      cells[c].bounds[0] = cell.cellMinX;
+      cells[c].bounds[1] = cell.cellMinY;
+      cells[c].bounds[2] = cell.cellMinZ;
+      cells[c].bounds[3] = cell.cellMaxX;
+      cells[c].bounds[4] = cell.cellMaxY;
+      cells[c].bounds[5] = cell.cellMaxZ;
+   }
+
+   // positions are quantized against the rest positions, velocities
+   // against the rest velocities with the bound scaled by the time step
+   vector<unsigned char> stateCode;
+   if (errorBound > 0){
+      int64_t *quant = new int64_t[6 * np > 0 ? 6 * np : 1];
+      DeltaCodec::quantize(model.S.getData(), model.restState.getData(), 3 * np,
+                           DeltaCodec::quantStep(errorBound), quant);
+      DeltaCodec::quantize(model.S.getData() + 3 * np, model.restState.getData() + 3 * np, 3 * np,
+                           DeltaCodec::quantStep(errorBound / model.h), quant + 3 * np);
+      DeltaCodec codec;
+      codec.reset(6 * np);
+      codec.encode(quant, true, stateCode);
+      delete[] quant;
+      hdr.stateCompressed = 1;
+      hdr.stateErrorBound = errorBound;
+   }
+
+   const void *data[NUM_SECTIONS] = {
+      (errorBound > 0) ? (const void*)&stateCode[0] : model.S.getData(), model.Sdot.getData(),
+      model.restState.getData(),
+      model.particles.mass, model.particles.invMass, model.particles.pinned,
+      struts.i0, struts.i1, struts.k, struts.d, struts.l_rest, struts.colorStart,
+      cells, (mesh != NULL) ? mesh->meshVertices : NULL};
+   hdr.bytes[STATE_SECTION] = (errorBound > 0) ? stateCode.size() : 6 * (uint64_t)np * sizeof(Real);
+   hdr.bytes[ACCEL_SECTION] = hdr.accelValid ? 6 * (uint64_t)np * sizeof(Real) : 0;
+   hdr.bytes[REST_SECTION] = 6 * (uint64_t)np * sizeof(Real);
+   hdr.bytes[MASS_SECTION] = (uint64_t)np * sizeof(Real);
+   hdr.bytes[INVMASS_SECTION] = (uint64_t)np * sizeof(Real);
+   hdr.bytes[PINNED_SECTION] = (uint64_t)np * sizeof(unsigned char);
+   hdr.bytes[I0_SECTION] = (uint64_t)ns * sizeof(int);
+   hdr.bytes[I1_SECTION] = (uint64_t)ns * sizeof(int);
+   hdr.bytes[K_SECTION] = (uint64_t)ns * sizeof(Real);
+   hdr.bytes[D_SECTION] = (uint64_t)ns * sizeof(Real);
+   hdr.bytes[LREST_SECTION] = (uint64_t)ns * sizeof(Real);
+   hdr.bytes[COLOR_SECTION] = (struts.colorStart != NULL) ? (uint64_t)(struts.numColors + 1) * sizeof(int) : 0;
+   hdr.bytes[CELL_SECTION] = (uint64_t)ncells * sizeof(CellRecord);
+   hdr.bytes[BINDING_SECTION] = (mesh != NULL) ? (uint64_t)mesh->getNumVertices() * sizeof(MeshVertex) : 0;
+
+   uint64_t pos = alignUp(sizeof(hdr));
+   for (int s = 0; s < NUM_SECTIONS; s++){
+      hdr.offset[s] = pos;
+      pos = alignUp(pos + hdr.bytes[s]);
+   }
+   hdr.fileSize = pos;
+
+   char suffix[32];
+   snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+   string tmp = string(filename) + suffix;
+
+   FILE *fp = fopen(tmp.c_str(), "wb");
+   if (fp == NULL){
+      cerr << "Could not create checkpoint " << tmp << endl;
+      delete[] cells;
+      return false;
+   }
+
+   static const char zeros[CHECKPOINT_ALIGN] = {0};
+   bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+   uint64_t at = sizeof(hdr);
+   for (int s = 0; ok && s < NUM_SECTIONS; s++){
+      ok = fwrite(zeros, 1, hdr.offset[s] - at, fp) == hdr.offset[s] - at;
+      if (ok && hdr.bytes[s] > 0)
+         ok = fwrite(data[s], 1, hdr.bytes[s], fp) == hdr.bytes[s];
+      at = hdr.offset[s] + hdr.bytes[s];
+   }
+   if (ok)
+      ok = fwrite(zeros, 1, hdr.fileSize - at, fp) == hdr.fileSize - at;
+   delete[] cells;
+
+   // the data must be on disk before the rename makes it the checkpoint,
+   // or a crash could leave a complete looking file with missing blocks
+   ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+   ok = (fclose(fp) == 0) && ok;
+   if (ok)
+      ok = rename(tmp.c_str(), filename) == 0;
+   if (!ok){
+      cerr << "Could not write checkpoint " << filename << endl;
+      remove(tmp.c_str());
+   }
+   return ok;
+}
+
+//-----------------------------------------------------------------
+/*
+Checkpoint::read()
+* PURPOSE : Restore the complete simulation state. Nothing in the
+            model is changed unless the whole file checks out.
+* INPUTS :  const char *filename, checkpoint file
+*           Model &model, simulation to restore
+*           DeformedMesh *mesh, loaded mesh to rebind, or NULL
+* OUTPUTS : bool, false if the file is missing, damaged or does not
+            fit the mesh
+*/
+//-----------------------------------------------------------------
+
+bool Checkpoint::read(const char *filename, Model &model, DeformedMesh *mesh)
+{
+   int fd = open(filename, O_RDONLY);
+   if (fd < 0){
+      cerr << "Could not open checkpoint " << filename << endl;
+      return false;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader)){
+      cerr << "Checkpoint " << filename << " is damaged" << endl;
+      close(fd);
+      return false;
+   }
+
+   size_t size = (size_t)st.st_size;
+   void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m == MAP_FAILED){
+      cerr << "Could not map checkpoint " << filename << endl;
+      return false;
+   }
+
+   const char *base = (const char*)m;
+   const CheckpointHeader &hdr = *(const CheckpointHeader*)m;
+   int np = hdr.numParticles, ns = hdr.numStruts;
+   bool compressed = hdr.stateCompressed != 0;
+
+   // a build of the other precision lays the arrays out differently
+   if (memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 && hdr.version == CHECKPOINT_VERSION &&
+       hdr.realSize != (int)sizeof(Real)){
+      cerr << "Checkpoint " << filename << " was made by a " << (hdr.realSize == (int)sizeof(float) ? "single" : "double")
+           << " precision build" << endl;
+      munmap(m, size);
+      return false;
+   }
+
+   uint64_t expect[NUM_SECTIONS] = {
+      6 * (uint64_t)np * sizeof(Real), hdr.accelValid ? 6 * (uint64_t)np * sizeof(Real) : 0,
+      6 * (uint64_t)np * sizeof(Real), (uint64_t)np * sizeof(Real), (uint64_t)np * sizeof(Real), (uint64_t)np * sizeof(unsigned char),
+      (uint64_t)ns * sizeof(int), (uint64_t)ns * sizeof(int),
+      (uint64_t)ns * sizeof(Real), (uint64_t)ns * sizeof(Real), (uint64_t)ns * sizeof(Real),
+      (uint64_t)(hdr.numColors + 1) * sizeof(int),
+      (uint64_t)hdr.numCells * sizeof(CellRecord),
+      (hdr.numMeshVertices > 0) ? (uint64_t)hdr.numMeshVertices * sizeof(MeshVertex) : 0};
+
+   bool valid = memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+                hdr.version == CHECKPOINT_VERSION &&
+                hdr.byteOrder == CHECKPOINT_BYTEORDER &&
+                hdr.fileSize == size &&
+                np >= 0 && ns >= 0 && hdr.numColors >= 0 && hdr.numCells >= 0 &&
+                hdr.numCells == hdr.latticePlanes * hdr.latticeRows * hdr.latticeCols &&
+                hdr.integrator >= 0 && hdr.integrator < Model::NUM_INTEGRATORS &&
+                (!compressed || (hdr.stateErrorBound > 0 && hdr.h > 0));
+   if (hdr.bytes[COLOR_SECTION] == 0)
+      expect[COLOR_SECTION] = 0;		// never colored
+   if (compressed)
+      expect[STATE_SECTION] = hdr.bytes[STATE_SECTION];
+   for (int s = 0; valid && s < NUM_SECTIONS; s++)
+      valid = hdr.bytes[s] == expect[s] && hdr.offset[s] + hdr.bytes[s] <= size;
+   if (!valid){
+      cerr << "Checkpoint " << filename << " is damaged or from another version" << endl;
+      munmap(m, size);
+      return false;
+   }
+   // every particle index has to land inside the particle arrays
+   const int *i0 = (const int*)(base + hdr.offset[I0_SECTION]);
+   const int *i1 = (const int*)(base + hdr.offset[I1_SECTION]);
+   for (int s = 0; valid && s < ns; s++)
+      valid = i0[s] >= 0 && i0[s] < np && i1[s] >= 0 && i1[s] < np;
+   const CellRecord *cells = (const CellRecord*)(base + hdr.offset[CELL_SECTION]);
+   for (int c = 0; valid && c < hdr.numCells; c++)
+      for (int v = 0; valid && v < 8; v++)
+         valid = cells[c].vertIndices[v] >= 0 && cells[c].vertIndices[v] < np;
+   if (valid && hdr.bytes[COLOR_SECTION] > 0){
+      const int *colors = (const int*)(base + hdr.offset[COLOR_SECTION]);
+      valid = colors[0] == 0 && colors[hdr.numColors] == ns;
+      for (int c = 0; valid && c < hdr.numColors; c++)
+         valid = colors[c] <= colors[c + 1];
+   }
+   if (!valid){
+      cerr << "Checkpoint " << filename << " is damaged" << endl;
+      munmap(m, size);
+      return false;
+   }
+   if (mesh != NULL && hdr.numMeshVertices != mesh->getNumVertices()){
+      cerr << "Checkpoint " << filename << " was not made with this mesh" << endl;
+      munmap(m, size);
+      return false;
+   }
+
+   // decode a compressed state before anything is changed
+   int64_t *quant = NULL;
+   if (compressed){
+      quant = new int64_t[6 * np > 0 ? 6 * np : 1];
+      DeltaCodec codec;
+      codec.reset(6 * np);
+      if (!codec.decode((const unsigned char*)base + hdr.offset[STATE_SECTION], hdr.bytes[STATE_SECTION], quant)){
+         cerr << "Checkpoint " << filename << " is damaged" << endl;
+         delete[] quant;
+         munmap(m, size);
+         return false;
+      }
+   }
+
+   // simulation clock and configuration
+   model.t = hdr.t;
+   model.h = hdr.h;
+   model.n = hdr.n;
+   model.setIntegrator((Model::Integrator)hdr.integrator);
+   model.setErrorTolerance(hdr.errorTolerance);
+   model.substep = hdr.substep;
+   model.substepError = hdr.substepError;
+   model.running = hdr.running != 0;
+   model.dispinterval = hdr.dispinterval;
+   model.latticePlanes = hdr.latticePlanes;
+   model.latticeRows = hdr.latticeRows;
+   model.latticeCols = hdr.latticeCols;
+   model.strutK = hdr.strutK;
+   model.strutD = hdr.strutD;
+   model.latticeMass = hdr.latticeMass;
+   model.setBoundingBox(hdr.bounds[0], hdr.bounds[1], hdr.bounds[2], hdr.bounds[3], hdr.bounds[4], hdr.bounds[5]);
+
+   // particles and state
+   model.numParticles = np;
+   ParticleStore &particles = model.particles;
+   particles.resize(np);
+   memcpy(particles.mass, base + hdr.offset[MASS_SECTION], hdr.bytes[MASS_SECTION]);
+   memcpy(particles.invMass, base + hdr.offset[INVMASS_SECTION], hdr.bytes[INVMASS_SECTION]);
+   memcpy(particles.pinned, base + hdr.offset[PINNED_SECTION], hdr.bytes[PINNED_SECTION]);
+   particles.gravity = Vec3(hdr.gravity[0], hdr.gravity[1], hdr.gravity[2]);
+
+   model.restState.resize(np);
+   memcpy(model.restState.getData(), base + hdr.offset[REST_SECTION], hdr.bytes[REST_SECTION]);
+   model.S.resize(np);
+   if (compressed){
+      const Real *rest = model.restState.getData();
+      DeltaCodec::dequantize(quant, rest, 3 * np, DeltaCodec::quantStep(hdr.stateErrorBound), model.S.getData());
+      DeltaCodec::dequantize(quant + 3 * np, rest + 3 * np, 3 * np,
+                             DeltaCodec::quantStep(hdr.stateErrorBound / hdr.h), model.S.getData() + 3 * np);
+      delete[] quant;
+   }
+   else
+      memcpy(model.S.getData(), base + hdr.offset[STATE_SECTION], hdr.bytes[STATE_SECTION]);
+   model.allocateWorkspace();
+   if (hdr.accelValid){
+      memcpy(model.Sdot.getData(), base + hdr.offset[ACCEL_SECTION], hdr.bytes[ACCEL_SECTION]);
+      model.accelValid = true;
+   }
+
+   // struts, already in color batch order
+   model.numStruts = ns;
+   StrutSet &struts = model.strutSet;
+   const Real *k = (const Real*)(base + hdr.offset[K_SECTION]);
+   const Real *d = (const Real*)(base + hdr.offset[D_SECTION]);
+   const Real *l = (const Real*)(base + hdr.offset[LREST_SECTION]);
+   struts.clear();
+   struts.reserve(ns);
+   for (int s = 0; s < ns; s++)
+      struts.add(i0[s], i1[s], k[s], d[s], l[s]);
+   delete[] struts.colorStart;
+   struts.colorStart = NULL;
+   struts.numColors = 0;
+   if (hdr.bytes[COLOR_SECTION] > 0){
+      struts.numColors = hdr.numColors;
+      struts.colorStart = new int[hdr.numColors + 1];
+      memcpy(struts.colorStart, base + hdr.offset[COLOR_SECTION], hdr.bytes[COLOR_SECTION]);
+   }
+   model.estimateStableStep();
+
+   // lattice cells
+   Lattice &lattice = model.lattice;
+   lattice = Lattice(hdr.latticePlanes, hdr.latticeRows, hdr.latticeCols);
+   lattice.setBounds(hdr.bounds[0], hdr.bounds[1], hdr.bounds[2], hdr.bounds[3], hdr.bounds[4], hdr.bounds[5]);
+   lattice.setCellDimensions(hdr.cellSize[0], hdr.cellSize[1], hdr.cellSize[2]);
+   for (int c = 0; c < hdr.numCells; c++){
+      Cell &cell = lattice.cells[c];
+      cell = Cell(cells[c].coord[0], cells[c].coord[1], cells[c].coord[2]);
+      memcpy(cell.vertIndices, cells[c].vertIndices, sizeof(cell.vertIndices));
+      cell.setMinBounds(cells[c].bounds[0], cells[c].bounds[1], cells[c].bounds[2]);
+      cell.setMaxBounds(cells[c].bounds[3], cells[c].bounds[4], cells[c].bounds[5]);
+   }
+
+   // mesh binding
+   if (mesh != NULL && hdr.numMeshVertices > 0){
+      delete[] mesh->meshVertices;
+      mesh->meshVertices = new MeshVertex[hdr.numMeshVertices];
+      memcpy(mesh->meshVertices, base + hdr.offset[BINDING_SECTION], hdr.bytes[BINDING_SECTION]);
+   }
+
+   munmap(m, size);
+   return true;
+}
@@ -0,0 +1,41 @@
+/*
+* Checkpoint.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Binary snapshot of a running simulation: time, step, time step and
+* integrator, the state vector and the acceleration carried over
+* between steps, particle masses and pins, the strut topology with
+* its color batches, the lattice cells and optionally the mesh
+* binding. A run restored from a checkpoint continues bit for bit as
+* the original would have, without rebuilding the lattice or
+* rebinding the mesh.
+*
+* Given an error bound, the state is instead stored compressed with
+* DeltaCodec against the rest lattice; the restored run then starts
+* within that bound of the original rather than bit for bit.
+*/
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <cstddef>
+
+class Model;
+class DeformedMesh;
+
+class Checkpoint{
+   public:
+      // Save model, and the binding of mesh if not NULL, to filename. The
+      // file is written under a temporary name and renamed into place.
+      // With errorBound above zero positions are stored to within
+      // errorBound, and velocities to within errorBound per time step.
+      static bool write(const char *filename, Model &model, const DeformedMesh *mesh = NULL,
+                        double errorBound = 0);
+
+      // Restore model, and the binding of mesh if not NULL, from filename.
+      // mesh must already hold the obj the checkpoint was made with.
+      static bool read(const char *filename, Model &model, DeformedMesh *mesh = NULL);
+};
+
+#endif
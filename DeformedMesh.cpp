@@ -0,0 +1,290 @@
+/*
+* DeformedMesh.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Each mesh vertex stores the eight lattice particles of the cell
+* it lies in, with trilinear weights from its position within that
+* cell at rest. The deformed position is the weighted sum of the
+* eight current particle positions, evaluated in one streaming,
+* multithreaded pass over the vertices.
+*/
+
+#include "DeformedMesh.h"
+#include "Model.h"
+#include "Lattice.h"
+#include "StateVector.h"
+#include "objtriloader.h"
+#include "MeshCache.h"
+#include "ThreadPool.h"
+#include "Vec3.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::DeformedMesh()
+* PURPOSE : Default constructor, an empty mesh
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+DeformedMesh::DeformedMesh()
+{
+   meshVertices = NULL;
+   positions = NULL;
+}
+
+DeformedMesh::~DeformedMesh()
+{
+   delete[] meshVertices;
+   delete[] positions;
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::load(const char *filename)
+* PURPOSE : Load the obj mesh to be deformed
+* INPUTS :  const char *filename, obj file
+* OUTPUTS : bool, false if the file could not be read or has no vertices
+*/
+//-----------------------------------------------------------------
+
+bool DeformedMesh::load(const char *filename)
+{
+   // use the pre-baked binary form when it is up to date, otherwise
+   // parse the obj and bake it for next time
+   if (!MeshCache::load(filename, obj)){
+      ObjLoader objloader(filename);
+      obj = objloader.ReturnObj();
+      if (obj.NumVertex > 0 && !MeshCache::write(filename, obj))
+         cerr << "Could not write mesh cache " << MeshCache::cachePath(filename) << endl;
+   }
+   if (obj.NumVertex == 0){
+      cerr << "Could not load mesh " << filename << endl;
+      return false;
+   }
+
+   delete[] positions;
+   positions = new float[3 * obj.NumVertex];
+   for (int i = 0; i < obj.NumVertex; i++)
+   {
+      positions[3 * i] = obj.VertexArray[i].X;
+      positions[3 * i + 1] = obj.VertexArray[i].Y;
+      positions[3 * i + 2] = obj.VertexArray[i].Z;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::getBounds(Vec3f &lo, Vec3f &hi)
+* PURPOSE : Find the bounding box of the undeformed mesh
+* INPUTS :  Vec3f &lo, Vec3f &hi, set to the minimum and maximum corners
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void DeformedMesh::getBounds(Vec3f &lo, Vec3f &hi) const
+{
+  const ObjVertex* V = obj.VertexArray;
+  lo = hi = Vec3f(V[0].X, V[0].Y, V[0].Z);
+  for (int i = 1; i < obj.NumVertex; i ++)
+  {
+      Vec3f p(V[i].X, V[i].Y, V[i].Z);
+      lo = cwiseMin(lo, p);
+      hi = cwiseMax(hi, p);
+  }
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::fitLattice(Model *model, float thresh)
+* PURPOSE : Size the model's lattice to the mesh bounding box, construct
+            it and bind the mesh to it
+* INPUTS :  Model *model, model whose lattice is built
+            float thresh, padding between the mesh and the lattice
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void DeformedMesh::fitLattice(Model *model, float thresh)
+{
+  Vec3f lo, hi;
+  getBounds(lo, hi);
+
+  model->setBoundingBox(lo.x - thresh, lo.y - thresh, lo.z - thresh, hi.x + thresh, hi.y + thresh, hi.z + thresh);
+  model->constructLattice();
+  bind(model);
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::bind(Model *model)
+* PURPOSE : Record for every mesh vertex the particles of its lattice cell
+            and their trilinear weights, from the vertex's (u, v, w)
+            position within that cell in the rest lattice
+* INPUTS :  Model *model, model with a constructed lattice
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void DeformedMesh::bind(Model *model)
+{
+  Lattice* L = model->getLPointer();
+  const StateVector& R = model->getRestState();
+
+  delete[] meshVertices;
+  meshVertices = new MeshVertex[obj.NumVertex];
+
+  for (int j = 0; j < obj.NumVertex; j ++)
+  {
+     int index = L->nearestCellIndex(obj.VertexArray[j].X, obj.VertexArray[j].Y, obj.VertexArray[j].Z);
+     const int* corner = L->cells[index].vertIndices;
+     int p0 = corner[0];
+     int p1 = corner[1];
+     int p2 = corner[2];
+     int p4 = corner[4];
+
+     float u = (obj.VertexArray[j].X - R.x[p0])/(R.x[p1] - R.x[p0]);
+     float v = (obj.VertexArray[j].Y - R.y[p0])/(R.y[p2] - R.y[p0]);
+     float w = (obj.VertexArray[j].Z - R.z[p0])/(R.z[p4] - R.z[p0]);
+
+     MeshVertex& mv = meshVertices[j];
+     for (int c = 0; c < 8; c++)
+        mv.index[c] = corner[c];
+     mv.weight[0] = (1 - u) * (1 - v) * (1 - w);
+     mv.weight[1] = u * (1 - v) * (1 - w);
+     mv.weight[2] = (1 - u) * v * (1 - w);
+     mv.weight[3] = u * v * (1 - w);
+     mv.weight[4] = (1 - u) * (1 - v) * w;
+     mv.weight[5] = u * (1 - v) * w;
+     mv.weight[6] = (1 - u) * v * w;
+     mv.weight[7] = u * v * w;
+  }
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::deform(Model *model)
+* PURPOSE : Compute every deformed vertex position from the current lattice
+            state, splitting the vertices across the shared thread pool
+* INPUTS :  Model *model, model the mesh is bound to
+* OUTPUTS : None, updates positions
+*/
+//-----------------------------------------------------------------
+
+void DeformedMesh::deform(Model *model)
+{
+  const StateVector* S = model->getSPointer();
+  const Real* x = S->x;
+  const Real* y = S->y;
+  const Real* z = S->z;
+
+  ThreadPool::shared().parallelFor(0, obj.NumVertex, [&](int b, int e){
+     deform(x, y, z, b, e);
+  }, 4096);
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::deform(const float *x, const float *y, const float *z)
+* PURPOSE : Compute every deformed vertex position from lattice positions
+            stored apart from the model, such as a lattice cache frame
+* INPUTS :  const float *x, *y, *z, lattice particle positions
+* OUTPUTS : None, updates positions
+*/
+//-----------------------------------------------------------------
+
+void DeformedMesh::deform(const float *x, const float *y, const float *z)
+{
+  ThreadPool::shared().parallelFor(0, obj.NumVertex, [&](int b, int e){
+     deform(x, y, z, b, e);
+  }, 4096);
+}
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::deform(const T *x, const T *y, const T *z, int begin, int end)
+* PURPOSE : Deform vertices [begin, end) from lattice positions given as
+            separate x, y, z arrays of float or double. A plain scalar
+            loop; each corner is a gather through the cell's particle
+            indices, so the pass is bound by memory, not arithmetic.
+* INPUTS :  const T *x, *y, *z, lattice particle positions
+            int begin, end, range of mesh vertices
+* OUTPUTS : None, updates positions of those vertices
+*/
+//-----------------------------------------------------------------
+
+template <class T>
+void DeformedMesh::deform(const T *x, const T *y, const T *z, int begin, int end)
+{
+  for (int j = begin; j < end; j++)
+  {
+     const MeshVertex& mv = meshVertices[j];
+     Vec3d p;
+     for (int c = 0; c < 8; c++)
+     {
+        int i = mv.index[c];
+        p += (double)mv.weight[c] * Vec3d(x[i], y[i], z[i]);
+     }
+     positions[3 * j] = p.x;
+     positions[3 * j + 1] = p.y;
+     positions[3 * j + 2] = p.z;
+  }
+}
+
+template void DeformedMesh::deform<float>(const float*, const float*, const float*, int, int);
+template void DeformedMesh::deform<double>(const double*, const double*, const double*, int, int);
+
+//-----------------------------------------------------------------
+/*
+DeformedMesh::writeObj(const char *filename)
+* PURPOSE : Write the deformed mesh as an obj, keeping the loaded normals,
+            texture coordinates and faces
+* INPUTS :  const char *filename, file to write
+* OUTPUTS : bool, false if the file could not be written
+*/
+//-----------------------------------------------------------------
+
+bool DeformedMesh::writeObj(const char *filename) const
+{
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL){
+     cerr << "Could not write " << filename << endl;
+     return false;
+  }
+
+  for (int i = 0; i < obj.NumVertex; i++)
+     fprintf(fp, "v %g %g %g\n", positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+  for (int i = 0; i < obj.NumTexCoord; i++)
+     fprintf(fp, "vt %g %g\n", obj.TexCoordArray[i].U, obj.TexCoordArray[i].V);
+  for (int i = 0; i < obj.NumNormal; i++)
+     fprintf(fp, "vn %g %g %g\n", obj.NormalArray[i].X, obj.NormalArray[i].Y, obj.NormalArray[i].Z);
+  for (int t = 0; t < obj.NumTriangle; t++)
+  {
+     const ObjTriangle& tri = obj.TriangleArray[t];
+     fputc('f', fp);
+     for (int c = 0; c < 3; c++)
+     {
+        // missing normal or texture indices are stored as -1
+        if (tri.TexCoord[c] >= 0 && tri.Normal[c] >= 0)
+           fprintf(fp, " %d/%d/%d", tri.Vertex[c] + 1, tri.TexCoord[c] + 1, tri.Normal[c] + 1);
+        else if (tri.Normal[c] >= 0)
+           fprintf(fp, " %d//%d", tri.Vertex[c] + 1, tri.Normal[c] + 1);
+        else if (tri.TexCoord[c] >= 0)
+           fprintf(fp, " %d/%d", tri.Vertex[c] + 1, tri.TexCoord[c] + 1);
+        else
+           fprintf(fp, " %d", tri.Vertex[c] + 1);
+     }
+     fputc('\n', fp);
+  }
+
+  bool ok = (ferror(fp) == 0);
+  fclose(fp);
+  return ok;
+}
@@ -0,0 +1,59 @@
+/*
+* DeformedMesh.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* The mesh carried by the lattice deformer: loads an obj, builds
+* the model's lattice around it, binds each vertex to the lattice
+* cell containing it and computes the deformed vertex positions
+* into a flat float buffer.
+* Has no OpenGL dependency, so it is shared by the interactive
+* viewer and the headless batch driver.
+*/
+
+#ifndef __DEFORMEDMESH_H__
+#define __DEFORMEDMESH_H__
+
+#include "Model.h"
+#include "objtriloader.h"
+#include "Vec3.h"
+
+// Binding of one mesh vertex to the lattice: the eight particles of the cell
+// it lies in and their trilinear weights, computed once at bind time. One
+// record is 64 bytes, a single cache line.
+struct MeshVertex
+{
+   int index[8];    // lattice particle indices of the cell corners
+   float weight[8]; // trilinear weight of each corner, summing to one
+};
+
+class DeformedMesh{
+   private:
+      ObjModel obj;
+
+      MeshVertex* meshVertices;
+      float* positions;		// deformed vertex positions, x y z per obj vertex
+
+      friend class Checkpoint;	// saves and restores the binding
+
+   public:
+      DeformedMesh();
+      ~DeformedMesh();
+
+      bool load(const char *filename);
+      void fitLattice(Model *model, float thresh = 0.02);	// build the lattice around the mesh and bind to it
+      void bind(Model *model);					// bind to the model's current lattice
+      void getBounds(Vec3f &lo, Vec3f &hi) const;			// bounding box of the rest mesh
+      void deform(Model *model);					// update positions from the lattice state
+      void deform(const float *x, const float *y, const float *z);	// from stored lattice positions
+      template <class T>
+      void deform(const T *x, const T *y, const T *z, int begin, int end);
+
+      bool writeObj(const char *filename) const;		// save the deformed mesh
+
+      const ObjModel& getObj() const {return obj;}
+      const float* getPositions() const {return positions;}
+      int getNumVertices() const {return obj.NumVertex;}
+};
+
+#endif
@@ -0,0 +1,369 @@
+/*
+* DeltaCodec.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Frame layout: one flag byte, then a little endian bit stream. The
+* residuals are coded in blocks of RICE_BLOCK values, each block
+* starting with its 6 bit Rice parameter k. A value v is written as
+* v >> k in unary, zeros ended by a one, then its low k bits. A
+* quotient of RICE_ESCAPE or more is written as RICE_ESCAPE zeros
+* and a one, then the bit length of v less one in 6 bits and v in
+* that many bits.
+*/
+
+#include "DeltaCodec.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+static const unsigned char FRAME_KEY = 1;
+static const int RICE_BLOCK = 64;
+static const int RICE_ESCAPE = 32;
+
+// largest magnitude a quantized value is clamped to
+static const double QUANT_LIMIT = 4.0e18;
+
+//
+// bit stream writer, least significant bit first
+//
+class BitWriter{
+   private:
+      vector<unsigned char> &out;
+      uint64_t acc;
+      int count;
+
+   public:
+      BitWriter(vector<unsigned char> &o) : out(o), acc(0), count(0) {}
+
+      // n at most 48
+      void put(uint64_t bits, int n){
+         acc |= bits << count;
+         count += n;
+         while (count >= 8){
+            out.push_back((unsigned char)acc);
+            acc >>= 8;
+            count -= 8;
+         }
+      }
+
+      void putLong(uint64_t bits, int n){
+         if (n > 32){
+            put(bits & 0xffffffffu, 32);
+            put(bits >> 32, n - 32);
+         }
+         else
+            put(bits, n);
+      }
+
+      void flush(){
+         if (count > 0)
+            out.push_back((unsigned char)acc);
+         acc = 0;
+         count = 0;
+      }
+};
+
+//
+// bit stream reader matching BitWriter; reading past the end sets bad
+//
+class BitReader{
+   private:
+      const unsigned char *ptr, *end;
+      uint64_t acc;
+      int count;
+
+      void refill(){
+         while (count <= 56 && ptr < end){
+            acc |= (uint64_t)(*ptr++) << count;
+            count += 8;
+         }
+      }
+
+   public:
+      bool bad;
+
+      BitReader(const unsigned char *p, const unsigned char *e) : ptr(p), end(e), acc(0), count(0), bad(false) {}
+
+      // n at most 32
+      uint64_t get(int n){
+         if (n == 0)
+            return 0;
+         refill();
+         if (count < n){
+            bad = true;
+            return 0;
+         }
+         uint64_t bits = acc & ((1ull << n) - 1);
+         acc >>= n;
+         count -= n;
+         return bits;
+      }
+
+      uint64_t getLong(int n){
+         if (n > 32){
+            uint64_t lo = get(32);
+            return lo | (get(n - 32) << 32);
+         }
+         return get(n);
+      }
+
+      // zeros before the next one, which is consumed
+      int unary(){
+         refill();
+         if (acc == 0){
+            bad = true;
+            return 0;
+         }
+         int z = __builtin_ctzll(acc);
+         if (z >= count){
+            bad = true;
+            return 0;
+         }
+         acc >>= z + 1;
+         count -= z + 1;
+         return z;
+      }
+};
+
+static inline uint64_t zigzag(uint64_t r)
+{
+   return (r << 1) ^ (uint64_t)((int64_t)r >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t z)
+{
+   return (z >> 1) ^ (0 - (z & 1));
+}
+
+static int bitLength(uint64_t v)
+{
+   return v == 0 ? 1 : 64 - __builtin_clzll(v);
+}
+
+//
+// Rice parameter minimizing the coded size of a block, ignoring escapes
+//
+static int riceParameter(const uint64_t *z, int n)
+{
+   double mean = 0;
+   for (int i = 0; i < n; i++)
+      mean += (double)z[i];
+   mean /= n;
+
+   int k0 = (mean < 2) ? 0 : (int)floor(log2(mean));
+   int best = k0;
+   double bestCost = -1;
+   for (int k = (k0 > 0 ? k0 - 1 : 0); k <= k0 + 1 && k < 64; k++){
+      double cost = (double)n * (k + 1);
+      for (int i = 0; i < n; i++){
+         uint64_t quotient = z[i] >> k;
+         cost += (quotient < (uint64_t)RICE_ESCAPE) ? (double)quotient : RICE_ESCAPE + 6 + bitLength(z[i]);
+      }
+      if (bestCost < 0 || cost < bestCost){
+         bestCost = cost;
+         best = k;
+      }
+   }
+   return best;
+}
+
+//-----------------------------------------------------------------
+/*
+DeltaCodec::DeltaCodec()
+* PURPOSE : Default constructor, an empty codec
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+DeltaCodec::DeltaCodec()
+{
+   numValues = 0;
+   prev = prev2 = NULL;
+   history = 0;
+}
+
+DeltaCodec::~DeltaCodec()
+{
+   delete[] prev;
+   delete[] prev2;
+}
+
+//-----------------------------------------------------------------
+/*
+DeltaCodec::reset()
+* PURPOSE : Size the codec for a frame length and forget the history
+* INPUTS :  int n, values per frame
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void DeltaCodec::reset(int n)
+{
+   if (n != numValues){
+      delete[] prev;
+      delete[] prev2;
+      numValues = n;
+      prev = new int64_t[n > 0 ? n : 1];
+      prev2 = new int64_t[n > 0 ? n : 1];
+   }
+   history = 0;
+}
+
+//-----------------------------------------------------------------
+/*
+DeltaCodec::encode()
+* PURPOSE : Code one frame: predict each value from the last two
+            frames, zigzag the residuals and Rice code them
+* INPUTS :  const int64_t *q, numValues quantized values
+*           bool keyframe, code without prediction
+*           vector<unsigned char> &out, the code is appended here
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void DeltaCodec::encode(const int64_t *q, bool keyframe, vector<unsigned char> &out)
+{
+   if (keyframe)
+      history = 0;
+   out.push_back(history == 0 ? FRAME_KEY : 0);
+
+   // residuals are taken modulo 2^64, so they undo exactly on decode
+   BitWriter bits(out);
+   uint64_t z[RICE_BLOCK];
+   for (int start = 0; start < numValues; start += RICE_BLOCK){
+      int n = (numValues - start < RICE_BLOCK) ? numValues - start : RICE_BLOCK;
+      for (int i = 0; i < n; i++){
+         int j = start + i;
+         uint64_t pred = (history == 0) ? 0 :
+                         (history == 1) ? (uint64_t)prev[j] :
+                         2 * (uint64_t)prev[j] - (uint64_t)prev2[j];
+         z[i] = zigzag((uint64_t)q[j] - pred);
+      }
+
+      int k = riceParameter(z, n);
+      bits.put(k, 6);
+      for (int i = 0; i < n; i++){
+         uint64_t quotient = z[i] >> k;
+         if (quotient < (uint64_t)RICE_ESCAPE){
+            bits.put(1ull << quotient, (int)quotient + 1);
+            bits.putLong(z[i] & ((k < 64) ? (1ull << k) - 1 : ~0ull), k);
+         }
+         else{
+            int len = bitLength(z[i]);
+            bits.put(1ull << RICE_ESCAPE, RICE_ESCAPE + 1);
+            bits.put(len - 1, 6);
+            bits.putLong(z[i], len);
+         }
+      }
+   }
+   bits.flush();
+
+   int64_t *t = prev2;
+   prev2 = prev;
+   prev = t;
+   memcpy(prev, q, numValues * sizeof(int64_t));
+   if (history < 2)
+      history++;
+}
+
+//-----------------------------------------------------------------
+/*
+DeltaCodec::decode()
+* PURPOSE : Decode one frame coded by encode()
+* INPUTS :  const unsigned char *in, the frame's code
+*           size_t bytes, its length
+*           int64_t *q, receives numValues quantized values
+* OUTPUTS : bool, false if the code is damaged or a delta frame has
+            no history to follow
+*/
+//-----------------------------------------------------------------
+
+bool DeltaCodec::decode(const unsigned char *in, size_t bytes, int64_t *q)
+{
+   if (bytes < 1)
+      return false;
+   if (in[0] & FRAME_KEY)
+      history = 0;
+   else if (history == 0)
+      return false;
+
+   BitReader bits(in + 1, in + bytes);
+   for (int start = 0; start < numValues; start += RICE_BLOCK){
+      int n = (numValues - start < RICE_BLOCK) ? numValues - start : RICE_BLOCK;
+      int k = (int)bits.get(6);
+      for (int i = 0; i < n; i++){
+         uint64_t z;
+         int quotient = bits.unary();
+         if (quotient < RICE_ESCAPE)
+            z = ((uint64_t)quotient << k) | bits.getLong(k);
+         else
+            z = bits.getLong((int)bits.get(6) + 1);
+
+         int j = start + i;
+         uint64_t pred = (history == 0) ? 0 :
+                         (history == 1) ? (uint64_t)prev[j] :
+                         2 * (uint64_t)prev[j] - (uint64_t)prev2[j];
+         q[j] = (int64_t)(pred + unzigzag(z));
+      }
+      if (bits.bad){
+         history = 0;
+         return false;
+      }
+   }
+
+   int64_t *t = prev2;
+   prev2 = prev;
+   prev = t;
+   memcpy(prev, q, numValues * sizeof(int64_t));
+   if (history < 2)
+      history++;
+   return true;
+}
+
+bool DeltaCodec::isKeyframe(const unsigned char *in, size_t bytes)
+{
+   return bytes > 0 && (in[0] & FRAME_KEY);
+}
+
+//-----------------------------------------------------------------
+/*
+DeltaCodec::quantize()
+* PURPOSE : Quantize values against a reference. Values too far off
+            to represent, or not numbers, are clamped.
+* INPUTS :  const Real *v, values
+*           const Ref *ref, reference values
+*           int n, number of values
+*           double step, quantization step
+*           int64_t *q, receives the quantized values
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class Real, class Ref>
+void DeltaCodec::quantize(const Real *v, const Ref *ref, int n, double step, int64_t *q)
+{
+   double inv = 1.0 / step;
+   for (int i = 0; i < n; i++){
+      double d = ((double)v[i] - (double)ref[i]) * inv;
+      if (!(fabs(d) < QUANT_LIMIT))
+         d = (d > 0) ? QUANT_LIMIT : (d < 0) ? -QUANT_LIMIT : 0;
+      q[i] = llrint(d);
+   }
+}
+
+template<class Real, class Ref>
+void DeltaCodec::dequantize(const int64_t *q, const Ref *ref, int n, double step, Real *v)
+{
+   for (int i = 0; i < n; i++)
+      v[i] = (Real)((double)ref[i] + (double)q[i] * step);
+}
+
+template void DeltaCodec::quantize<float, float>(const float*, const float*, int, double, int64_t*);
+template void DeltaCodec::quantize<double, float>(const double*, const float*, int, double, int64_t*);
+template void DeltaCodec::quantize<double, double>(const double*, const double*, int, double, int64_t*);
+template void DeltaCodec::dequantize<float, float>(const int64_t*, const float*, int, double, float*);
+template void DeltaCodec::dequantize<double, double>(const int64_t*, const double*, int, double, double*);
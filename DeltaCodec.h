@@ -0,0 +1,60 @@
+/*
+* DeltaCodec.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Compression for lattice trajectories. Values are quantized against
+* a reference, normally the rest lattice, with a step of twice the
+* error bound, so every decoded value lies within the bound of the
+* original, up to the rounding of the type it is decoded to. Each
+* frame of quantized values is predicted from the two frames before
+* it, and the zigzagged residuals are written with a Rice code whose
+* parameter adapts per block of values. A keyframe
+* codes the quantized values with no prediction, so decoding can
+* start there. The quantized values themselves are coded losslessly,
+* so errors never accumulate from frame to frame.
+*/
+
+#ifndef __DELTACODEC_H__
+#define __DELTACODEC_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+class DeltaCodec{
+   private:
+      int numValues;
+      int64_t *prev, *prev2;	// quantized values of the last two frames
+      int history;		// frames available for prediction, 0 to 2
+
+   public:
+      DeltaCodec();
+      ~DeltaCodec();
+      DeltaCodec(const DeltaCodec&) = delete;
+      DeltaCodec& operator=(const DeltaCodec&) = delete;
+
+      // Size for frames of numValues values and forget the history
+      void reset(int numValues);
+
+      // Append the code for one frame of quantized values to out. The
+      // first frame after a reset is always a keyframe.
+      void encode(const int64_t *q, bool keyframe, std::vector<unsigned char> &out);
+
+      // Decode one frame of bytes bytes into q. Unless it is a keyframe
+      // it must be the frame encoded right after the last one decoded.
+      bool decode(const unsigned char *in, size_t bytes, int64_t *q);
+
+      static bool isKeyframe(const unsigned char *in, size_t bytes);
+
+      // quantization step giving the error bound
+      static double quantStep(double errorBound) {return 2 * errorBound;}
+
+      // q[i] = round((v[i] - ref[i]) / step), and back
+      template<class Real, class Ref>
+      static void quantize(const Real *v, const Ref *ref, int n, double step, int64_t *q);
+      template<class Real, class Ref>
+      static void dequantize(const int64_t *q, const Ref *ref, int n, double step, Real *v);
+};
+
+#endif
@@ -0,0 +1,471 @@
+/*
+* ImplicitSolver.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* With u the unit vector along a strut of length l, rest length L,
+* spring constant k and damping d, the strut's stiffness block is
+* k (c (I - u u^T) + u u^T), c = max(0, 1 - L / l), and its damping
+* block is d u u^T. Clamping c keeps the stiffness positive semidefinite
+* for compressed struts, so the system matrix is symmetric positive
+* definite and conjugate gradients converges. Linearizing
+*
+*    M (v1 - v0) = h f(x0 + h v1, v1)
+*
+* about x0 and solving for v1 directly gives
+*
+*    (M + h D + h^2 K) v1 = M v0 + h (f_spring + f_external)
+*
+* since the damping force is D v0 exactly. Pinned particles keep their
+* velocity: their rows become the identity and their couplings move to
+* the right hand side, which keeps the matrix symmetric. Compiled for
+* float and double.
+*/
+
+#include "ImplicitSolver.h"
+
+#include <cmath>
+
+using namespace std;
+
+// reductions are split into at most SUM_CHUNKS ranges of at least
+// SUM_GRAIN particles, independent of the thread count, so a run
+// gives the same result on any machine
+static const int SUM_CHUNKS = 64;
+static const int SUM_GRAIN = 1024;
+
+//
+// run fn(b, e, partial) over chunks of [0, n) in parallel, each adding
+// its N sums to partial, and total the chunks in sums
+//
+template<class S, int N, class Fn>
+static void parallelSums(ThreadPool& pool, int n, S* sums, Fn fn)
+{
+   int chunks = (n + SUM_GRAIN - 1) / SUM_GRAIN;
+   if (chunks > SUM_CHUNKS) chunks = SUM_CHUNKS;
+   if (chunks < 1) chunks = 1;
+
+   S partial[SUM_CHUNKS][N];
+   pool.parallelFor(0, chunks, [&](int cb, int ce){
+      for (int c = cb; c < ce; c++){
+         for (int k = 0; k < N; k++)
+            partial[c][k] = 0;
+         fn((int)((long)n * c / chunks), (int)((long)n * (c + 1) / chunks), partial[c]);
+      }
+   });
+
+   for (int k = 0; k < N; k++)
+      sums[k] = 0;
+   for (int c = 0; c < chunks; c++)
+      for (int k = 0; k < N; k++)
+         sums[k] += partial[c][k];
+}
+
+//
+// y = B x for a 3x3 row major block
+//
+template<class T>
+static inline void blockMultiplyAdd(const T* B, const T* x, T* y)
+{
+   y[0] += B[0] * x[0] + B[1] * x[1] + B[2] * x[2];
+   y[1] += B[3] * x[0] + B[4] * x[1] + B[5] * x[2];
+   y[2] += B[6] * x[0] + B[7] * x[1] + B[8] * x[2];
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::ImplicitSolver()
+* PURPOSE : Default constructor, no block structure yet
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+ImplicitSolverT<T>::ImplicitSolverT()
+{
+   numParticles = numStruts = numBlocks = 0;
+   rowStart = column = diagBlock = strutBlock = NULL;
+   blocks = precond = NULL;
+   rhs = v = r = z = p = Ap = NULL;
+
+   tolerance = 1.0e-5;
+   maxIterations = 200;
+   iterations = 0;
+   residual = 0;
+}
+
+template<class T>
+ImplicitSolverT<T>::~ImplicitSolverT()
+{
+   release();
+}
+
+template<class T>
+void ImplicitSolverT<T>::release()
+{
+   delete[] rowStart;
+   delete[] column;
+   delete[] diagBlock;
+   delete[] strutBlock;
+   delete[] blocks;
+   delete[] precond;
+   delete[] rhs;
+   delete[] v;
+   delete[] r;
+   delete[] z;
+   delete[] p;
+   delete[] Ap;
+   rowStart = column = diagBlock = strutBlock = NULL;
+   blocks = precond = NULL;
+   rhs = v = r = z = p = Ap = NULL;
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::reset()
+* PURPOSE : Forget the block structure. Call whenever the struts are
+            rebuilt or reordered; the next step builds it again.
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::reset()
+{
+   release();
+   numParticles = numStruts = numBlocks = 0;
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::setTolerance()
+* PURPOSE : Set when the conjugate gradient solve stops
+* INPUTS :  double tol, residual relative to the right hand side
+*           int maxIter, iteration limit
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::setTolerance(double tol, int maxIter)
+{
+   tolerance = tol;
+   maxIterations = maxIter;
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::build()
+* PURPOSE : Lay out the block rows: the diagonal block of each particle
+            followed by one block per strut at the particle
+* INPUTS :  const StrutSet& struts, the struts in their final order
+*           int np, number of particles
+* OUTPUTS : None, allocates the matrix and the solver vectors
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::build(const StrutSetT<T>& struts, int np)
+{
+   release();
+   numParticles = np;
+   numStruts = struts.getNumStruts();
+   numBlocks = np + 2 * numStruts;
+
+   rowStart = new int[np + 1];
+   column = new int[numBlocks > 0 ? numBlocks : 1];
+   diagBlock = new int[np > 0 ? np : 1];
+   strutBlock = new int[numStruts > 0 ? 2 * numStruts : 1];
+   blocks = new T[numBlocks > 0 ? 9 * numBlocks : 1];
+   precond = new T[np > 0 ? 9 * np : 1];
+   rhs = new T[np > 0 ? 3 * np : 1];
+   v = new T[np > 0 ? 3 * np : 1];
+   r = new T[np > 0 ? 3 * np : 1];
+   z = new T[np > 0 ? 3 * np : 1];
+   p = new T[np > 0 ? 3 * np : 1];
+   Ap = new T[np > 0 ? 3 * np : 1];
+
+   // row lengths, then their running sum
+   for (int i = 0; i < np; i++)
+      rowStart[i + 1] = 1;
+   for (int s = 0; s < numStruts; s++){
+      rowStart[struts.i0[s] + 1]++;
+      rowStart[struts.i1[s] + 1]++;
+   }
+   rowStart[0] = 0;
+   for (int i = 0; i < np; i++)
+      rowStart[i + 1] += rowStart[i];
+
+   int* next = new int[np > 0 ? np : 1];
+   for (int i = 0; i < np; i++){
+      diagBlock[i] = rowStart[i];
+      column[rowStart[i]] = i;
+      next[i] = rowStart[i] + 1;
+   }
+   for (int s = 0; s < numStruts; s++){
+      int i = struts.i0[s];
+      int j = struts.i1[s];
+      strutBlock[2 * s] = next[i];
+      column[next[i]++] = j;
+      strutBlock[2 * s + 1] = next[j];
+      column[next[j]++] = i;
+   }
+   delete[] next;
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::assemble()
+* PURPOSE : Fill the system matrix, the right hand side, the
+            preconditioner and the initial guess for one step
+* INPUTS :  const StateVector& state, positions and velocities at the
+            start of the step
+*           const ParticleStore& particles, masses, pinning and gravity
+*           const StrutSet& struts, the struts
+*           double h, time step
+*           ThreadPool& pool, threads to use
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::assemble(const StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+                                  const StrutSetT<T>& struts, double h, ThreadPool& pool)
+{
+   const Vec3T<T> g = particles.gravity;
+
+   // mass on the diagonal, momentum plus gravity impulse on the right;
+   // pinned rows are the identity and keep their velocity
+   pool.parallelFor(0, numParticles, [&](int b, int e){
+      for (int i = b; i < e; i++){
+         T* B = blocks + 9 * diagBlock[i];
+         T m = particles.pinned[i] ? 1 : particles.mass[i];
+         B[0] = m; B[1] = 0; B[2] = 0;
+         B[3] = 0; B[4] = m; B[5] = 0;
+         B[6] = 0; B[7] = 0; B[8] = m;
+
+         Vec3T<T> vi = state.velocity(i);
+         T* R = rhs + 3 * i;
+         if (particles.pinned[i]){
+            R[0] = vi.x; R[1] = vi.y; R[2] = vi.z;
+         }
+         else{
+            R[0] = m * (vi.x + (T)h * g.x);
+            R[1] = m * (vi.y + (T)h * g.y);
+            R[2] = m * (vi.z + (T)h * g.z);
+         }
+         v[3 * i] = vi.x; v[3 * i + 1] = vi.y; v[3 * i + 2] = vi.z;
+      }
+   }, 1024);
+
+   // struts of one color share no particle, so their diagonal blocks and
+   // right hand sides can be updated from many threads at once
+   for (int c = 0; c < struts.getNumColors(); c++){
+      pool.parallelFor(struts.colorBegin(c), struts.colorEnd(c), [&](int b, int e){
+         for (int s = b; s < e; s++){
+            int i = struts.i0[s];
+            int j = struts.i1[s];
+            T* Bij = blocks + 9 * strutBlock[2 * s];
+            T* Bji = blocks + 9 * strutBlock[2 * s + 1];
+
+            Vec3T<T> dx = state.position(j) - state.position(i);
+            T l = norm(dx);
+            if (!(l > 0)){
+               for (int a = 0; a < 9; a++)
+                  Bij[a] = Bji[a] = 0;
+               continue;
+            }
+            Vec3T<T> u = dx / l;
+
+            // H = h D + h^2 K = alpha I + beta u u^T
+            T ratio = struts.l_rest[s] / l;
+            T clamp = (ratio < 1) ? 1 - ratio : 0;
+            T alpha = (T)(h * h) * struts.k[s] * clamp;
+            T beta = (T)h * struts.d[s] + (T)(h * h) * struts.k[s] * (1 - clamp);
+            T H[9];
+            for (int a = 0; a < 3; a++)
+               for (int bb = 0; bb < 3; bb++)
+                  H[3 * a + bb] = beta * u[a] * u[bb] + (a == bb ? alpha : 0);
+
+            // spring impulse, the damper is implicit in H
+            Vec3T<T> f = u * ((T)h * struts.k[s] * (l - struts.l_rest[s]));
+
+            bool pi = particles.pinned[i] != 0;
+            bool pj = particles.pinned[j] != 0;
+            if (!pi){
+               T* D = blocks + 9 * diagBlock[i];
+               for (int a = 0; a < 9; a++)
+                  D[a] += H[a];
+               T* R = rhs + 3 * i;
+               R[0] += f.x; R[1] += f.y; R[2] += f.z;
+               if (pj)
+                  blockMultiplyAdd(H, v + 3 * j, R);
+            }
+            if (!pj){
+               T* D = blocks + 9 * diagBlock[j];
+               for (int a = 0; a < 9; a++)
+                  D[a] += H[a];
+               T* R = rhs + 3 * j;
+               R[0] -= f.x; R[1] -= f.y; R[2] -= f.z;
+               if (pi)
+                  blockMultiplyAdd(H, v + 3 * i, R);
+            }
+            for (int a = 0; a < 9; a++)
+               Bij[a] = Bji[a] = (pi || pj) ? 0 : -H[a];
+         }
+      }, 256);
+   }
+
+   // invert the symmetric diagonal blocks for the preconditioner
+   pool.parallelFor(0, numParticles, [&](int b, int e){
+      for (int i = b; i < e; i++){
+         const T* B = blocks + 9 * diagBlock[i];
+         T* P = precond + 9 * i;
+         T c00 = B[4] * B[8] - B[5] * B[7];
+         T c01 = B[5] * B[6] - B[3] * B[8];
+         T c02 = B[3] * B[7] - B[4] * B[6];
+         T inv = 1 / (B[0] * c00 + B[1] * c01 + B[2] * c02);
+         P[0] = c00 * inv;
+         P[1] = (B[2] * B[7] - B[1] * B[8]) * inv;
+         P[2] = (B[1] * B[5] - B[2] * B[4]) * inv;
+         P[3] = c01 * inv;
+         P[4] = (B[0] * B[8] - B[2] * B[6]) * inv;
+         P[5] = (B[2] * B[3] - B[0] * B[5]) * inv;
+         P[6] = c02 * inv;
+         P[7] = (B[1] * B[6] - B[0] * B[7]) * inv;
+         P[8] = (B[0] * B[4] - B[1] * B[3]) * inv;
+      }
+   }, 1024);
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::solve()
+* PURPOSE : Preconditioned conjugate gradients on the assembled system,
+            starting from the velocities at the start of the step. Stops
+            when the residual falls below tolerance times the right hand
+            side, or after maxIterations.
+* INPUTS :  ThreadPool& pool, threads to use
+* OUTPUTS : None, leaves the new velocities in v
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::solve(ThreadPool& pool)
+{
+   int np = numParticles;
+   Sum sums[3];
+
+   // r = rhs - A v, z = P r, p = z
+   parallelSums<Sum, 3>(pool, np, sums, [&](int b, int e, Sum* part){
+      for (int i = b; i < e; i++){
+         T y[3] = {0, 0, 0};
+         for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            blockMultiplyAdd(blocks + 9 * k, v + 3 * column[k], y);
+         T* ri = r + 3 * i;
+         T* zi = z + 3 * i;
+         for (int a = 0; a < 3; a++)
+            ri[a] = rhs[3 * i + a] - y[a];
+         zi[0] = zi[1] = zi[2] = 0;
+         blockMultiplyAdd(precond + 9 * i, ri, zi);
+         for (int a = 0; a < 3; a++){
+            p[3 * i + a] = zi[a];
+            part[0] += (Sum)ri[a] * zi[a];
+            part[1] += (Sum)ri[a] * ri[a];
+            part[2] += (Sum)rhs[3 * i + a] * rhs[3 * i + a];
+         }
+      }
+   });
+   Sum rz = sums[0];
+   Sum rr = sums[1];
+   Sum bb = sums[2];
+   Sum limit = (Sum)(tolerance * tolerance) * bb;
+
+   iterations = 0;
+   while (rr > limit && iterations < maxIterations){
+      // Ap = A p
+      parallelSums<Sum, 1>(pool, np, sums, [&](int b, int e, Sum* part){
+         for (int i = b; i < e; i++){
+            T* y = Ap + 3 * i;
+            y[0] = y[1] = y[2] = 0;
+            for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+               blockMultiplyAdd(blocks + 9 * k, p + 3 * column[k], y);
+            for (int a = 0; a < 3; a++)
+               part[0] += (Sum)p[3 * i + a] * y[a];
+         }
+      });
+      if (!(sums[0] > 0))
+         break;
+      T alpha = (T)(rz / sums[0]);
+
+      // step along p, update the residual and precondition it
+      parallelSums<Sum, 2>(pool, np, sums, [&](int b, int e, Sum* part){
+         for (int i = b; i < e; i++){
+            T* ri = r + 3 * i;
+            T* zi = z + 3 * i;
+            for (int a = 0; a < 3; a++){
+               v[3 * i + a] += alpha * p[3 * i + a];
+               ri[a] -= alpha * Ap[3 * i + a];
+            }
+            zi[0] = zi[1] = zi[2] = 0;
+            blockMultiplyAdd(precond + 9 * i, ri, zi);
+            for (int a = 0; a < 3; a++){
+               part[0] += (Sum)ri[a] * zi[a];
+               part[1] += (Sum)ri[a] * ri[a];
+            }
+         }
+      });
+      iterations++;
+      T beta = (T)(sums[0] / rz);
+      rz = sums[0];
+      rr = sums[1];
+      if (rr <= limit)
+         break;
+
+      pool.parallelFor(0, 3 * np, [&](int b, int e){
+         for (int a = b; a < e; a++)
+            p[a] = z[a] + beta * p[a];
+      }, 4096);
+   }
+
+   residual = (bb > 0) ? sqrt((double)(rr / bb)) : 0;
+}
+
+//-----------------------------------------------------------------
+/*
+ImplicitSolver::step()
+* PURPOSE : Advance the state one backward Euler step: solve for the
+            new velocities, then move the particles with them
+* INPUTS :  StateVector& state, the state, advanced in place
+*           const ParticleStore& particles, masses, pinning and gravity
+*           const StrutSet& struts, the struts
+*           double h, time step
+*           ThreadPool& pool, threads to use
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ImplicitSolverT<T>::step(StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+                              const StrutSetT<T>& struts, double h, ThreadPool& pool)
+{
+   int np = state.getNumParticles();
+   if (rowStart == NULL || np != numParticles || struts.getNumStruts() != numStruts)
+      build(struts, np);
+
+   assemble(state, particles, struts, h, pool);
+   solve(pool);
+
+   pool.parallelFor(0, np, [&](int b, int e){
+      for (int i = b; i < e; i++){
+         Vec3T<T> vi(v[3 * i], v[3 * i + 1], v[3 * i + 2]);
+         state.setVelocity(i, vi);
+         state.setPosition(i, state.position(i) + vi * (T)h);
+      }
+   }, 1024);
+}
+
+template class ImplicitSolverT<float>;
+template class ImplicitSolverT<double>;
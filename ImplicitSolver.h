@@ -0,0 +1,75 @@
+/*
+* ImplicitSolver.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Linearized backward Euler step for the strut lattice. Each step
+* assembles the system matrix M + h D + h^2 K, where D and K are the
+* damping and stiffness Jacobians of the struts, into a sparse matrix
+* of 3x3 blocks with one block row per particle, and solves it for the
+* new velocities with conjugate gradients preconditioned by the inverse
+* diagonal blocks. The step is stable far beyond the step size RK4
+* allows, at the price of numerical damping.
+*
+* The block structure follows the strut set's order, so assembly runs
+* over the same conflict free color batches as the force kernel.
+*/
+
+#ifndef __IMPLICITSOLVER_H__
+#define __IMPLICITSOLVER_H__
+
+#include "StateVector.h"
+#include "ParticleStore.h"
+#include "Strut.h"
+#include "ThreadPool.h"
+#include "Precision.h"
+
+template<class T>
+class ImplicitSolverT{
+	private:
+		typedef typename Accum<T>::type Sum;
+
+		int numParticles;
+		int numStruts;
+		int numBlocks;
+
+		int* rowStart;		// block row i is blocks [rowStart[i], rowStart[i + 1])
+		int* column;		// block column of each block
+		int* diagBlock;		// block (i, i) of each row
+		int* strutBlock;	// blocks (i0, i1) and (i1, i0) of strut s at 2s and 2s + 1
+		T* blocks;		// 9 entries per block, row major
+		T* precond;		// inverse of each diagonal block, 9 per particle
+
+		// 3 * numParticles vectors, x y z interleaved per particle
+		T *rhs, *v, *r, *z, *p, *Ap;
+
+		double tolerance;
+		int maxIterations;
+		int iterations;		// of the last solve
+		double residual;	// relative residual the last solve reached
+
+		void release();
+		void build(const StrutSetT<T>& struts, int np);
+		void assemble(const StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+		              const StrutSetT<T>& struts, double h, ThreadPool& pool);
+		void solve(ThreadPool& pool);
+
+	public:
+		ImplicitSolverT();
+		~ImplicitSolverT();
+
+		void reset();		// forget the block structure, rebuilt on the next step
+		void setTolerance(double tol, int maxIter);
+
+		// advance state by h in place
+		void step(StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+		          const StrutSetT<T>& struts, double h, ThreadPool& pool);
+
+		int getIterations() const {return iterations;}
+		double getResidual() const {return residual;}
+};
+
+// the solver the simulation runs in
+typedef ImplicitSolverT<Real> ImplicitSolver;
+
+#endif
@@ -9,20 +9,37 @@
 
 #include "Lattice.h"
 #include "Cell.h"
-#include "Vector.h"
 #include <math.h>
 using namespace std;
 
 Lattice::Lattice()
 {
    numCells = 0;
+   numPlanes = numRows = numCols = 0;
+   cellWidth = cellHeight = cellDepth = 0;
+   minX = minY = minZ = maxX = maxY = maxZ = 0;
    cells = NULL;
 }
 
-Lattice::Lattice(int nc)
+//-----------------------------------------------------------------
+/*
+Lattice::Lattice(int planes, int rows, int cols)
+* PURPOSE : Variable constructor, cell (p, r, c) is stored at index
+            (p * rows + r) * cols + c
+* INPUTS :  int planes, rows, cols, number of cells along z, y and x
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+Lattice::Lattice(int planes, int rows, int cols)
 {
-   numCells = nc;
-   cells = new Cell[nc];
+   numPlanes = planes;
+   numRows = rows;
+   numCols = cols;
+   numCells = planes * rows * cols;
+   cellWidth = cellHeight = cellDepth = 0;
+   minX = minY = minZ = maxX = maxY = maxZ = 0;
+   cells = new Cell[numCells];
 }
 
 void Lattice::setBounds(float minx, float miny, float minz, float maxx, float maxy, float maxz)
@@ -42,32 +59,54 @@ void Lattice::setCellDimensions(float w, float h, float d)
    cellDepth = d;
 }
 
+//-----------------------------------------------------------------
+/*
+Lattice::searchCellIndex(float x, float y, float z)
+* PURPOSE : Find the cell containing a point by direct computation from the
+            lattice bounds and cell dimensions. A point on a face shared by
+            two cells belongs to the cell on its positive side; points on the
+            outer max faces belong to the last cell along that axis.
+* INPUTS :  float x, y, z, point to locate
+* OUTPUTS : int, index of the containing cell, or -1 if the point lies
+            outside the lattice
+*/
+//-----------------------------------------------------------------
+
 int Lattice::searchCellIndex(float x, float y, float z)
 {
-   int index = -1;
-   for (int i = 0; i < numCells; i++)
-   {
-      //cout << cells[i].cellMinX << endl;
-      if (x >= cells[i].cellMinX && x <= cells[i].cellMaxX){
-         if(y >= cells[i].cellMinY && y <= cells[i].cellMaxY){
-            if(z >= cells[i].cellMinZ && z <= cells[i].cellMaxZ){
-               index = i;
-            }
-         }
-      }
-   
-   }
+   if (x < minX || x > maxX || y < minY || y > maxY || z < minZ || z > maxZ)
+      return -1;
 
-    if (index == -1){
-      cout << x << " " << y << " " << z << endl;
-      cout << minX << " " << maxX << endl;
-      cout << minY << " " << maxY << endl;
-      cout << minZ << " " << maxZ << endl;
-      cout << endl;
+   return nearestCellIndex(x, y, z);
 }
 
-   return index;
+//-----------------------------------------------------------------
+/*
+Lattice::nearestCellIndex(float x, float y, float z)
+* PURPOSE : As searchCellIndex, but a point outside the lattice is assigned
+            to the boundary cell nearest to it, so trilinear weights computed
+            against that cell extrapolate smoothly
+* INPUTS :  float x, y, z, point to locate
+* OUTPUTS : int, index of the cell, -1 only if the lattice has no cells
+*/
+//-----------------------------------------------------------------
+
+static int cellCoord(double v, double vmin, double size, int count)
+{
+   int i = (size > 0) ? (int)floor((v - vmin) / size) : 0;
+   if (i < 0) i = 0;
+   if (i > count - 1) i = count - 1;
+   return i;
 }
 
+int Lattice::nearestCellIndex(float x, float y, float z)
+{
+   if (numCells == 0)
+      return -1;
 
+   int c = cellCoord(x, minX, cellWidth, numCols);
+   int r = cellCoord(y, minY, cellHeight, numRows);
+   int p = cellCoord(z, minZ, cellDepth, numPlanes);
 
+   return (p * numRows + r) * numCols + c;
+}
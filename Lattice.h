@@ -7,28 +7,44 @@
 #ifndef __LATTICE_H__
 #define __LATTICE_H__
 
-#include "Vector.h"
 #include "Cell.h"
 
 class Lattice{
    private:
       int numCells;
+      int numPlanes;	// cells along z
+      int numRows;	// cells along y
+      int numCols;	// cells along x
       float cellWidth;
       float cellHeight;
       float cellDepth;
       float minX, minY, minZ, maxX, maxY, maxZ;
 
+      friend class Checkpoint;	// saves and restores the private state
+
    public:      
       Cell* cells;
 
       Lattice();
-      Lattice(int nc);
+      Lattice(int planes, int rows, int cols);
 
       void setBounds(float minx, float miny, float minz, float maxx, float maxy, float maxz);
 
       void setCellDimensions(float w, float h, float d);
 
-      int searchCellIndex(float x, float y, float z);
+      int searchCellIndex(float x, float y, float z);	// -1 if outside the lattice
+      int nearestCellIndex(float x, float y, float z);	// clamps outside points to the boundary cells
+
+      int getNumCells(){return numCells;}
+      int getNumPlanes(){return numPlanes;}
+      int getNumRows(){return numRows;}
+      int getNumCols(){return numCols;}
+      float getMinX(){return minX;}
+      float getMinY(){return minY;}
+      float getMinZ(){return minZ;}
+      float getMaxX(){return maxX;}
+      float getMaxY(){return maxY;}
+      float getMaxZ(){return maxZ;}
 };	
 
 #endif
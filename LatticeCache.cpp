@@ -0,0 +1,433 @@
+/*
+* LatticeCache.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* File layout: a fixed header, then from a 64 byte aligned offset
+* one block per frame of float x[n], y[n], z[n]. The frame count is
+* patched into the header on close; a file cut short by a crash is
+* still readable up to its last whole frame.
+*
+* A compressed cache has the float x, y, z arrays of the rest lattice
+* after the header, then from the frames offset one record per frame:
+* its byte count as a uint32 and the DeltaCodec code.
+*/
+
+#include "LatticeCache.h"
+#include "Model.h"
+#include "StateVector.h"
+#include "Lattice.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char LATTICECACHE_MAGIC[8] = {'S', 'S', 'L', 'A', 'T', 'T', 'C', '\0'};
+static const uint32_t LATTICECACHE_VERSION = 1;
+static const uint32_t LATTICECACHE_BYTEORDER = 0x01020304;
+static const uint64_t LATTICECACHE_FRAMES_OFFSET = 128;
+static const uint64_t LATTICECACHE_ALIGN = 64;
+
+enum {RAW_FRAMES, DELTA_FRAMES};
+
+struct LatticeCacheHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byteOrder;
+   int32_t numParticles;
+   int32_t numFrames;		// 0 until the cache is closed
+   int32_t planes, rows, cols;
+   int32_t frameInterval;	// simulation steps between frames
+   float timeStep;
+   float bounds[6];
+   uint64_t framesOffset;
+
+   // compression
+   int32_t codec;		// RAW_FRAMES or DELTA_FRAMES
+   int32_t keyframeInterval;
+   double errorBound;
+   uint64_t restOffset;		// rest lattice, for DELTA_FRAMES
+};
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheWriter::LatticeCacheWriter()
+* PURPOSE : Default constructor, a closed writer
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+LatticeCacheWriter::LatticeCacheWriter()
+{
+   fp = NULL;
+   numParticles = numFrames = 0;
+   frame = NULL;
+   step = 0;
+   keyframeInterval = 1;
+   rest = NULL;
+   quant = NULL;
+}
+
+LatticeCacheWriter::~LatticeCacheWriter()
+{
+   close();
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheWriter::open()
+* PURPOSE : Create the cache and write its header
+* INPUTS :  const char *filename, file to create
+*           Model &model, simulation whose lattice is recorded
+*           int frameInterval, simulation steps between frames
+*           double errorBound, compress frames to this accuracy; 0
+*           stores raw floats
+*           int keyframeInterval, frames between keyframes
+* OUTPUTS : bool, false if the file could not be created
+*/
+//-----------------------------------------------------------------
+
+bool LatticeCacheWriter::open(const char *filename, Model &model, int frameInterval,
+                              double errorBound, int keyframeInterval)
+{
+   close();
+
+   Lattice *L = model.getLPointer();
+   LatticeCacheHeader hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, LATTICECACHE_MAGIC, sizeof(LATTICECACHE_MAGIC));
+   hdr.version = LATTICECACHE_VERSION;
+   hdr.byteOrder = LATTICECACHE_BYTEORDER;
+   hdr.numParticles = model.getNumParticles();
+   hdr.planes = L->getNumPlanes();
+   hdr.rows = L->getNumRows();
+   hdr.cols = L->getNumCols();
+   hdr.frameInterval = frameInterval;
+   hdr.timeStep = model.getTimeStep();
+   hdr.bounds[0] = L->getMinX();
+   hdr.bounds[1] = L->getMinY();
+   hdr.bounds[2] = L->getMinZ();
+   hdr.bounds[3] = L->getMaxX();
+   hdr.bounds[4] = L->getMaxY();
+   hdr.bounds[5] = L->getMaxZ();
+   hdr.framesOffset = LATTICECACHE_FRAMES_OFFSET;
+   hdr.codec = RAW_FRAMES;
+   hdr.keyframeInterval = 1;
+
+   // a compressed cache carries the rest lattice it is quantized against
+   int np = hdr.numParticles;
+   if (errorBound > 0){
+      const StateVector &restState = model.getRestState();
+      rest = new float[3 * np];
+      for (int i = 0; i < np; i++){
+         rest[i] = restState.x[i];
+         rest[np + i] = restState.y[i];
+         rest[2 * np + i] = restState.z[i];
+      }
+      hdr.codec = DELTA_FRAMES;
+      hdr.keyframeInterval = (keyframeInterval > 0) ? keyframeInterval : 1;
+      hdr.errorBound = errorBound;
+      hdr.restOffset = LATTICECACHE_FRAMES_OFFSET;
+      hdr.framesOffset = (hdr.restOffset + 3 * (uint64_t)np * sizeof(float) + LATTICECACHE_ALIGN - 1) &
+                         ~(LATTICECACHE_ALIGN - 1);
+   }
+
+   fp = fopen(filename, "wb");
+   if (fp == NULL){
+      cerr << "Could not create lattice cache " << filename << endl;
+      delete[] rest;
+      rest = NULL;
+      return false;
+   }
+
+   static const char zeros[LATTICECACHE_FRAMES_OFFSET] = {0};
+   bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             fwrite(zeros, 1, LATTICECACHE_FRAMES_OFFSET - sizeof(hdr), fp) == LATTICECACHE_FRAMES_OFFSET - sizeof(hdr);
+   if (ok && rest != NULL){
+      uint64_t restBytes = 3 * (uint64_t)np * sizeof(float);
+      uint64_t pad = hdr.framesOffset - hdr.restOffset - restBytes;
+      ok = fwrite(rest, 1, restBytes, fp) == restBytes &&
+           fwrite(zeros, 1, pad, fp) == pad;
+   }
+   if (!ok){
+      cerr << "Could not write lattice cache " << filename << endl;
+      fclose(fp);
+      fp = NULL;
+      delete[] rest;
+      rest = NULL;
+      return false;
+   }
+
+   numParticles = np;
+   numFrames = 0;
+   if (rest != NULL){
+      step = DeltaCodec::quantStep(errorBound);
+      this->keyframeInterval = hdr.keyframeInterval;
+      quant = new int64_t[3 * np];
+      codec.reset(3 * np);
+   }
+   else
+      frame = new float[3 * np];
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheWriter::addFrame()
+* PURPOSE : Append the particle positions of a state as one frame
+* INPUTS :  const StateVector &state, current simulation state
+* OUTPUTS : bool, false if the write failed
+*/
+//-----------------------------------------------------------------
+
+bool LatticeCacheWriter::addFrame(const StateVector &state)
+{
+   if (fp == NULL || state.getNumParticles() != numParticles)
+      return false;
+
+   if (rest != NULL){
+      int np = numParticles;
+      DeltaCodec::quantize(state.x, rest, np, step, quant);
+      DeltaCodec::quantize(state.y, rest + np, np, step, quant + np);
+      DeltaCodec::quantize(state.z, rest + 2 * np, np, step, quant + 2 * np);
+      code.clear();
+      codec.encode(quant, numFrames % keyframeInterval == 0, code);
+
+      uint32_t bytes = (uint32_t)code.size();
+      if (fwrite(&bytes, sizeof(bytes), 1, fp) != 1 ||
+          fwrite(&code[0], 1, bytes, fp) != bytes)
+         return false;
+      numFrames++;
+      return true;
+   }
+
+   for (int i = 0; i < numParticles; i++){
+      frame[i] = state.x[i];
+      frame[numParticles + i] = state.y[i];
+      frame[2 * numParticles + i] = state.z[i];
+   }
+   if (fwrite(frame, sizeof(float), 3 * numParticles, fp) != (size_t)(3 * numParticles))
+      return false;
+   numFrames++;
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheWriter::close()
+* PURPOSE : Patch the frame count into the header and close the file
+* INPUTS :  None
+* OUTPUTS : bool, false if the file could not be finished
+*/
+//-----------------------------------------------------------------
+
+bool LatticeCacheWriter::close()
+{
+   if (fp == NULL)
+      return true;
+
+   int32_t frames = numFrames;
+   bool ok = fseek(fp, offsetof(LatticeCacheHeader, numFrames), SEEK_SET) == 0 &&
+             fwrite(&frames, sizeof(frames), 1, fp) == 1;
+   ok = (fclose(fp) == 0) && ok;
+   fp = NULL;
+   if (!ok)
+      cerr << "Error writing lattice cache" << endl;
+
+   delete[] frame;
+   frame = NULL;
+   delete[] rest;
+   rest = NULL;
+   delete[] quant;
+   quant = NULL;
+   step = 0;
+   return ok;
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheReader::LatticeCacheReader()
+* PURPOSE : Default constructor, no cache open
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+LatticeCacheReader::LatticeCacheReader()
+{
+   mapping = NULL;
+   mappingSize = 0;
+   frames = NULL;
+   numParticles = numFrames = 0;
+   planes = rows = cols = 0;
+   frameInterval = 1;
+   timeStep = 0;
+   memset(bounds, 0, sizeof(bounds));
+   step = errorBound = 0;
+   rest = NULL;
+   quant = NULL;
+   decoded = NULL;
+   decodedFrame = -1;
+}
+
+LatticeCacheReader::~LatticeCacheReader()
+{
+   close();
+}
+
+void LatticeCacheReader::close()
+{
+   if (mapping != NULL)
+      munmap(mapping, mappingSize);
+   mapping = NULL;
+   mappingSize = 0;
+   frames = NULL;
+   numParticles = numFrames = 0;
+   step = errorBound = 0;
+   rest = NULL;
+   frameOffsets.clear();
+   delete[] quant;
+   quant = NULL;
+   delete[] decoded;
+   decoded = NULL;
+   decodedFrame = -1;
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheReader::open()
+* PURPOSE : Map a lattice cache for random access to its frames
+* INPUTS :  const char *filename, cache file
+* OUTPUTS : bool, false if the file is missing or damaged
+*/
+//-----------------------------------------------------------------
+
+bool LatticeCacheReader::open(const char *filename)
+{
+   close();
+
+   int fd = ::open(filename, O_RDONLY);
+   if (fd < 0){
+      cerr << "Could not open lattice cache " << filename << endl;
+      return false;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < LATTICECACHE_FRAMES_OFFSET){
+      cerr << "Lattice cache " << filename << " is damaged" << endl;
+      ::close(fd);
+      return false;
+   }
+
+   size_t size = (size_t)st.st_size;
+   void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (m == MAP_FAILED){
+      cerr << "Could not map lattice cache " << filename << endl;
+      return false;
+   }
+
+   const LatticeCacheHeader &hdr = *(const LatticeCacheHeader*)m;
+   bool compressed = hdr.codec == DELTA_FRAMES;
+   size_t frameBytes = 3 * (size_t)hdr.numParticles * sizeof(float);
+   if (memcmp(hdr.magic, LATTICECACHE_MAGIC, sizeof(LATTICECACHE_MAGIC)) != 0 ||
+       hdr.version != LATTICECACHE_VERSION || hdr.byteOrder != LATTICECACHE_BYTEORDER ||
+       hdr.numParticles <= 0 || hdr.framesOffset > size ||
+       (hdr.codec != RAW_FRAMES && hdr.codec != DELTA_FRAMES) ||
+       (compressed && (hdr.errorBound <= 0 || hdr.restOffset + frameBytes > hdr.framesOffset))){
+      cerr << "Lattice cache " << filename << " is damaged or from another version" << endl;
+      munmap(m, size);
+      return false;
+   }
+
+   // an unfinished cache has no frame count, so count the whole frames
+   int available = 0;
+   if (compressed){
+      uint64_t pos = hdr.framesOffset;
+      while (pos + sizeof(uint32_t) <= size){
+         uint32_t bytes;
+         memcpy(&bytes, (const char*)m + pos, sizeof(bytes));
+         if (pos + sizeof(uint32_t) + bytes > size)
+            break;
+         frameOffsets.push_back(pos);
+         pos += sizeof(uint32_t) + bytes;
+      }
+      available = (int)frameOffsets.size();
+   }
+   else
+      available = (int)((size - hdr.framesOffset) / frameBytes);
+   numFrames = (hdr.numFrames > 0 && hdr.numFrames <= available) ? hdr.numFrames : available;
+
+   mapping = m;
+   mappingSize = size;
+   numParticles = hdr.numParticles;
+   if (compressed){
+      step = DeltaCodec::quantStep(hdr.errorBound);
+      errorBound = hdr.errorBound;
+      rest = (const float*)((const char*)m + hdr.restOffset);
+      codec.reset(3 * numParticles);
+      quant = new int64_t[3 * numParticles];
+      decoded = new float[3 * numParticles];
+      memcpy(decoded, rest, frameBytes);
+   }
+   else
+      frames = (const float*)((const char*)m + hdr.framesOffset);
+   planes = hdr.planes;
+   rows = hdr.rows;
+   cols = hdr.cols;
+   frameInterval = hdr.frameInterval;
+   timeStep = hdr.timeStep;
+   memcpy(bounds, hdr.bounds, sizeof(bounds));
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+LatticeCacheReader::getFrame()
+* PURPOSE : Positions of a frame. A compressed frame is decoded from
+            the last one decoded if it follows it, otherwise from the
+            nearest keyframe before it.
+* INPUTS :  int f, frame number
+* OUTPUTS : const float*, x, y and z arrays of numParticles floats
+*/
+//-----------------------------------------------------------------
+
+const float* LatticeCacheReader::getFrame(int f)
+{
+   if (frames != NULL)
+      return frames + 3 * (size_t)numParticles * f;
+   if (f == decodedFrame || f < 0 || f >= numFrames)
+      return decoded;
+
+   const unsigned char *base = (const unsigned char*)mapping;
+   int start = f;
+   if (f != decodedFrame + 1 || decodedFrame < 0){
+      while (start > 0 && !DeltaCodec::isKeyframe(base + frameOffsets[start] + sizeof(uint32_t),
+                                                  mappingSize - frameOffsets[start] - sizeof(uint32_t)))
+         start--;
+   }
+
+   int np = numParticles;
+   for (int g = start; g <= f; g++){
+      uint32_t bytes;
+      memcpy(&bytes, base + frameOffsets[g], sizeof(bytes));
+      if (!codec.decode(base + frameOffsets[g] + sizeof(uint32_t), bytes, quant)){
+         cerr << "Lattice cache frame " << g << " is damaged" << endl;
+         decodedFrame = -1;
+         return decoded;
+      }
+   }
+   DeltaCodec::dequantize(quant, rest, np, step, decoded);
+   DeltaCodec::dequantize(quant + np, rest + np, np, step, decoded + np);
+   DeltaCodec::dequantize(quant + 2 * np, rest + 2 * np, np, step, decoded + 2 * np);
+   decodedFrame = f;
+   return decoded;
+}
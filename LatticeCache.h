@@ -0,0 +1,115 @@
+/*
+* LatticeCache.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Simulation cache holding only the lattice particle positions of
+* each recorded frame, as float x, y and z arrays. The mesh is
+* rebuilt from them by the trilinear deformation on playback, so a
+* cache is a tiny fraction of the size of a per vertex one. The
+* header records the lattice resolution and bounds it was made with
+* so playback can rebuild the same lattice around the mesh.
+*
+* Given an error bound, frames are compressed with DeltaCodec
+* against the rest lattice instead of stored as floats; playback
+* then decodes each frame forward from the nearest keyframe.
+*/
+
+#ifndef __LATTICECACHE_H__
+#define __LATTICECACHE_H__
+
+#include "DeltaCodec.h"
+#include "StateVector.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+class Model;
+
+class LatticeCacheWriter{
+   private:
+      FILE *fp;
+      int numParticles;
+      int numFrames;
+      float *frame;		// x, y, z arrays of the frame being written
+
+      // compression, used when an error bound is given
+      DeltaCodec codec;
+      double step;		// quantization step, 0 for raw frames
+      int keyframeInterval;
+      float *rest;		// x, y, z arrays the frames are quantized against
+      int64_t *quant;
+      std::vector<unsigned char> code;
+
+   public:
+      LatticeCacheWriter();
+      ~LatticeCacheWriter();
+      LatticeCacheWriter(const LatticeCacheWriter&) = delete;
+      LatticeCacheWriter& operator=(const LatticeCacheWriter&) = delete;
+
+      // Create the file for the model's current lattice; frames are
+      // frameInterval simulation steps apart. With an errorBound above
+      // zero frames are compressed, positions kept within errorBound,
+      // with a keyframe every keyframeInterval frames.
+      bool open(const char *filename, Model &model, int frameInterval = 1,
+                double errorBound = 0, int keyframeInterval = 30);
+      bool addFrame(const StateVector &state);
+      bool close();		// records the frame count and closes
+
+      int getNumFrames() const {return numFrames;}
+};
+
+class LatticeCacheReader{
+   private:
+      void *mapping;
+      size_t mappingSize;
+      const float *frames;	// raw frames, or NULL if compressed
+      int numParticles;
+      int numFrames;
+      int planes, rows, cols;
+      int frameInterval;
+      float timeStep;
+      float bounds[6];
+
+      // compressed frames
+      double step;
+      double errorBound;
+      const float *rest;
+      std::vector<uint64_t> frameOffsets;	// start of each frame's record
+      DeltaCodec codec;
+      int64_t *quant;
+      float *decoded;		// x, y, z arrays of frame decodedFrame
+      int decodedFrame;
+
+   public:
+      LatticeCacheReader();
+      ~LatticeCacheReader();
+      LatticeCacheReader(const LatticeCacheReader&) = delete;
+      LatticeCacheReader& operator=(const LatticeCacheReader&) = delete;
+
+      bool open(const char *filename);	// maps the file
+      void close();
+
+      int getNumFrames() const {return numFrames;}
+      int getNumParticles() const {return numParticles;}
+      int getNumPlanes() const {return planes;}
+      int getNumRows() const {return rows;}
+      int getNumCols() const {return cols;}
+      int getFrameInterval() const {return frameInterval;}	// simulation steps per frame
+      float getTimeStep() const {return timeStep;}		// simulation time step
+      const float* getBounds() const {return bounds;}	// min x y z, max x y z
+      double getErrorBound() const {return errorBound;}	// 0 for raw frames
+
+      // x, y and z arrays of frame f, one after another, decoded if
+      // compressed; valid until another frame is asked for
+      const float* getFrame(int f);
+
+      // positions of frame f, each array numParticles long
+      const float* getX(int f) {return getFrame(f);}
+      const float* getY(int f) {return getFrame(f) + numParticles;}
+      const float* getZ(int f) {return getFrame(f) + 2 * numParticles;}
+};
+
+#endif
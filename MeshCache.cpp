@@ -0,0 +1,282 @@
+/*
+* MeshCache.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* File layout: a fixed header followed by the vertex, normal,
+* texture coordinate, triangle, welded vertex and index arrays
+* exactly as ObjModel holds them, each section starting on a 64
+* byte boundary. Loading maps the file copy-on-write and points the
+* ObjModel arrays into it.
+* A cache is written to a temporary name and renamed into place, so
+* a reader never sees a partly written file.
+*/
+
+#include "MeshCache.h"
+#include "objtriloader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char MESHCACHE_MAGIC[8] = {'S', 'S', 'M', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t MESHCACHE_VERSION = 2;
+static const uint32_t MESHCACHE_BYTEORDER = 0x01020304;
+static const uint64_t MESHCACHE_ALIGN = 64;
+
+enum {VERTEX_SECTION, NORMAL_SECTION, TEXCOORD_SECTION, TRIANGLE_SECTION,
+      WELDED_SECTION, INDEX_SECTION, NUM_SECTIONS};
+
+struct MeshCacheHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byteOrder;         // reads back as MESHCACHE_BYTEORDER on a matching machine
+   uint64_t sourceSize;        // stamp of the obj the cache was built from
+   int64_t sourceMtime;        // nanoseconds
+   uint64_t sourceChecksum;    // FNV-1a of the obj contents
+   int32_t count[NUM_SECTIONS];
+   uint64_t offset[NUM_SECTIONS];
+   uint64_t fileSize;
+};
+
+static const size_t sectionItemSize[NUM_SECTIONS] =
+   {sizeof(ObjVertex), sizeof(ObjNormal), sizeof(ObjTexCoord), sizeof(ObjTriangle),
+    sizeof(ObjWeldedVertex), sizeof(unsigned int)};
+
+static uint64_t alignUp(uint64_t n)
+{
+   return (n + MESHCACHE_ALIGN - 1) & ~(MESHCACHE_ALIGN - 1);
+}
+
+//-----------------------------------------------------------------
+/*
+sourceStamp()
+* PURPOSE : Size and modification time of the source obj
+* INPUTS :  const char *objfile, the source file
+*           uint64_t &size, int64_t &mtime, returned stamp
+* OUTPUTS : bool, false if the file cannot be examined
+*/
+//-----------------------------------------------------------------
+
+static bool sourceStamp(const char *objfile, uint64_t &size, int64_t &mtime)
+{
+   struct stat st;
+   if (stat(objfile, &st) != 0)
+      return false;
+
+   size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+   mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+   mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+sourceChecksum()
+* PURPOSE : 64 bit FNV-1a hash of the source obj's contents
+* INPUTS :  const char *objfile, the source file
+*           uint64_t &sum, returned checksum
+* OUTPUTS : bool, false if the file cannot be read
+*/
+//-----------------------------------------------------------------
+
+static bool sourceChecksum(const char *objfile, uint64_t &sum)
+{
+   int fd = open(objfile, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0){
+      close(fd);
+      return false;
+   }
+
+   sum = 14695981039346656037ULL;
+   size_t size = (size_t)st.st_size;
+   if (size > 0){
+      void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m == MAP_FAILED){
+         close(fd);
+         return false;
+      }
+      madvise(m, size, MADV_SEQUENTIAL);
+      const unsigned char *p = (const unsigned char*)m;
+      for (size_t i = 0; i < size; i++)
+         sum = (sum ^ p[i]) * 1099511628211ULL;
+      munmap(m, size);
+   }
+   close(fd);
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+MeshCache::cachePath()
+* PURPOSE : Name of the cache file belonging to an obj
+* INPUTS :  const char *objfile, the source file
+* OUTPUTS : string, objfile with .mcache appended
+*/
+//-----------------------------------------------------------------
+
+string MeshCache::cachePath(const char *objfile)
+{
+   return string(objfile) + ".mcache";
+}
+
+//-----------------------------------------------------------------
+/*
+MeshCache::load()
+* PURPOSE : Map a valid, up to date cache into obj. The size and time
+            stamp of the source are checked first; if they differ the
+            source checksum decides, so copied or touched files keep
+            their cache. A missing source leaves the cache usable.
+* INPUTS :  const char *objfile, the source obj
+*           ObjModel &obj, model to fill
+* OUTPUTS : bool, false if the cache is missing, stale or damaged
+*/
+//-----------------------------------------------------------------
+
+bool MeshCache::load(const char *objfile, ObjModel &obj)
+{
+   obj.Clear();
+
+   string path = cachePath(objfile);
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MeshCacheHeader)){
+      close(fd);
+      return false;
+   }
+
+   // private writable mapping: the model may modify its arrays without
+   // touching the file
+   size_t size = (size_t)st.st_size;
+   void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m == MAP_FAILED)
+      return false;
+
+   const MeshCacheHeader *hdr = (const MeshCacheHeader*)m;
+   bool valid = memcmp(hdr->magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC)) == 0 &&
+                hdr->version == MESHCACHE_VERSION &&
+                hdr->byteOrder == MESHCACHE_BYTEORDER &&
+                hdr->fileSize == size;
+   for (int s = 0; valid && s < NUM_SECTIONS; s++)
+      valid = hdr->count[s] >= 0 && hdr->offset[s] % MESHCACHE_ALIGN == 0 &&
+              hdr->offset[s] + (uint64_t)hdr->count[s] * sectionItemSize[s] <= size;
+   if (valid)
+      valid = hdr->count[INDEX_SECTION] == 3 * hdr->count[TRIANGLE_SECTION];	// the draw call reads three per triangle
+
+   uint64_t srcSize;
+   int64_t srcMtime;
+   if (valid && sourceStamp(objfile, srcSize, srcMtime) &&
+       (srcSize != hdr->sourceSize || srcMtime != hdr->sourceMtime)){
+      uint64_t sum;
+      valid = srcSize == hdr->sourceSize && sourceChecksum(objfile, sum) &&
+              sum == hdr->sourceChecksum;
+   }
+
+   if (!valid){
+      munmap(m, size);
+      return false;
+   }
+
+   char *base = (char*)m;
+   obj.NumVertex = hdr->count[VERTEX_SECTION];
+   obj.NumNormal = hdr->count[NORMAL_SECTION];
+   obj.NumTexCoord = hdr->count[TEXCOORD_SECTION];
+   obj.NumTriangle = hdr->count[TRIANGLE_SECTION];
+   obj.VertexArray = (ObjVertex*)(base + hdr->offset[VERTEX_SECTION]);
+   obj.NormalArray = (ObjNormal*)(base + hdr->offset[NORMAL_SECTION]);
+   obj.TexCoordArray = (ObjTexCoord*)(base + hdr->offset[TEXCOORD_SECTION]);
+   obj.TriangleArray = (ObjTriangle*)(base + hdr->offset[TRIANGLE_SECTION]);
+   obj.NumWelded = hdr->count[WELDED_SECTION];
+   obj.WeldedArray = (ObjWeldedVertex*)(base + hdr->offset[WELDED_SECTION]);
+   obj.IndexArray = (unsigned int*)(base + hdr->offset[INDEX_SECTION]);
+   obj.Mapping = m;
+   obj.MappingSize = size;
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+MeshCache::write()
+* PURPOSE : Write the cache for objfile, stamped with the source's
+            size, time and checksum
+* INPUTS :  const char *objfile, the source obj
+*           const ObjModel &obj, the model parsed from it
+* OUTPUTS : bool, false if the cache could not be written
+*/
+//-----------------------------------------------------------------
+
+bool MeshCache::write(const char *objfile, const ObjModel &obj)
+{
+   MeshCacheHeader hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC));
+   hdr.version = MESHCACHE_VERSION;
+   hdr.byteOrder = MESHCACHE_BYTEORDER;
+   if (!sourceStamp(objfile, hdr.sourceSize, hdr.sourceMtime) ||
+       !sourceChecksum(objfile, hdr.sourceChecksum))
+      return false;
+
+   const void *data[NUM_SECTIONS] =
+      {obj.VertexArray, obj.NormalArray, obj.TexCoordArray, obj.TriangleArray,
+       obj.WeldedArray, obj.IndexArray};
+   hdr.count[VERTEX_SECTION] = obj.NumVertex;
+   hdr.count[NORMAL_SECTION] = obj.NumNormal;
+   hdr.count[TEXCOORD_SECTION] = obj.NumTexCoord;
+   hdr.count[TRIANGLE_SECTION] = obj.NumTriangle;
+   hdr.count[WELDED_SECTION] = obj.NumWelded;
+   hdr.count[INDEX_SECTION] = 3 * obj.NumTriangle;
+
+   uint64_t pos = alignUp(sizeof(hdr));
+   for (int s = 0; s < NUM_SECTIONS; s++){
+      hdr.offset[s] = pos;
+      pos = alignUp(pos + (uint64_t)hdr.count[s] * sectionItemSize[s]);
+   }
+   hdr.fileSize = pos;
+
+   string path = cachePath(objfile);
+   char suffix[32];
+   snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+   string tmp = path + suffix;
+
+   FILE *fp = fopen(tmp.c_str(), "wb");
+   if (fp == NULL)
+      return false;
+
+   static const char zeros[MESHCACHE_ALIGN] = {0};
+   bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+   uint64_t at = sizeof(hdr);
+   for (int s = 0; ok && s < NUM_SECTIONS; s++){
+      ok = fwrite(zeros, 1, hdr.offset[s] - at, fp) == hdr.offset[s] - at;
+      size_t bytes = (size_t)hdr.count[s] * sectionItemSize[s];
+      if (ok && bytes > 0)
+         ok = fwrite(data[s], 1, bytes, fp) == bytes;
+      at = hdr.offset[s] + bytes;
+   }
+   if (ok)
+      ok = fwrite(zeros, 1, hdr.fileSize - at, fp) == hdr.fileSize - at;
+
+   ok = (fclose(fp) == 0) && ok;
+   if (ok)
+      ok = rename(tmp.c_str(), path.c_str()) == 0;
+   if (!ok)
+      remove(tmp.c_str());
+   return ok;
+}
@@ -0,0 +1,34 @@
+/*
+* MeshCache.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Pre-baked binary form of a loaded obj, kept next to the source
+* file as <file>.mcache. The cache is memory mapped and its
+* vertex, normal, texture coordinate, triangle and welded index
+* sections are used in place, so a fresh cache loads with no parsing at all. The
+* header records the source file's size, modification time and
+* checksum; a cache that no longer matches its source is ignored
+* and rewritten after the obj is parsed again.
+*/
+
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <string>
+
+class ObjModel;
+
+class MeshCache{
+   public:
+      static std::string cachePath(const char *objfile);
+
+      // Map the cache for objfile into obj. Returns false, leaving obj
+      // empty, if there is no cache or it is stale or damaged.
+      static bool load(const char *objfile, ObjModel &obj);
+
+      // Write the cache for objfile from a freshly parsed obj
+      static bool write(const char *objfile, const ObjModel &obj);
+};
+
+#endif
@@ -10,20 +10,51 @@
 //********************************************************************************
 
 #include "Model.h"
-#include "Vector.h"
+#include "Vec3.h"
 #include "StateVector.h"
-#include "Particle.h"
+#include "ParticleStore.h"
 #include "RandomGenerator.h"
 #include "objtriloader.h"
 #include "Cell.h"
 #include "Lattice.h"
+#include "ThreadPool.h"
+#include "ImplicitSolver.h"
+#include "ProjectiveSolver.h"
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <iostream>
 #include <math.h>       
 
 using namespace std;
 
+// Dormand-Prince 5(4) tableau; the 5th order weights are the last row
+// of a, so the derivative at the new state is the next step's first stage
+static const double DOPRI_A[7][6] = {
+  {0, 0, 0, 0, 0, 0},
+  {1.0/5, 0, 0, 0, 0, 0},
+  {3.0/40, 9.0/40, 0, 0, 0, 0},
+  {44.0/45, -56.0/15, 32.0/9, 0, 0, 0},
+  {19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729, 0, 0},
+  {9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656, 0},
+  {35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84}};
+static const double DOPRI_C[7] = {0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1};
+// difference of the 5th and 4th order weights, the local error estimate
+static const double DOPRI_E[7] = {71.0/57600, 0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40};
+
+// PI step size control after Hairer and Wanner's DOPRI5
+static const double DOPRI_SAFETY = 0.9;
+static const double DOPRI_BETA = 0.04;			// weight of the previous error
+static const double DOPRI_ALPHA = 0.2 - 0.75 * DOPRI_BETA;	// weight of the current error
+static const double DOPRI_MIN_ERROR = 1.0e-4;		// floor of the remembered error
+static const double DOPRI_MAX_GROWTH = 5;
+static const double DOPRI_MAX_SHRINK = 10;
+
+// the stability region of DOPRI5 reaches about 3.3 from the origin along
+// both the negative real and the imaginary axis
+static const double DOPRI_STABILITY = 3.3;
+
 //-----------------------------------------------------------------
 /*
 Model::Model()
@@ -36,6 +67,27 @@ Model::Model()
 Model::Model(){
   //initSimulation();
   dispinterval = 1;
+
+  // default lattice resolution and springy mesh parameters
+  latticePlanes = 2;
+  latticeRows = 12;
+  latticeCols = 4;
+  strutK = 11.1;
+  strutD = 2.8;
+  latticeMass = 1000.0;
+
+  h = 0.05;
+  integrator = RK4_INTEGRATOR;
+  accelValid = false;
+  errorTolerance = 1.0e-4;
+  substep = 0;
+  substepError = DOPRI_MIN_ERROR;
+  stableStep = 0;
+  evaluations = 0;
+
+  running = false;
+  numParticles = 0;
+  numStruts = 0;
 }
 
 //-----------------------------------------------------------------
@@ -59,12 +111,144 @@ void Model::setBoundingBox(float minX, float minY, float minZ, float maxX, float
  
 }
 
+//-----------------------------------------------------------------
+/*
+Model::setResolution(int planes, int rows, int cols)
+* PURPOSE : Set the number of lattice cells used by constructLattice
+* INPUTS :  int planes, number of cells along z (depth)
+            int rows, number of cells along y (height)
+            int cols, number of cells along x (width)
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setResolution(int planes, int rows, int cols)
+{
+  if (planes < 1 || rows < 1 || cols < 1){
+    std::cerr << "Lattice resolution must be at least one cell along each axis." << std::endl;
+    return;
+  }
+  latticePlanes = planes;
+  latticeRows = rows;
+  latticeCols = cols;
+}
+
+//-----------------------------------------------------------------
+/*
+Model::setSpringConstants(float k, float d)
+* PURPOSE : Set the spring and damping constants given to every strut
+* INPUTS :  float k, spring constant
+            float d, damping constant
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setSpringConstants(float k, float d)
+{
+  strutK = k;
+  strutD = d;
+}
+
+//-----------------------------------------------------------------
+/*
+Model::setLatticeMass(float mass)
+* PURPOSE : Set the total lattice mass, shared evenly by its particles
+* INPUTS :  float mass, total mass
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setLatticeMass(float mass)
+{
+  latticeMass = fabs(mass);
+}
+
+//-----------------------------------------------------------------
+/*
+Model::setTimeStep(float timestep)
+* PURPOSE : Set the simulation time step. The backward Euler integrator
+            stays stable at steps many times larger than RK4 allows.
+* INPUTS :  float timestep, h, in seconds
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setTimeStep(float timestep)
+{
+  if(timestep > 0)
+    h = timestep;
+}
+
+//-----------------------------------------------------------------
+/*
+Model::setIntegrator(Integrator method)
+* PURPOSE : Choose the time integration method, also while running
+* INPUTS :  Integrator method
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setIntegrator(Integrator method)
+{
+  if(method >= 0 && method < NUM_INTEGRATORS && method != integrator){
+    integrator = method;
+    accelValid = false;		// other integrators use Sdot as scratch
+  }
+}
+
+//-----------------------------------------------------------------
+/*
+Model::setErrorTolerance(float tol)
+* PURPOSE : Set the error the Dormand-Prince integrator allows each
+            substep, relative to the size of each state component plus
+            the same amount absolute
+* INPUTS :  float tol, error tolerance
+* OUTPUTS : None, sets class variables
+*/
+//-----------------------------------------------------------------
+
+void Model::setErrorTolerance(float tol)
+{
+  if(tol > 0)
+    errorTolerance = tol;
+}
+
+static const char* integratorNames[Model::NUM_INTEGRATORS] = {"rk4", "implicit", "symplectic", "verlet", "dopri", "projective"};
+
+//-----------------------------------------------------------------
+/*
+Model::integratorName(Integrator method), Model::findIntegrator(const char* name, Integrator& method)
+* PURPOSE : Convert between integrators and the names used on command lines
+* INPUTS :  Integrator method, or const char* name
+* OUTPUTS : the name, or method and true if the name is known
+*/
+//-----------------------------------------------------------------
+
+const char* Model::integratorName(Integrator method)
+{
+  return (method >= 0 && method < NUM_INTEGRATORS) ? integratorNames[method] : "unknown";
+}
+
+bool Model::findIntegrator(const char* name, Integrator& method)
+{
+  for(int i = 0; i < NUM_INTEGRATORS; i++){
+    if(strcmp(name, integratorNames[i]) == 0){
+      method = (Integrator)i;
+      return true;
+    }
+  }
+  return false;
+}
+
 //-----------------------------------------------------------------
 /*
 Model::constructLattice()
-* PURPOSE : Receive bounding information about the 3d mesh to be deformed
-* INPUTS :  float minX, float minY, float minZ, minimum bounding values for the mesh
-            float maxX, float maxY, float maxZ, maximum bounding values for the mesh
+* PURPOSE : Build the lattice of particles (vertices), struts (edges) and
+            cells that bounds the mesh. Every cell edge, both diagonals of
+            every cell face and the four internal diagonals of every cell
+            get exactly one strut, so all arrays are sized exactly up front
+            and construction is linear in the number of cells.
+* INPUTS :  None, uses the bounding box, resolution and spring constants
 * OUTPUTS : None, sets class variables
 */
 //-----------------------------------------------------------------
@@ -72,27 +256,19 @@ Model::constructLattice()
 void Model::constructLattice()
 {
 
-//============================================
-  // Set springy mesh parameters
-  float cubeMass = 1000.0;
-  float k = 11.1;
-  float d = 2.8;
-  float l_rest = 5.0;
-
 //============================================
   // Define lattice and cell dimensions
   float latticeWidth = maxX_bound - minX_bound;
   float latticeHeight = maxY_bound - minY_bound;
   float latticeDepth = maxZ_bound - minZ_bound;
 
-  int L = 2;  // num depth planes
-  int M = 12; // num rows
-  int N = 4;  // num cols
+  int L = latticePlanes;  // num depth planes
+  int M = latticeRows;    // num rows
+  int N = latticeCols;    // num cols
 
   numParticles = ((L + 1) * (M + 1) * (N + 1));
 
-  int numCells = L * M * N;
-  lattice = Lattice(numCells);
+  lattice = Lattice(L, M, N);
   lattice.setBounds(minX_bound, minY_bound, minZ_bound, maxX_bound, maxY_bound, maxZ_bound);
 
   float cellWidth = fabs(latticeWidth/N);
@@ -102,14 +278,13 @@ void Model::constructLattice()
   lattice.setCellDimensions(cellWidth, cellHeight, cellDepth);
 //============================================
   // Set initial particle parameters
-  float particleMass = cubeMass/numParticles;
-  float speed_avg = 1.0;
-  float speed_range = 0.08;
+  float particleMass = latticeMass/numParticles;
   
 //============================================
 // Construct all particles (vertices) in the lattice and add to system particle list
   
-  particles = new Particle[numParticles];
+  particles.resize(numParticles);
+  restState.resize(numParticles);
   int p_index = 0; // index in system particle list
 
   for (int z = 0; z < L + 1; z++)
@@ -118,35 +293,22 @@ void Model::constructLattice()
      {
         for (int x = 0; x < N + 1; x++)
         {
-           Vector3d particlePosition = {minX_bound + (x * cellWidth), minY_bound + (y * cellHeight), minZ_bound + (z * cellDepth)};
-           //Vector3d particleVelocity = generateVelocity(speed_avg, speed_range);
-           Vector3d particleVelocity = {0.0, 0.0, 0.0};
-           particles[p_index] = Particle(particlePosition, particleVelocity, particleMass);
+           Vec3 particlePosition(minX_bound + (x * cellWidth), minY_bound + (y * cellHeight), minZ_bound + (z * cellDepth));
+           Vec3 particleVelocity(0.0, 0.0, 0.0);
+           restState.setPosition(p_index, particlePosition);
+           restState.setVelocity(p_index, particleVelocity);
 	   // Pin top of the lattice deformer to show effect of gravity
-           if (y == M){
-              particles[p_index].isPinned = true;
-           }
+           particles.setPinned(p_index, y == M);
+           particles.setMass(p_index, particleMass);
            p_index = p_index + 1;
         }
       }
   }
 
-//============================================
-// Construct struts -- struts at this point are not attached to any particles
-  numStruts = (M * N * L * 16) + (4 * M * L) + (4 * N * L) + (4 * M * N);
-  struts = new Strut[numStruts];
-  for (int st = 0; st < numStruts; st++)
-  {
-     struts[st] = Strut(k, d, l_rest);
-  }
-
 //============================================
 // Construct the cells of the lattice and attach to constructed particles
-  int strut_index = 0;
-  float depth_height_diagonal = sqrt(pow(cellDepth, 2) + pow(cellHeight, 2));
-  float depth_width_diagonal = sqrt(pow(cellDepth, 2) + pow(cellWidth, 2));
-  float height_width_diagonal = sqrt(pow(cellHeight, 2) + pow(cellWidth, 2));
-  float cell_diagonal = sqrt(pow(cellHeight,2) + pow(cellWidth,2) + pow(cellDepth,2));
+  int rowStride = N + 1;                // index step to the next particle along y
+  int planeStride = (M + 1) * (N + 1);  // index step to the next particle along z
 
   for (int p = 0; p < L; p++)
   {
@@ -154,141 +316,87 @@ void Model::constructLattice()
      {
         for (int c = 0; c < N; c++)
         {
-           lattice.cells[(p*M + r)*N + c] = Cell(p, r, c);
-           int back_bottom_left = c + (r*(N + 1)) + (p*((M + 1) * (N + 1)));
-           int back_bottom_right = back_bottom_left + 1;
-           int back_top_left = c + ((r + 1)*(N + 1)) + (p* (M + 1) * (N + 1));
-           int back_top_right = back_top_left + 1;
-           int front_bottom_left = c + (r*(N + 1)) + ((p + 1)*(M + 1)*(N + 1));
-           int front_bottom_right = front_bottom_left + 1;
-           int front_top_left = c + ((r + 1)*(N + 1)) + ((p + 1)*(M + 1)*(N + 1));
-           int front_top_right = front_top_left + 1;
-
-           lattice.cells[(p*M + r)*N + c].vertIndices[0] = back_bottom_left;
-           lattice.cells[(p*M + r)*N + c].vertIndices[1] = back_bottom_right;
-           lattice.cells[(p*M + r)*N + c].vertIndices[2] = back_top_left;
-           lattice.cells[(p*M + r)*N + c].vertIndices[3] = back_top_right;
-           lattice.cells[(p*M + r)*N + c].vertIndices[4] = front_bottom_left;
-           lattice.cells[(p*M + r)*N + c].vertIndices[5] = front_bottom_right;
-           lattice.cells[(p*M + r)*N + c].vertIndices[6] = front_top_left;
-           lattice.cells[(p*M + r)*N + c].vertIndices[7] = front_top_right;
-
-           lattice.cells[(p*M + r)*N + c].setMinBounds(particles[back_bottom_left].position.x, particles[back_bottom_left].position.y, particles[back_bottom_left].position.z);
-           lattice.cells[(p*M + r)*N + c].setMaxBounds(particles[front_top_right].position.x, particles[front_top_right].position.y, particles[front_top_right].position.z);
-           
-           //============================================
-           // Connect struts between the particles in each cell
-
-           // FOR EACH CELL: CONNECT STRUTS ALONG INTERNAL DIAGONALS
-           struts[strut_index].connectVerts(front_top_left, back_bottom_right); // p6 to p1
-           struts[strut_index].setLRest(cell_diagonal); 
-           strut_index += 1;
-           struts[strut_index].connectVerts(front_top_right, back_bottom_left); // p7 to p0
-           struts[strut_index].setLRest(cell_diagonal);
-           strut_index += 1;
-           struts[strut_index].connectVerts(back_top_left, front_bottom_right); // p2 to p5
-           struts[strut_index].setLRest(cell_diagonal); 
-           strut_index += 1;
-           struts[strut_index].connectVerts(back_top_right, front_bottom_left); // p3 to p4
-           struts[strut_index].setLRest(cell_diagonal); 
-           strut_index += 1;
-
-           // FOR EACH COLUMN: CONNECT STRUTS FRONT TO BACK
-           struts[strut_index].connectVerts(back_bottom_left, front_bottom_left); // p0 to p4
-           struts[strut_index].setLRest(cellDepth);
-           strut_index += 1;
-           struts[strut_index].connectVerts(back_top_left, front_top_left); // p2 to p6
-           struts[strut_index].setLRest(cellDepth);
-           strut_index += 1;
-           // diagonals
-           struts[strut_index].connectVerts(back_top_left, front_bottom_left); // p2 to p4
-           struts[strut_index].setLRest(depth_height_diagonal);
-           strut_index += 1;
-           struts[strut_index].connectVerts(front_top_left, back_bottom_left); // p6 to p0
-           struts[strut_index].setLRest(depth_height_diagonal); 
-           strut_index += 1;
-
-           if (c == N - 1){ // if last cell in row
-              struts[strut_index].connectVerts(back_bottom_right, front_bottom_right); // p1 to p5
-              struts[strut_index].setLRest(cellDepth);
-              strut_index += 1;  
-              struts[strut_index].connectVerts(back_top_right, front_top_right); // p3 to p7
-              struts[strut_index].setLRest(cellDepth);
-              strut_index += 1;  
-              // diagonals
-              struts[strut_index].connectVerts(back_top_right, front_bottom_right); // p3 to p5
-              struts[strut_index].setLRest(depth_height_diagonal); 
-              strut_index += 1;
-              struts[strut_index].connectVerts(back_bottom_right, front_top_right); // p1 to p7
-              struts[strut_index].setLRest(depth_height_diagonal);
-              strut_index += 1;
-           }
+           Cell& cell = lattice.cells[(p*M + r)*N + c];
+           cell = Cell(p, r, c);
+           int back_bottom_left = c + (r * rowStride) + (p * planeStride);
+
+           cell.vertIndices[0] = back_bottom_left;                               // back_bottom_left
+           cell.vertIndices[1] = back_bottom_left + 1;                           // back_bottom_right
+           cell.vertIndices[2] = back_bottom_left + rowStride;                   // back_top_left
+           cell.vertIndices[3] = back_bottom_left + rowStride + 1;               // back_top_right
+           cell.vertIndices[4] = back_bottom_left + planeStride;                 // front_bottom_left
+           cell.vertIndices[5] = back_bottom_left + planeStride + 1;             // front_bottom_right
+           cell.vertIndices[6] = back_bottom_left + planeStride + rowStride;     // front_top_left
+           cell.vertIndices[7] = back_bottom_left + planeStride + rowStride + 1; // front_top_right
+
+           int front_top_right = cell.vertIndices[7];
+           cell.setMinBounds(restState.x[back_bottom_left], restState.y[back_bottom_left], restState.z[back_bottom_left]);
+           cell.setMaxBounds(restState.x[front_top_right], restState.y[front_top_right], restState.z[front_top_right]);
+        }
+     }
+  }
 
-           // FOR EACH ROW: CONNECT STRUTS LEFT TO RIGHT
-           struts[strut_index].connectVerts(back_bottom_left, back_bottom_right); // p0 to p1
-           struts[strut_index].setLRest(cellWidth);
-           strut_index += 1;
-           struts[strut_index].connectVerts(front_bottom_left, front_bottom_right); // p4 to p5
-           struts[strut_index].setLRest(cellWidth);
-           strut_index += 1;
-           // diagonals
-           struts[strut_index].connectVerts(back_bottom_right, front_bottom_left); // p1 to p4
-           struts[strut_index].setLRest(depth_width_diagonal);
-           struts[strut_index].connectVerts(back_bottom_left, front_bottom_right); // p0 to p5
-           struts[strut_index].setLRest(depth_width_diagonal);
-           strut_index += 1;
-
-           if (r == M - 1){ // if last cell in row
-              struts[strut_index].connectVerts(back_top_left, back_top_right); // p2 to p3
-              struts[strut_index].setLRest(cellWidth);
-              strut_index += 1;  
-              struts[strut_index].connectVerts(front_top_left, front_top_right); // p6 to p7
-              struts[strut_index].setLRest(cellWidth);
-              strut_index += 1;  
-              // diagonals
-              struts[strut_index].connectVerts(back_top_right, front_top_left); // p3 to p6
-              struts[strut_index].setLRest(depth_width_diagonal); 
-              strut_index += 1;
-              struts[strut_index].connectVerts(back_top_left, front_top_right); // p2 to p7
-              struts[strut_index].setLRest(depth_width_diagonal);
-              strut_index += 1;
+//============================================
+// Connect struts between the particles. Each particle owns the edges,
+// face diagonals and internal diagonals that start at it and run in the
+// +x, +y, +z directions, so every strut is created exactly once.
+  float height_width_diagonal = sqrt(cellHeight * cellHeight + cellWidth * cellWidth);
+  float depth_width_diagonal = sqrt(cellDepth * cellDepth + cellWidth * cellWidth);
+  float depth_height_diagonal = sqrt(cellDepth * cellDepth + cellHeight * cellHeight);
+  float cell_diagonal = sqrt(cellHeight * cellHeight + cellWidth * cellWidth + cellDepth * cellDepth);
+
+  numStruts = N * (M + 1) * (L + 1) + (N + 1) * M * (L + 1) + (N + 1) * (M + 1) * L   // edges
+            + 2 * (N * M * (L + 1) + N * L * (M + 1) + M * L * (N + 1))              // face diagonals
+            + 4 * L * M * N;                                                         // internal diagonals
+
+  strutSet.clear();
+  strutSet.reserve(numStruts);
+
+  for (int z = 0; z < L + 1; z++)
+  {
+     for (int y = 0; y < M + 1; y++)
+     {
+        for (int x = 0; x < N + 1; x++)
+        {
+           int p0 = x + (y * rowStride) + (z * planeStride);
+           int px = p0 + 1;             // next particle along x
+           int py = p0 + rowStride;     // next particle along y
+           int pz = p0 + planeStride;   // next particle along z
+
+           // edges
+           if (x < N) strutSet.add(p0, px, strutK, strutD, cellWidth);
+           if (y < M) strutSet.add(p0, py, strutK, strutD, cellHeight);
+           if (z < L) strutSet.add(p0, pz, strutK, strutD, cellDepth);
+
+           // face diagonals
+           if (x < N && y < M){
+              strutSet.add(p0, py + 1, strutK, strutD, height_width_diagonal);
+              strutSet.add(px, py, strutK, strutD, height_width_diagonal);
            }
-           
-           // FOR EACH DEPTH PLANE: CONNECT STRUTS BOTTOM TO TOP
-           struts[strut_index].connectVerts(back_bottom_left, back_top_left); // p0 to p2
-           struts[strut_index].setLRest(cellHeight);
-           strut_index += 1;
-           struts[strut_index].connectVerts(back_bottom_right, back_top_right); // p1 to p3
-           struts[strut_index].setLRest(cellHeight);
-           strut_index += 1;
-           // diagonals
-           struts[strut_index].connectVerts(back_bottom_left, back_top_right); // p0 to p3
-           struts[strut_index].setLRest(height_width_diagonal);
-           strut_index += 1;
-           struts[strut_index].connectVerts(back_bottom_right, back_top_left); // p1 to p2
-           struts[strut_index].setLRest(height_width_diagonal); 
-           strut_index += 1;
-
-           if (p == L - 1){ // if last cell in row
-              struts[strut_index].connectVerts(front_bottom_left, front_top_left); // p4 to p6
-              struts[strut_index].setLRest(cellHeight);
-              strut_index += 1;  
-              struts[strut_index].connectVerts(front_bottom_right, front_top_right); // p5 to p7
-              struts[strut_index].setLRest(cellHeight);
-              strut_index += 1;  
-              // diagonals
-              struts[strut_index].connectVerts(front_top_left, front_bottom_right); // p6 to p5
-              struts[strut_index].setLRest(height_width_diagonal);
-              strut_index += 1;
-              struts[strut_index].connectVerts(front_bottom_left, front_top_right); // p4 to p7
-              struts[strut_index].setLRest(height_width_diagonal);
-              strut_index += 1;
+           if (x < N && z < L){
+              strutSet.add(p0, pz + 1, strutK, strutD, depth_width_diagonal);
+              strutSet.add(px, pz, strutK, strutD, depth_width_diagonal);
+           }
+           if (y < M && z < L){
+              strutSet.add(p0, pz + rowStride, strutK, strutD, depth_height_diagonal);
+              strutSet.add(py, pz, strutK, strutD, depth_height_diagonal);
            }
 
+           // internal diagonals
+           if (x < N && y < M && z < L){
+              strutSet.add(p0, pz + rowStride + 1, strutK, strutD, cell_diagonal);
+              strutSet.add(px, pz + rowStride, strutK, strutD, cell_diagonal);
+              strutSet.add(py, pz + 1, strutK, strutD, cell_diagonal);
+              strutSet.add(py + 1, pz, strutK, strutD, cell_diagonal);
+           }
         }
-      }
+     }
   }
 
+//============================================
+// Group the struts into conflict free batches for the force kernel
+  strutSet.colorBatches(numParticles);
+
 }
 
 //-----------------------------------------------------------------
@@ -309,104 +417,412 @@ void Model::initSimulation(){
 //============================================
   // Set simulation parameters
    t = 0;
-   h = 0.05;                                    
    n = 0;
+   substep = 0;
+   substepError = DOPRI_MIN_ERROR;
+
+   S = restState;     // start from the lattice at rest
+
+   allocateWorkspace();
+   estimateStableStep();
+}
 
-   S = StateVector(numParticles);     // copy all position and velocity values to the state vector
-   S.copyToSV(particles);
+//-----------------------------------------------------------------
+/*
+Model::allocateWorkspace()
+* PURPOSE : Size the integration workspace once so timeStep never
+            allocates
+* INPUTS :  None, uses numParticles
+* OUTPUTS : None, resizes the workspace state vectors
+*/
+//-----------------------------------------------------------------
 
+void Model::allocateWorkspace(){
+   Sdot.resize(numParticles);
+   K2.resize(numParticles);
+   K3.resize(numParticles);
+   K4.resize(numParticles);
+   K5.resize(numParticles);
+   K6.resize(numParticles);
+   K7.resize(numParticles);
+   Stemp.resize(numParticles);
+   Snew.resize(numParticles);
+   implicitSolver.reset();	// the struts may have been rebuilt
+   projectiveSolver.reset();
+   accelValid = false;
+   stableStep = 0;		// estimated again once the struts are in place
 }
 
 //-----------------------------------------------------------------
 /*
-StateVector Model::F(StateVector state_vec, float time)
-* PURPOSE : System Dynamics Function
-* INPUTS :  StateVector state_vec, contains the current state of the system
-            float time, current time
-* OUTPUTS : StateVector deriv, derivative of the system state vector (contains velocities and accelerations)
+void Model::F(const StateVector& state_vec, float time, StateVector& deriv)
+* PURPOSE : System Dynamics Function. Evaluates the derivative of the
+            given state only; neither the member state S nor the particles
+            are read for positions or velocities, and nothing is written
+            back to them, so every Runge Kutta stage is a real evaluation.
+* INPUTS :  const StateVector& state_vec, the system state to evaluate
+            float time, current time, unused as no force depends on it
+            StateVector& deriv, preallocated output state vector
+* OUTPUTS : deriv, derivative of the system state vector (contains velocities and accelerations)
 */
 //-----------------------------------------------------------------
-StateVector Model::F(StateVector state_vec, float time)
+void Model::F(const StateVector& state_vec, float /*time*/, StateVector& deriv)
 {
    int nb = state_vec.getNumParticles();
-   int len = state_vec.getLength();
+   evaluations++;
    
-   // copy velocities from S to the first half of derivative state vector
-   StateVector deriv = StateVector(nb);
-   for (int k=nb; k < len; k++)
+   // velocities of the given state form the first half of the derivative
+   for (int k=0; k < nb; k++)
    {
-      deriv.states[k - nb].set(S.states[k].x, S.states[k].y, S.states[k].z);
+      deriv.x[k] = state_vec.vx[k];
+      deriv.y[k] = state_vec.vy[k];
+      deriv.z[k] = state_vec.vz[k];
    } 
    
-   // loop through each vertex
-   for(int m=0; m < numParticles; m++)
+   // external forces on each vertex, then the struts
+   particles.applyExternalForces();
+   strutSet.applyForces(state_vec, particles, ThreadPool::shared());
+
+   // accelerations form the second half of the derivative
+   particles.computeAccelerations(deriv);
+} 
+//-----------------------------------------------------------------
+/*
+void Model::numInt(const StateVector& Sn, const StateVector& S_dot, float timestep, StateVector& Sn1)
+* PURPOSE : Perform 4th order Runge Kutta integration on the current system state vector.
+            Intermediate stages live in the Model's workspace, so no state
+            vectors are allocated here.
+* INPUTS :  const StateVector& Sn, system state vector at time n
+            const StateVector& S_dot, derivative of Sn (K1)
+            float timestep
+            StateVector& Sn1, preallocated output, must not alias Sn
+* OUTPUTS : Sn1, system state vector at time n+1 
+*/
+//-----------------------------------------------------------------
+
+void Model::numInt(const StateVector& Sn, const StateVector& S_dot, float timestep, StateVector& Sn1)
+{
+   const StateVector& K1 = S_dot;
+
+   Stemp.setSum(Sn, K1, timestep/2.0);
+   F(Stemp, (t + (timestep/2.0)), K2);
+   Stemp.setSum(Sn, K2, timestep/2.0);
+   F(Stemp, (t + (timestep/2.0)), K3);
+   Stemp.setSum(Sn, K3, timestep);
+   F(Stemp, (t + timestep), K4);
+
+   // Sn1 = Sn + h/6 (K1 + 2 K2 + 2 K3 + K4)
+   Sn1.setSum(Sn, K1, timestep/6.0);
+   Sn1.addScaled(K2, timestep/3.0);
+   Sn1.addScaled(K3, timestep/3.0);
+   Sn1.addScaled(K4, timestep/6.0);
+}
+
+//-----------------------------------------------------------------
+/*
+Model::symplecticEulerStep()
+* PURPOSE : Advance S by h with semi-implicit Euler: the velocities take
+            a full step with the current accelerations, then the positions
+            move with the new velocities. One evaluation of F per step and
+            no energy drift for undamped springs.
+* INPUTS :  None
+* OUTPUTS : None, advances S in place
+*/
+//-----------------------------------------------------------------
+
+void Model::symplecticEulerStep()
+{
+   F(S, t, Sdot);
+
+   for (int i = 0; i < numParticles; i++)
    {
-      particles[m].clearForce();
-      particles[m].computeExtForces();
+      S.vx[i] += h * Sdot.vx[i];
+      S.vy[i] += h * Sdot.vy[i];
+      S.vz[i] += h * Sdot.vz[i];
+      S.x[i] += h * S.vx[i];
+      S.y[i] += h * S.vy[i];
+      S.z[i] += h * S.vz[i];
    }
+}
+
+//-----------------------------------------------------------------
+/*
+Model::velocityVerletStep()
+* PURPOSE : Advance S by h with velocity Verlet: half a velocity step,
+            a full position step, then the second half with the new
+            accelerations. The new accelerations are kept in Sdot for the
+            first half of the next step, so after the first step there is
+            one evaluation of F per step. The damping force is evaluated
+            with the half step velocities.
+* INPUTS :  None
+* OUTPUTS : None, advances S
+*/
+//-----------------------------------------------------------------
 
-   for (int n=0; n < numStruts; n++){
-      struts[n].computeVertForces(particles);
+void Model::velocityVerletStep()
+{
+   if(!accelValid)
+      F(S, t, Sdot);
+
+   Real half = 0.5 * h;
+   for (int i = 0; i < numParticles; i++)
+   {
+      Snew.vx[i] = S.vx[i] + half * Sdot.vx[i];
+      Snew.vy[i] = S.vy[i] + half * Sdot.vy[i];
+      Snew.vz[i] = S.vz[i] + half * Sdot.vz[i];
+      Snew.x[i] = S.x[i] + h * Snew.vx[i];
+      Snew.y[i] = S.y[i] + h * Snew.vy[i];
+      Snew.z[i] = S.z[i] + h * Snew.vz[i];
    }
 
-   for (int o=0; o < numParticles; o++)
+   F(Snew, t + h, Sdot);
+
+   for (int i = 0; i < numParticles; i++)
    {
-      particles[o].computeAcceleration(); 
-      // copy acceleration to derivative state vector
-      deriv.states[o + numParticles].set(particles[o].acceleration.x, particles[o].acceleration.y, particles[o].acceleration.z);
+      Snew.vx[i] += half * Sdot.vx[i];
+      Snew.vy[i] += half * Sdot.vy[i];
+      Snew.vz[i] += half * Sdot.vz[i];
    }
+   S.swap(Snew);
+   accelValid = true;
+}
+
+//
+// largest eigenvalue of a symmetric 3x3 matrix, entries xx yy zz xy xz yz
+//
+static double largestEigenvalue(const double* A)
+{
+  double off = A[3] * A[3] + A[4] * A[4] + A[5] * A[5];
+  double mean = (A[0] + A[1] + A[2]) / 3;
+  if(off == 0)
+    return fmax(A[0], fmax(A[1], A[2]));
+
+  double a = A[0] - mean, b = A[1] - mean, c = A[2] - mean;
+  double p = sqrt((a * a + b * b + c * c + 2 * off) / 6);
+  double det = a * (b * c - A[5] * A[5]) - A[3] * (A[3] * c - A[5] * A[4]) + A[4] * (A[3] * A[5] - b * A[4]);
+  double r = det / (2 * p * p * p);
+  r = (r < -1) ? -1 : (r > 1) ? 1 : r;
+  return mean + 2 * p * cos(acos(r) / 3);
+}
 
-   
-   
-   return deriv;
-} 
 //-----------------------------------------------------------------
 /*
-StateVector Model::numInt(StateVector Sn, StateVector Sn1, float timestep)
-* PURPOSE : Perform 4th order Runge Kutta integration on the current system state vector
-* INPUTS :  StateVector Sn, system state vector at time n
-            StateVector S_dot, system state vector at time n+1
-            float timestep
-* OUTPUTS : StateVector Snew, result of integration 
+Model::estimateStableStep()
+* PURPOSE : Estimate the largest substep the explicit Dormand-Prince
+            integrator stays stable at, from the strut constants, their
+            directions at rest and the particle masses. Each strut adds
+            k u u^T to the stiffness blocks of its two particles at the
+            diagonal and its own block off it, and likewise d u u^T to the
+            damping. By the block Gershgorin theorem every eigenvalue of a
+            particle's rows is at most the largest eigenvalue of its
+            diagonal block plus the norms of its off diagonal blocks, over
+            its mass; for the stiffness that gives kappa, for the damping
+            gamma. A damped oscillator with those constants has eigenvalues
+            no larger than max(sqrt(kappa), gamma). The bound is
+            conservative. Run once the lattice is built or restored, so
+            the steps themselves never allocate.
+* INPUTS :  None
+* OUTPUTS : None, sets stableStep, 0 with no free particle or no
+            struts to limit it
 */
 //-----------------------------------------------------------------
 
-StateVector Model::numInt(StateVector Sn, StateVector S_dot, float timestep)
+void Model::estimateStableStep()
 {
-   StateVector Snew = StateVector(numParticles);
-   StateVector K1 = S_dot;
-   StateVector K2 = F(Sn.add(K1.mult(timestep/2.0)), (t + (timestep/2.0)));
-   StateVector K3 = F(Sn.add(K2.mult(timestep/2.0)), (t + (timestep/2.0)));
-   StateVector K4 = F(Sn.add(K3.mult(timestep)), (t + timestep));
-
-   StateVector RK = K1.add(K2.mult(2));
-   RK = RK.add(K3.mult(2));
-   RK = RK.add(K4);
-   RK = RK.mult(timestep/6.0);
-   
-   Snew = Sn.add(RK);
-   return Snew;
+  // per particle: diagonal stiffness and damping blocks, then the sums
+  // of k and d, which are also the summed norms of the off diagonal blocks
+  int np = numParticles > 0 ? numParticles : 1;
+  double* blockK = new double[6 * np];
+  double* blockD = new double[6 * np];
+  double* sumK = new double[np];
+  double* sumD = new double[np];
+  for(int i = 0; i < numParticles; i++){
+    for(int a = 0; a < 6; a++)
+      blockK[6 * i + a] = blockD[6 * i + a] = 0;
+    sumK[i] = sumD[i] = 0;
+  }
+
+  for(int s = 0; s < strutSet.getNumStruts(); s++){
+    int ends[2] = {strutSet.i0[s], strutSet.i1[s]};
+    Vec3d u = normalize(Vec3d(restState.position(ends[1]) - restState.position(ends[0])));
+    double uu[6] = {u.x * u.x, u.y * u.y, u.z * u.z, u.x * u.y, u.x * u.z, u.y * u.z};
+    for(int e = 0; e < 2; e++){
+      int i = ends[e];
+      for(int a = 0; a < 6; a++){
+        blockK[6 * i + a] += strutSet.k[s] * uu[a];
+        blockD[6 * i + a] += strutSet.d[s] * uu[a];
+      }
+      sumK[i] += strutSet.k[s];
+      sumD[i] += strutSet.d[s];
+    }
+  }
+
+  double largest = 0;
+  for(int i = 0; i < numParticles; i++){
+    if(particles.pinned[i] || !(particles.mass[i] > 0))
+      continue;
+    double kappa = (largestEigenvalue(blockK + 6 * i) + sumK[i]) / particles.mass[i];
+    double gamma = (largestEigenvalue(blockD + 6 * i) + sumD[i]) / particles.mass[i];
+    double lambda = fmax(sqrt(fmax(kappa, 0.0)), gamma);
+    if(lambda > largest)
+      largest = lambda;
+  }
+  delete[] blockK;
+  delete[] blockD;
+  delete[] sumK;
+  delete[] sumD;
+
+  stableStep = (largest > 0) ? DOPRI_STABILITY / largest : 0;
+}
+
+//-----------------------------------------------------------------
+/*
+Model::dormandPrinceStep()
+* PURPOSE : Advance S by h in Dormand-Prince 5(4) substeps. The embedded
+            4th order solution estimates each substep's error, and a PI
+            controller sizes the next substep from it and the error before,
+            so quiet motion covers h in one substep and violent motion in
+            many. Substeps never exceed the stable step estimate. Rejected
+            substeps are retried smaller. The derivative at the end of a
+            substep is its successor's first stage, so an accepted substep
+            costs six evaluations of F. A substep that is not finite is
+            never accepted; if one still is not at the smallest substep,
+            the step fails and S is left as it was at that substep.
+* INPUTS :  None
+* OUTPUTS : bool, false if the motion could not be kept finite
+*/
+//-----------------------------------------------------------------
+
+bool Model::dormandPrinceStep()
+{
+  StateVector* K[7] = {&Sdot, &K2, &K3, &K4, &K5, &K6, &K7};
+  int length = S.getLength();
+  double limit = stableStep;
+  double minStep = 1.0e-6 * h;
+
+  if(!accelValid)
+    F(S, t, Sdot);
+  if(!(substep > 0))
+    substep = h;
+
+  double done = 0;
+  bool rejected = false;
+  while(done < h){
+    double remaining = h - done;
+    double dt = substep;
+    if(limit > 0 && dt > limit)
+      dt = limit;
+    bool last = (dt >= remaining);
+    if(last)
+      dt = remaining;
+
+    // stages 2 to 7, stage 7 at the 5th order solution
+    for(int st = 1; st < 7; st++){
+      StateVector& stage = (st == 6) ? Snew : Stemp;
+      stage.setSum(S, *K[0], DOPRI_A[st][0] * dt);
+      for(int j = 1; j < st; j++){
+        if(DOPRI_A[st][j] != 0)
+          stage.addScaled(*K[j], DOPRI_A[st][j] * dt);
+      }
+      F(stage, t + done + DOPRI_C[st] * dt, *K[st]);
+    }
+
+    // RMS of the error estimate scaled by tol (1 + max |y|)
+    const Real* y0 = S.getData();
+    const Real* y1 = Snew.getData();
+    double sum = 0;
+    bool finite = true;
+    for(int i = 0; i < length; i++){
+      if(!isfinite(y1[i]))
+        finite = false;
+      double e = 0;
+      for(int st = 0; st < 7; st++){
+        if(DOPRI_E[st] != 0)
+          e += DOPRI_E[st] * K[st]->getData()[i];
+      }
+      double size = fabs(y0[i]) > fabs(y1[i]) ? fabs(y0[i]) : fabs(y1[i]);
+      double scaled = dt * e / (errorTolerance * (1 + size));
+      sum += scaled * scaled;
+    }
+    double err = (length > 0) ? sqrt(sum / length) : 0;
+    if(!finite || !isfinite(err)){
+      if(dt <= minStep){
+        std::cerr << "Dormand-Prince substep is not finite at t = " << t + done << std::endl;
+        return false;
+      }
+      err = 1.0e10;		// retry as small as the controller allows
+    }
+
+    double grow = pow(err, DOPRI_ALPHA);
+    if(err <= 1 || dt <= minStep){
+      // accept, and take the next substep from this error and the last
+      double factor = grow / pow((double)substepError, DOPRI_BETA) / DOPRI_SAFETY;
+      if(factor < 1 / DOPRI_MAX_GROWTH) factor = 1 / DOPRI_MAX_GROWTH;
+      if(factor > DOPRI_MAX_SHRINK) factor = DOPRI_MAX_SHRINK;
+      double next = dt / factor;
+      if(last && next < substep && err <= 1)
+        next = substep;		// cut short by the end of the step, not by error
+      if(rejected && next > dt)
+        next = dt;
+      substep = next;
+      substepError = (err > DOPRI_MIN_ERROR) ? err : DOPRI_MIN_ERROR;
+
+      S.swap(Snew);
+      Sdot.swap(K7);
+      done = last ? h : done + dt;
+      rejected = false;
+    }
+    else{
+      double factor = grow / DOPRI_SAFETY;
+      if(factor > DOPRI_MAX_SHRINK) factor = DOPRI_MAX_SHRINK;
+      substep = dt / factor;
+      if(substep < minStep)
+        substep = minStep;
+      rejected = true;
+    }
+  }
+  accelValid = true;
+  return true;
 }
 
 //-----------------------------------------------------------------
 /*
 Model::timeStep()
-* PURPOSE : Perform one time step in the simulation
+* PURPOSE : Perform one time step in the simulation with the chosen integrator
 * INPUTS :  None
-* OUTPUTS : None, updates particles 
+* OUTPUTS : None, advances S
 */
 //-----------------------------------------------------------------
 
 void Model::timeStep(){
 
-StateVector Snew = StateVector(numParticles);
-
   if(running){
-     S.copyToSV(particles);
-     Sdot = F(S, t);
-     Snew = numInt(S, Sdot, h);
-     S = Snew;
-     S.copyFromSV(particles);
+     if(integrator == BACKWARD_EULER){
+        implicitSolver.step(S, particles, strutSet, h, ThreadPool::shared());
+     }
+     else if(integrator == SYMPLECTIC_EULER){
+        symplecticEulerStep();
+     }
+     else if(integrator == VELOCITY_VERLET){
+        velocityVerletStep();
+     }
+     else if(integrator == DORMAND_PRINCE){
+        if(!dormandPrinceStep()){
+           running = false;
+           return;
+        }
+     }
+     else if(integrator == PROJECTIVE_DYNAMICS){
+        if(!projectiveSolver.step(S, particles, strutSet, h, ThreadPool::shared())){
+           running = false;
+           return;
+        }
+     }
+     else{
+        F(S, t, Sdot);
+        numInt(S, Sdot, h, Snew);
+        S.swap(Snew);
+     }
      n = n + 1;
      t = n * h;
    }
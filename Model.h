@@ -8,15 +8,29 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
-#include "Vector.h"
+#include "Vec3.h"
 #include "StateVector.h"
-#include "Particle.h"
+#include "ParticleStore.h"
 #include "Strut.h"
 #include "Cell.h"
 #include "objtriloader.h"
 #include "Lattice.h"
+#include "ImplicitSolver.h"
+#include "ProjectiveSolver.h"
 
 class Model{
+  public:
+    // time integration method used by timeStep
+    enum Integrator{
+      RK4_INTEGRATOR,		// explicit 4th order Runge Kutta
+      BACKWARD_EULER,		// linearized implicit Euler, stable at large h
+      SYMPLECTIC_EULER,		// semi-implicit Euler, one force evaluation per step
+      VELOCITY_VERLET,		// 2nd order, one force evaluation per step
+      DORMAND_PRINCE,		// adaptive 5(4) Runge Kutta substeps within each step
+      PROJECTIVE_DYNAMICS,	// local global solve with a prefactored matrix, stable at large h
+      NUM_INTEGRATORS
+    };
+
   private:
     float h; 		// h, timestep
     int dispinterval;	
@@ -25,30 +39,67 @@ class Model{
     int n;
 
     int numParticles;
-    Particle* particles;
+    ParticleStore particles;	// mass, pinning and force accumulators
+    StateVector restState;	// lattice positions at rest, S is reset to this
 
     int numStruts;
-    Strut* struts;
+    StrutSet strutSet;		// attached struts, packed for the force kernel
 
     StateVector S;
     StateVector* Spointer;
     StateVector Sdot;
 
+    // RK4 workspace, sized once in initSimulation and reused every step;
+    // Dormand-Prince uses K5 to K7 as well
+    StateVector K2, K3, K4, K5, K6, K7;
+    StateVector Stemp;
+    StateVector Snew;
+
+    Integrator integrator;
+    bool accelValid;		// Sdot carries over from the last step, for velocity Verlet
+				// and Dormand-Prince
+
+    // Dormand-Prince step control
+    float errorTolerance;	// relative and absolute error allowed per substep
+    float substep;		// next substep to try, 0 before the first
+    float substepError;		// scaled error of the last accepted substep
+    float stableStep;		// stability limit of the substeps, 0 for none
+    long evaluations;		// calls of F so far
+    ImplicitSolver implicitSolver;	// sparse system of the backward Euler step
+    ProjectiveSolver projectiveSolver;	// factored system of the projective dynamics step
+
+    int latticePlanes, latticeRows, latticeCols;	// lattice resolution in cells
+    float strutK, strutD;				// spring and damping constants
+    float latticeMass;					// total mass of the lattice
+
     float minX_bound, minY_bound, minZ_bound, maxX_bound, maxY_bound, maxZ_bound;
 
     Lattice lattice;
     Lattice* Lpointer;
 
+    void allocateWorkspace();	// size the integration workspace for numParticles
+    void estimateStableStep();	// set stableStep from the struts in place
+    void symplecticEulerStep();
+    void velocityVerletStep();
+    bool dormandPrinceStep();
+
+    friend class Checkpoint;	// saves and restores the private state
 
   public:
     Model();
 
     void setBoundingBox(float minX, float minY, float minZ, float maxX, float maxY, float maxZ);
+    void setResolution(int planes, int rows, int cols);
+    void setSpringConstants(float k, float d);
+    void setLatticeMass(float mass);
+    void setTimeStep(float timestep);
+    void setIntegrator(Integrator method);
+    void setErrorTolerance(float tol);
     void constructLattice();
     void initSimulation();
 
-    StateVector F(StateVector state_vec, float time); 
-    StateVector numInt(StateVector Sn, StateVector Sn1, float timestep);
+    void F(const StateVector& state_vec, float time, StateVector& deriv); 
+    void numInt(const StateVector& Sn, const StateVector& S_dot, float timestep, StateVector& Sn1);
 
     void timeStep();
     void startSimulation();     
@@ -58,9 +109,22 @@ class Model{
     int getNumParticles(){return numParticles;}
     StateVector* getSPointer(){Spointer = &S; return Spointer;}
     Lattice* getLPointer(){Lpointer = &lattice; return Lpointer;}
-    Particle* getParticles(){return particles;}
-    Strut* getStruts(){return struts;}
+    ParticleStore* getParticles(){return &particles;}
+    const StateVector& getRestState(){return restState;}
+    StrutSet* getStruts(){return &strutSet;}
     int getNumStruts(){return numStruts;}
+    int getStep(){return n;}
+    float getTime(){return t;}
+    float getTimeStep(){return h;}
+    Integrator getIntegrator(){return integrator;}
+    float getErrorTolerance(){return errorTolerance;}
+    float getStableStep(){return stableStep;}
+    long getNumEvaluations(){return evaluations;}
+    ImplicitSolver* getImplicitSolver(){return &implicitSolver;}
+    ProjectiveSolver* getProjectiveSolver(){return &projectiveSolver;}
+
+    static const char* integratorName(Integrator method);
+    static bool findIntegrator(const char* name, Integrator& method);
 };
 
 #endif
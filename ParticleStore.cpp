@@ -0,0 +1,204 @@
+/*
+* ParticleStore.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Per particle mass, pinning and force storage kept as
+* separate contiguous arrays, so the force and integration
+* loops stream through memory and vectorize. Compiled for
+* float and double.
+*/
+
+#include "ParticleStore.h"
+#include "StateVector.h"
+#include <cmath>
+
+using namespace std;
+
+//-----------------------------------------------------------------
+/*
+ParticleStore::ParticleStore()
+* PURPOSE : Default constructor
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+ParticleStoreT<T>::ParticleStoreT()
+{
+   numParticles = 0;
+   mass = NULL;
+   invMass = NULL;
+   pinned = NULL;
+   fx = fy = fz = NULL;
+   gravity = Vec3T<T>(0.2, -0.6, -0.05);
+}
+
+//-----------------------------------------------------------------
+/*
+ParticleStore::ParticleStore(int np)
+* PURPOSE : Variable constructor, every particle starts free with unit mass
+* INPUTS :  int np, number of particles
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+ParticleStoreT<T>::ParticleStoreT(int np)
+{
+   numParticles = 0;
+   mass = NULL;
+   invMass = NULL;
+   pinned = NULL;
+   fx = fy = fz = NULL;
+   gravity = Vec3T<T>(0.2, -0.6, -0.05);
+   resize(np);
+}
+
+template<class T>
+ParticleStoreT<T>::~ParticleStoreT()
+{
+   delete[] mass;
+   delete[] invMass;
+   delete[] pinned;
+   delete[] fx;
+   delete[] fy;
+   delete[] fz;
+}
+
+template<class T>
+ParticleStoreT<T>::ParticleStoreT(const ParticleStoreT& other)
+{
+   numParticles = 0;
+   mass = NULL;
+   invMass = NULL;
+   pinned = NULL;
+   fx = fy = fz = NULL;
+   *this = other;
+}
+
+template<class T>
+ParticleStoreT<T>& ParticleStoreT<T>::operator=(const ParticleStoreT& other)
+{
+   if (this != &other)
+   {
+      resize(other.numParticles);
+      for (int i = 0; i < numParticles; i++)
+      {
+         mass[i] = other.mass[i];
+         invMass[i] = other.invMass[i];
+         pinned[i] = other.pinned[i];
+         fx[i] = other.fx[i];
+         fy[i] = other.fy[i];
+         fz[i] = other.fz[i];
+      }
+      gravity = other.gravity;
+   }
+   return *this;
+}
+
+//-----------------------------------------------------------------
+/*
+ParticleStore::resize(int np)
+* PURPOSE : Size the store for np particles, resetting every particle to
+            a free particle of unit mass if the size changes
+* INPUTS :  int np, number of particles
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ParticleStoreT<T>::resize(int np)
+{
+   if (np == numParticles)
+      return;
+
+   delete[] mass;
+   delete[] invMass;
+   delete[] pinned;
+   delete[] fx;
+   delete[] fy;
+   delete[] fz;
+
+   numParticles = np;
+   mass = new T[np];
+   invMass = new T[np];
+   pinned = new unsigned char[np];
+   fx = new Force[np];
+   fy = new Force[np];
+   fz = new Force[np];
+
+   for (int i = 0; i < np; i++)
+   {
+      mass[i] = 1.0;
+      invMass[i] = 1.0;
+      pinned[i] = 0;
+      fx[i] = fy[i] = fz[i] = 0.0;
+   }
+}
+
+template<class T>
+void ParticleStoreT<T>::setMass(int i, double m)
+{
+   mass[i] = (T)fabs(m);			// Mass must be positive
+   invMass[i] = pinned[i] ? 0 : 1 / mass[i];
+}
+
+template<class T>
+void ParticleStoreT<T>::setPinned(int i, bool p)
+{
+   pinned[i] = p ? 1 : 0;
+   invMass[i] = pinned[i] ? 0 : 1 / mass[i];
+}
+
+/***DEFINE EXTERNAL FORCES HERE****/
+
+//-----------------------------------------------------------------
+/*
+ParticleStore::applyExternalForces()
+* PURPOSE : Reset the force accumulators to the external forces. Pinned
+            particles receive no force.
+* INPUTS :  None
+* OUTPUTS : None, overwrites fx, fy, fz
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ParticleStoreT<T>::applyExternalForces()
+{
+   for (int i = 0; i < numParticles; i++)
+   {
+      Force m = pinned[i] ? 0 : mass[i];
+      fx[i] = m * (Force)gravity.x;
+      fy[i] = m * (Force)gravity.y;
+      fz[i] = m * (Force)gravity.z;
+   }
+}
+
+//-----------------------------------------------------------------
+/*
+ParticleStore::computeAccelerations(StateVector& deriv)
+* PURPOSE : Write a = f / m into the velocity half of a derivative state.
+            Pinned particles have zero inverse mass and so never accelerate.
+* INPUTS :  StateVector& deriv, derivative state sized for this store
+* OUTPUTS : None, overwrites deriv.vx, deriv.vy, deriv.vz
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ParticleStoreT<T>::computeAccelerations(StateVectorT<T>& deriv) const
+{
+   T* ax = deriv.vx;
+   T* ay = deriv.vy;
+   T* az = deriv.vz;
+   for (int i = 0; i < numParticles; i++)
+   {
+      ax[i] = (T)(fx[i] * invMass[i]);
+      ay[i] = (T)(fy[i] * invMass[i]);
+      az[i] = (T)(fz[i] * invMass[i]);
+   }
+}
+
+template class ParticleStoreT<float>;
+template class ParticleStoreT<double>;
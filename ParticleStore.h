@@ -0,0 +1,56 @@
+/*
+* ParticleStore.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Structure of arrays storage for the per particle attributes
+* that do not change during integration (mass, pinning) along
+* with the force accumulators used by the dynamics function.
+* Positions and velocities live in the StateVector. The forces
+* are accumulated in Accum<T>::type.
+*/
+
+#ifndef __PARTICLESTORE_H__
+#define __PARTICLESTORE_H__
+
+#include "Vec3.h"
+#include "StateVector.h"
+#include "Precision.h"
+
+template<class T>
+class ParticleStoreT{
+	private:
+		int numParticles;
+
+	public:
+		typedef typename Accum<T>::type Force;
+
+		T* mass;
+		T* invMass;	// 1/mass for free particles, 0 for pinned ones
+		unsigned char* pinned;	// 1 if the particle is fixed in place
+
+		Force *fx, *fy, *fz;	// force accumulators
+
+		Vec3T<T> gravity;	// external acceleration applied to every free particle
+
+		ParticleStoreT();
+		ParticleStoreT(int np);
+		~ParticleStoreT();
+
+		ParticleStoreT(const ParticleStoreT& other);
+		ParticleStoreT& operator=(const ParticleStoreT& other);
+
+		void resize(int np);
+		void setMass(int i, double m);
+		void setPinned(int i, bool p);
+
+		void applyExternalForces();			  // fx, fy, fz = external forces
+		void computeAccelerations(StateVectorT<T>& deriv) const; // deriv.v = f / m
+
+		int getNumParticles() const {return numParticles;}
+};
+
+// the particle store the simulation runs in
+typedef ParticleStoreT<Real> ParticleStore;
+
+#endif
@@ -0,0 +1,210 @@
+/*
+* PointCache.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* PC2 layout, little endian:
+*    char  signature[12]   "POINTCACHE2\0"
+*    int   fileVersion     1
+*    int   numPoints
+*    float startFrame
+*    float sampleRate
+*    int   numSamples
+* followed by numSamples frames of numPoints float x y z. The
+* sample count is unknown until the run ends, so it is written as
+* zero and patched when the cache is closed.
+*/
+
+#include "PointCache.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+
+using namespace std;
+
+static const char PC2_SIGNATURE[12] = "POINTCACHE2";
+static const long PC2_NUMSAMPLES_OFFSET = 12 + 4 * sizeof(int32_t);
+
+//-----------------------------------------------------------------
+/*
+PointCacheWriter::PointCacheWriter()
+* PURPOSE : Default constructor, a closed writer
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+PointCacheWriter::PointCacheWriter()
+{
+   fp = NULL;
+   numPoints = 0;
+   numSamples = 0;
+   failed = closing = false;
+}
+
+PointCacheWriter::~PointCacheWriter()
+{
+   close();
+}
+
+//-----------------------------------------------------------------
+/*
+PointCacheWriter::open()
+* PURPOSE : Create the cache file, write its header and start the
+            writer thread
+* INPUTS :  const char *filename, file to create
+*           int npoints, vertices per frame
+*           float startFrame, float sampleRate, header timing fields
+*           int queueFrames, number of frame buffers
+* OUTPUTS : bool, false if the file could not be created
+*/
+//-----------------------------------------------------------------
+
+bool PointCacheWriter::open(const char *filename, int npoints, float startFrame, float sampleRate,
+                            int queueFrames)
+{
+   close();
+
+   fp = fopen(filename, "wb");
+   if (fp == NULL){
+      cerr << "Could not create point cache " << filename << endl;
+      return false;
+   }
+
+   int32_t version = 1, points = npoints, samples = 0;
+   bool ok = fwrite(PC2_SIGNATURE, 1, sizeof(PC2_SIGNATURE), fp) == sizeof(PC2_SIGNATURE) &&
+             fwrite(&version, sizeof(version), 1, fp) == 1 &&
+             fwrite(&points, sizeof(points), 1, fp) == 1 &&
+             fwrite(&startFrame, sizeof(startFrame), 1, fp) == 1 &&
+             fwrite(&sampleRate, sizeof(sampleRate), 1, fp) == 1 &&
+             fwrite(&samples, sizeof(samples), 1, fp) == 1;
+   if (!ok){
+      cerr << "Could not write point cache " << filename << endl;
+      fclose(fp);
+      fp = NULL;
+      return false;
+   }
+
+   numPoints = npoints;
+   numSamples = 0;
+   failed = closing = false;
+
+   if (queueFrames < 1)
+      queueFrames = 1;
+   for (int i = 0; i < queueFrames; i++){
+      buffers.push_back(new float[3 * numPoints]);
+      freeBuffers.push_back(buffers.back());
+   }
+
+   writer = thread(&PointCacheWriter::writerLoop, this);
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+PointCacheWriter::addFrame()
+* PURPOSE : Copy a frame into a free buffer and queue it for writing.
+            With every buffer queued, waits until the writer thread
+            frees one.
+* INPUTS :  const float *positions, x y z of every vertex
+* OUTPUTS : bool, false if the cache is not open or a write failed
+*/
+//-----------------------------------------------------------------
+
+bool PointCacheWriter::addFrame(const float *positions)
+{
+   if (fp == NULL)
+      return false;
+
+   float *buf;
+   {
+      unique_lock<mutex> guard(lock);
+      freed.wait(guard, [this]{return failed || !freeBuffers.empty();});
+      if (failed)
+         return false;
+      buf = freeBuffers.back();
+      freeBuffers.pop_back();
+   }
+
+   memcpy(buf, positions, 3 * numPoints * sizeof(float));
+
+   {
+      unique_lock<mutex> guard(lock);
+      pending.push_back(buf);
+   }
+   ready.notify_one();
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+PointCacheWriter::writerLoop()
+* PURPOSE : Background thread body, writes queued frames in order
+            until the writer is closed and the queue is empty
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void PointCacheWriter::writerLoop()
+{
+   unique_lock<mutex> guard(lock);
+   for (;;){
+      ready.wait(guard, [this]{return closing || !pending.empty();});
+      if (pending.empty())
+         break;
+
+      float *buf = pending.front();
+      pending.pop_front();
+
+      guard.unlock();
+      bool ok = fwrite(buf, sizeof(float), 3 * numPoints, fp) == (size_t)(3 * numPoints);
+      guard.lock();
+
+      if (ok)
+         numSamples++;
+      else
+         failed = true;
+      freeBuffers.push_back(buf);
+      freed.notify_one();
+   }
+}
+
+//-----------------------------------------------------------------
+/*
+PointCacheWriter::close()
+* PURPOSE : Drain the queue, patch the sample count into the header
+            and close the file
+* INPUTS :  None
+* OUTPUTS : bool, false if any write failed
+*/
+//-----------------------------------------------------------------
+
+bool PointCacheWriter::close()
+{
+   if (fp == NULL)
+      return true;
+
+   {
+      unique_lock<mutex> guard(lock);
+      closing = true;
+   }
+   ready.notify_one();
+   writer.join();
+
+   int32_t samples = numSamples;
+   bool ok = !failed &&
+             fseek(fp, PC2_NUMSAMPLES_OFFSET, SEEK_SET) == 0 &&
+             fwrite(&samples, sizeof(samples), 1, fp) == 1;
+   ok = (fclose(fp) == 0) && ok;
+   fp = NULL;
+   if (!ok)
+      cerr << "Error writing point cache" << endl;
+
+   for (size_t i = 0; i < buffers.size(); i++)
+      delete[] buffers[i];
+   buffers.clear();
+   freeBuffers.clear();
+   return ok;
+}
@@ -0,0 +1,70 @@
+/*
+* PointCache.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Writes deformed mesh vertex positions as a PC2 point cache: a
+* fixed header followed by one block of float x y z per vertex for
+* each frame. Frames are copied into a small set of preallocated
+* buffers and written by a background thread, so the simulation
+* normally never waits on the disk.
+*
+* When every buffer is still queued, addFrame blocks until the
+* writer frees one, so a disk slower than the simulation does stall
+* it. Dropping the frame instead would keep the simulation off the
+* disk entirely, but a PC2 file has no per frame timestamps: a lost
+* frame would silently shift every later frame in time. A stall
+* leaves a complete cache, which is what the cache is for.
+*/
+
+#ifndef __POINTCACHE_H__
+#define __POINTCACHE_H__
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class PointCacheWriter{
+   private:
+      FILE *fp;
+      int numPoints;
+      int numSamples;		// frames written to the file
+      bool failed;
+      bool closing;
+
+      std::vector<float*> buffers;	// all frame buffers
+      std::vector<float*> freeBuffers;	// buffers ready to take a frame
+      std::deque<float*> pending;	// filled buffers waiting to be written
+      std::mutex lock;
+      std::condition_variable ready;	// a frame was queued or the writer is closing
+      std::condition_variable freed;	// a buffer was written and is free again
+      std::thread writer;
+
+      void writerLoop();
+
+   public:
+      PointCacheWriter();
+      ~PointCacheWriter();
+
+      // Create the file and start the writer thread. startFrame and
+      // sampleRate go in the header; queueFrames bounds the frames in flight.
+      bool open(const char *filename, int npoints, float startFrame = 0, float sampleRate = 1,
+                int queueFrames = 16);
+
+      // Queue one frame of 3 * npoints floats, waiting for a free buffer
+      // if the queue is full. Returns false if the cache is not open or
+      // a write has failed.
+      bool addFrame(const float *positions);
+
+      // Write out everything queued, record the frame count and close.
+      // Returns false if any write failed.
+      bool close();
+
+      bool isOpen() const {return fp != NULL;}
+      int getNumSamples() const {return numSamples;}
+};
+
+#endif
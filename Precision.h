@@ -0,0 +1,33 @@
+/*
+* Precision.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Scalar type of the simulation core. The state vector, particle
+* store and strut set are templates over their scalar type, with
+* both float and double compiled; Real picks the one the simulation
+* runs in. Build with PRECISION=float for single precision, which
+* halves the memory traffic of the force and integration loops and
+* doubles the SIMD width of the strut kernel.
+*
+* Accum<T>::type is the type sums of many terms are kept in, the
+* particle force accumulators and the state vector arithmetic. It is
+* T itself unless built with ACCUMULATE=double.
+*/
+
+#ifndef __PRECISION_H__
+#define __PRECISION_H__
+
+#ifdef SIM_SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+template<class T> struct Accum {typedef T type;};
+
+#ifdef SIM_DOUBLE_ACCUMULATE
+template<> struct Accum<float> {typedef double type;};
+#endif
+
+#endif
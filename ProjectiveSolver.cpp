@@ -0,0 +1,498 @@
+/*
+* ProjectiveSolver.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* A step from positions x0 and velocities v0 minimizes
+*
+*    1/(2 h^2) |M^1/2 (x - y)|^2 + sum k/2 |x_j - x_i - p_s|^2
+*       + 1/(2 h) sum d |(x_j - x_i) - (x0_j - x0_i)|^2
+*
+* with y = x0 + h v0 + h^2 g the inertial prediction and p_s the strut
+* vector projected onto rest length l_rest. Holding the projections
+* fixed, setting the gradient to zero gives the global system
+*
+*    (M + h D + h^2 L) x = M y + h D x0 + h^2 J p
+*
+* where L and D are the graph Laplacians weighted by k and d and J p
+* scatters k p_s to the struts' ends. Holding x fixed, the best p_s is
+* l_rest times the unit strut vector. The new velocities are
+* (x - x0) / h. Pinned particles keep their positions: their rows are
+* the identity and their couplings move to the right hand side.
+*
+* The struts only damp along their length, d u u^T rather than the
+* d I of D. The difference, d (I - u u^T), is moved to the right hand
+* side at the last iterate, so each iteration is also a step of a
+* splitting that converges to damping along the struts alone; it
+* converges because the matrix with D bounds the one without.
+*
+* The factor is an envelope (profile) Cholesky factorization. Reverse
+* Cuthill-McKee ordering keeps the envelope, which holds all the fill,
+* to about one lattice plane per row. The local step and right hand
+* side run over the strut color batches in parallel; the triangular
+* solves are serial, all three coordinates at once. Compiled for float
+* and double.
+*/
+
+#include "ProjectiveSolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::ProjectiveSolver()
+* PURPOSE : Default constructor, nothing factored yet
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+ProjectiveSolverT<T>::ProjectiveSolverT()
+{
+   numParticles = numStruts = 0;
+   factoredStep = 0;
+   order = end0 = end1 = first = NULL;
+   rowStart = NULL;
+   factor = NULL;
+   inertia = rhs = x = NULL;
+   iterations = 10;
+}
+
+template<class T>
+ProjectiveSolverT<T>::~ProjectiveSolverT()
+{
+   release();
+}
+
+template<class T>
+void ProjectiveSolverT<T>::release()
+{
+   delete[] order;
+   delete[] end0;
+   delete[] end1;
+   delete[] first;
+   delete[] rowStart;
+   delete[] factor;
+   delete[] inertia;
+   delete[] rhs;
+   delete[] x;
+   order = end0 = end1 = first = NULL;
+   rowStart = NULL;
+   factor = NULL;
+   inertia = rhs = x = NULL;
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::reset()
+* PURPOSE : Forget the ordering and the factor. Call whenever the struts
+            or masses change; the next step rebuilds them.
+* INPUTS :  None
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ProjectiveSolverT<T>::reset()
+{
+   release();
+   numParticles = numStruts = 0;
+   factoredStep = 0;
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::setIterations()
+* PURPOSE : Set the number of local global iterations per step. More
+            iterations approach the fully converged implicit step; fewer
+            are cheaper and softer.
+* INPUTS :  int n, iterations, at least 1
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ProjectiveSolverT<T>::setIterations(int n)
+{
+   if (n > 0)
+      iterations = n;
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::orderRows()
+* PURPOSE : Reverse Cuthill-McKee order the particles and lay out the
+            envelope of the factor. Each connected part of the strut graph
+            is numbered breadth first from a pseudo peripheral particle,
+            neighbors in order of increasing degree, and the numbering is
+            then reversed.
+* INPUTS :  const StrutSet& struts, the struts
+*           int np, number of particles
+* OUTPUTS : None, allocates the ordering, the envelope and the vectors
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ProjectiveSolverT<T>::orderRows(const StrutSetT<T>& struts, int np)
+{
+   release();
+   numParticles = np;
+   numStruts = struts.getNumStruts();
+
+   // strut graph adjacency
+   vector<int> adjStart(np + 1, 0);
+   vector<int> adj(2 * (size_t)numStruts);
+   for (int s = 0; s < numStruts; s++){
+      adjStart[struts.i0[s] + 1]++;
+      adjStart[struts.i1[s] + 1]++;
+   }
+   for (int i = 0; i < np; i++)
+      adjStart[i + 1] += adjStart[i];
+   vector<int> next(adjStart.begin(), adjStart.end() - 1);
+   for (int s = 0; s < numStruts; s++){
+      adj[next[struts.i0[s]]++] = struts.i1[s];
+      adj[next[struts.i1[s]]++] = struts.i0[s];
+   }
+   auto degree = [&](int i){return adjStart[i + 1] - adjStart[i];};
+   auto byDegree = [&](int a, int b){return degree(a) < degree(b) || (degree(a) == degree(b) && a < b);};
+   for (int i = 0; i < np; i++)
+      sort(adj.begin() + adjStart[i], adj.begin() + adjStart[i + 1], byDegree);
+
+   vector<int> seq;
+   seq.reserve(np);
+   vector<int> level(np, -1);
+   vector<char> numbered(np, 0);
+
+   // breadth first levels from root over the unnumbered particles,
+   // returning the last level's particle of least degree and its depth
+   vector<int> queue;
+   auto sweep = [&](int root, int& depth){
+      queue.clear();
+      queue.push_back(root);
+      level[root] = 0;
+      for (size_t q = 0; q < queue.size(); q++){
+         int i = queue[q];
+         for (int a = adjStart[i]; a < adjStart[i + 1]; a++){
+            int j = adj[a];
+            if (!numbered[j] && level[j] < 0){
+               level[j] = level[i] + 1;
+               queue.push_back(j);
+            }
+         }
+      }
+      depth = level[queue.back()];
+      int far = queue.back();
+      for (size_t q = queue.size(); q-- > 0 && level[queue[q]] == depth;)
+         if (degree(queue[q]) < degree(far))
+            far = queue[q];
+      for (size_t q = 0; q < queue.size(); q++)
+         level[queue[q]] = -1;
+      return far;
+   };
+
+   for (int start = 0; start < np; start++){
+      if (numbered[start])
+         continue;
+
+      // walk to a pseudo peripheral particle of this part
+      int root = start, depth = 0, farDepth;
+      int far = sweep(root, depth);
+      for (int tries = 0; tries < 8; tries++){
+         int candidate = sweep(far, farDepth);
+         if (farDepth <= depth)
+            break;
+         root = far;
+         depth = farDepth;
+         far = candidate;
+      }
+
+      // Cuthill-McKee numbering of the part
+      size_t head = seq.size();
+      seq.push_back(root);
+      numbered[root] = 1;
+      for (size_t q = head; q < seq.size(); q++){
+         int i = seq[q];
+         for (int a = adjStart[i]; a < adjStart[i + 1]; a++){
+            int j = adj[a];
+            if (!numbered[j]){
+               numbered[j] = 1;
+               seq.push_back(j);
+            }
+         }
+      }
+   }
+
+   order = new int[np > 0 ? np : 1];
+   for (int k = 0; k < np; k++)
+      order[seq[np - 1 - k]] = k;
+
+   end0 = new int[numStruts > 0 ? numStruts : 1];
+   end1 = new int[numStruts > 0 ? numStruts : 1];
+   for (int s = 0; s < numStruts; s++){
+      end0[s] = order[struts.i0[s]];
+      end1[s] = order[struts.i1[s]];
+   }
+
+   // envelope: each row from its first nonzero column to the diagonal
+   first = new int[np > 0 ? np : 1];
+   for (int r = 0; r < np; r++)
+      first[r] = r;
+   for (int s = 0; s < numStruts; s++){
+      int lo = min(end0[s], end1[s]);
+      int hi = max(end0[s], end1[s]);
+      if (lo < first[hi])
+         first[hi] = lo;
+   }
+   rowStart = new long[np + 1];
+   rowStart[0] = 0;
+   for (int r = 0; r < np; r++)
+      rowStart[r + 1] = rowStart[r] + (r - first[r] + 1);
+
+   factor = new double[rowStart[np] > 0 ? rowStart[np] : 1];
+   inertia = new double[np > 0 ? 3 * np : 1];
+   rhs = new double[np > 0 ? 3 * np : 1];
+   x = new double[np > 0 ? 3 * np : 1];
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::factorize()
+* PURPOSE : Assemble M + h D + h^2 L in the envelope and factor it in
+            place, row by row
+* INPUTS :  const ParticleStore& particles, masses and pinning
+*           const StrutSet& struts, the struts
+*           double h, time step
+* OUTPUTS : bool, false if the matrix is not positive definite
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+bool ProjectiveSolverT<T>::factorize(const ParticleStoreT<T>& particles, const StrutSetT<T>& struts, double h)
+{
+   int np = numParticles;
+   memset(factor, 0, rowStart[np] * sizeof(double));
+
+   for (int i = 0; i < np; i++){
+      int r = order[i];
+      factor[rowStart[r] + (r - first[r])] = particles.pinned[i] ? 1 : (double)particles.mass[i];
+   }
+   for (int s = 0; s < numStruts; s++){
+      double w = h * (double)struts.d[s] + h * h * (double)struts.k[s];
+      bool pi = particles.pinned[struts.i0[s]] != 0;
+      bool pj = particles.pinned[struts.i1[s]] != 0;
+      int a = end0[s], b = end1[s];
+      if (!pi)
+         factor[rowStart[a] + (a - first[a])] += w;
+      if (!pj)
+         factor[rowStart[b] + (b - first[b])] += w;
+      if (!pi && !pj){
+         int hi = max(a, b), lo = min(a, b);
+         factor[rowStart[hi] + (lo - first[hi])] -= w;
+      }
+   }
+
+   for (int i = 0; i < np; i++){
+      double* Li = factor + rowStart[i] - first[i];	// Li[c] is column c of row i
+      for (int j = first[i]; j <= i; j++){
+         const double* Lj = factor + rowStart[j] - first[j];
+         int k0 = max(first[i], first[j]);
+         double sum = Li[j];
+         for (int k = k0; k < j; k++)
+            sum -= Li[k] * Lj[k];
+         if (j < i)
+            Li[j] = sum / Lj[j];
+         else{
+            if (!(sum > 0)){
+               cerr << "Projective dynamics system is not positive definite" << endl;
+               return false;
+            }
+            Li[i] = sqrt(sum);
+         }
+      }
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::substitute()
+* PURPOSE : Solve L L^T x = rhs for all three coordinates, forward then
+            back substitution over the envelope
+* INPUTS :  None, reads rhs
+* OUTPUTS : None, overwrites x
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void ProjectiveSolverT<T>::substitute()
+{
+   int np = numParticles;
+
+   // L z = rhs
+   for (int i = 0; i < np; i++){
+      const double* Li = factor + rowStart[i] - first[i];
+      double sx = rhs[3 * i], sy = rhs[3 * i + 1], sz = rhs[3 * i + 2];
+      for (int k = first[i]; k < i; k++){
+         sx -= Li[k] * x[3 * k];
+         sy -= Li[k] * x[3 * k + 1];
+         sz -= Li[k] * x[3 * k + 2];
+      }
+      double inv = 1 / Li[i];
+      x[3 * i] = sx * inv;
+      x[3 * i + 1] = sy * inv;
+      x[3 * i + 2] = sz * inv;
+   }
+
+   // L^T x = z, by columns of L^T, that is rows of L
+   for (int i = np - 1; i >= 0; i--){
+      const double* Li = factor + rowStart[i] - first[i];
+      double inv = 1 / Li[i];
+      double xx = x[3 * i] *= inv;
+      double xy = x[3 * i + 1] *= inv;
+      double xz = x[3 * i + 2] *= inv;
+      for (int k = first[i]; k < i; k++){
+         x[3 * k] -= Li[k] * xx;
+         x[3 * k + 1] -= Li[k] * xy;
+         x[3 * k + 2] -= Li[k] * xz;
+      }
+   }
+}
+
+//-----------------------------------------------------------------
+/*
+ProjectiveSolver::step()
+* PURPOSE : Advance the state one projective dynamics step. The ordering
+            is built with the first step and the factor again whenever h
+            changes.
+* INPUTS :  StateVector& state, the state, advanced in place
+*           const ParticleStore& particles, masses, pinning and gravity
+*           const StrutSet& struts, the struts
+*           double h, time step
+*           ThreadPool& pool, threads to use
+* OUTPUTS : bool, false if the system could not be factored; the state
+            is then unchanged
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+bool ProjectiveSolverT<T>::step(StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+                                const StrutSetT<T>& struts, double h, ThreadPool& pool)
+{
+   int np = state.getNumParticles();
+   if (order == NULL || np != numParticles || struts.getNumStruts() != numStruts){
+      orderRows(struts, np);
+      factoredStep = 0;
+   }
+   if (factoredStep != h){
+      if (!factorize(particles, struts, h)){
+         factoredStep = 0;
+         return false;
+      }
+      factoredStep = h;
+   }
+
+   // inertial prediction, which also starts the iteration
+   Vec3d g(particles.gravity);
+   pool.parallelFor(0, np, [&](int b, int e){
+      for (int i = b; i < e; i++){
+         int r = order[i];
+         Vec3d xi(state.position(i));
+         Vec3d yi = xi;
+         double m = 1;
+         if (!particles.pinned[i]){
+            yi += Vec3d(state.velocity(i)) * h + g * (h * h);
+            m = particles.mass[i];
+         }
+         for (int a = 0; a < 3; a++){
+            inertia[3 * r + a] = m * yi[a];
+            x[3 * r + a] = yi[a];
+         }
+      }
+   }, 1024);
+
+   // damping toward the start positions, and the couplings of pinned
+   // particles, complete the constant part of the right hand side
+   for (int c = 0; c < struts.getNumColors(); c++){
+      pool.parallelFor(struts.colorBegin(c), struts.colorEnd(c), [&](int b, int e){
+         for (int s = b; s < e; s++){
+            int i = struts.i0[s], j = struts.i1[s];
+            bool pi = particles.pinned[i] != 0;
+            bool pj = particles.pinned[j] != 0;
+            if (pi && pj)
+               continue;
+            double hd = h * (double)struts.d[s];
+            double w = hd + h * h * (double)struts.k[s];
+            Vec3d xi(state.position(i)), xj(state.position(j));
+            Vec3d toI = (xi - xj) * hd;
+            if (!pi){
+               Vec3d add = pj ? toI + xj * w : toI;
+               for (int a = 0; a < 3; a++)
+                  inertia[3 * end0[s] + a] += add[a];
+            }
+            if (!pj){
+               Vec3d add = pi ? xi * w - toI : -toI;
+               for (int a = 0; a < 3; a++)
+                  inertia[3 * end1[s] + a] += add[a];
+            }
+         }
+      }, 256);
+   }
+
+   for (int it = 0; it < iterations; it++){
+      pool.parallelFor(0, 3 * np, [&](int b, int e){
+         memcpy(rhs + b, inertia + b, (e - b) * sizeof(double));
+      }, 4096);
+
+      // local step: project each strut onto its rest length and scatter
+      // h^2 k times the projection to its free ends, less the damping
+      // across the strut at the last iterate
+      for (int c = 0; c < struts.getNumColors(); c++){
+         pool.parallelFor(struts.colorBegin(c), struts.colorEnd(c), [&](int b, int e){
+            for (int s = b; s < e; s++){
+               int ra = end0[s], rb = end1[s];
+               Vec3d dx(x[3 * rb] - x[3 * ra], x[3 * rb + 1] - x[3 * ra + 1], x[3 * rb + 2] - x[3 * ra + 2]);
+               double l = norm(dx);
+               if (!(l > 0))
+                  continue;
+               Vec3d u = dx / l;
+               Vec3d moved = dx - Vec3d(state.position(struts.i1[s]) - state.position(struts.i0[s]));
+               Vec3d across = moved - u * dot(u, moved);
+               Vec3d p = u * (h * h * (double)struts.k[s] * (double)struts.l_rest[s]) +
+                         across * (h * (double)struts.d[s]);
+               if (!particles.pinned[struts.i0[s]])
+                  for (int a = 0; a < 3; a++)
+                     rhs[3 * ra + a] -= p[a];
+               if (!particles.pinned[struts.i1[s]])
+                  for (int a = 0; a < 3; a++)
+                     rhs[3 * rb + a] += p[a];
+            }
+         }, 256);
+      }
+
+      // global step
+      substitute();
+   }
+
+   pool.parallelFor(0, np, [&](int b, int e){
+      for (int i = b; i < e; i++){
+         if (particles.pinned[i])
+            continue;
+         int r = order[i];
+         Vec3d xi(x[3 * r], x[3 * r + 1], x[3 * r + 2]);
+         Vec3d vi = (xi - Vec3d(state.position(i))) / h;
+         state.setPosition(i, Vec3T<T>(xi));
+         state.setVelocity(i, Vec3T<T>(vi));
+      }
+   }, 1024);
+   return true;
+}
+
+template class ProjectiveSolverT<float>;
+template class ProjectiveSolverT<double>;
@@ -0,0 +1,82 @@
+/*
+* ProjectiveSolver.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Projective dynamics step for the strut lattice, after Liu et al.,
+* "Fast Simulation of Mass-Spring Systems". Each step alternates a
+* local step, which projects every strut onto its rest length, with a
+* global step, which solves one linear system for the positions that
+* best balance inertia against the projected struts. The system
+* matrix M + h D + h^2 L only depends on the masses, the strut
+* constants and h, and is the same for x, y and z, so it is factored
+* once with a sparse Cholesky factorization and every global step is
+* a back substitution. Like backward Euler it stays stable at large
+* time steps.
+*
+* The matrix carries the struts' damping in all directions, which
+* keeps it constant; the part across the struts is taken back out on
+* the right hand side as the iterations proceed, so the damping
+* converges to the force kernel's, along the struts only.
+*/
+
+#ifndef __PROJECTIVESOLVER_H__
+#define __PROJECTIVESOLVER_H__
+
+#include "StateVector.h"
+#include "ParticleStore.h"
+#include "Strut.h"
+#include "ThreadPool.h"
+#include "Precision.h"
+
+template<class T>
+class ProjectiveSolverT{
+	private:
+		int numParticles;
+		int numStruts;
+		double factoredStep;	// h the factor was made for, 0 if none
+
+		// particle i is row order[i] of the system, reverse Cuthill-McKee
+		// ordered so the factor's envelope stays narrow
+		int* order;
+		int* end0;		// strut ends as rows
+		int* end1;
+
+		// lower triangular Cholesky factor, envelope stored by rows: row i
+		// holds columns [first[i], i] at factor + rowStart[i]. Kept in
+		// double in either precision.
+		int* first;
+		long* rowStart;
+		double* factor;
+
+		// 3 * numParticles vectors by row, x y z interleaved
+		double *inertia;	// constant part of the right hand side
+		double *rhs;
+		double *x;
+
+		int iterations;		// local global iterations per step
+
+		void release();
+		void orderRows(const StrutSetT<T>& struts, int np);
+		bool factorize(const ParticleStoreT<T>& particles, const StrutSetT<T>& struts, double h);
+		void substitute();
+
+	public:
+		ProjectiveSolverT();
+		~ProjectiveSolverT();
+
+		void reset();		// forget the ordering and factor, rebuilt on the next step
+		void setIterations(int n);
+		int getIterations() const {return iterations;}
+
+		// advance state by h in place; false if the system could not be factored
+		bool step(StateVectorT<T>& state, const ParticleStoreT<T>& particles,
+		          const StrutSetT<T>& struts, double h, ThreadPool& pool);
+
+		long getFactorSize() const {return (numParticles > 0 && rowStart != NULL) ? rowStart[numParticles] : 0;}
+};
+
+// the solver the simulation runs in
+typedef ProjectiveSolverT<Real> ProjectiveSolver;
+
+#endif
@@ -9,11 +9,12 @@
 * (position and velocity, or their derivatives) of each
 * particle in the system. This makes for a more efficient
 * integration, particularly in the case of higher order
-* Runge Kutta.
+* Runge Kutta. Components are kept in separate contiguous
+* arrays so the integrator and force loops stream through
+* memory and vectorize. Compiled for float and double; the
+* arithmetic is carried out in Accum<T>::type.
 */
 #include "StateVector.h"
-#include "Vector.h"
-#include "Particle.h"
 #include <math.h>
 #include <iostream>
 
@@ -30,11 +31,13 @@ StateVector::StateVector()
 */
 //-----------------------------------------------------------------
 
-StateVector::StateVector()
+template<class T>
+StateVectorT<T>::StateVectorT()
 {
    numParticles = 0;
    length = 0;
-   states = NULL;
+   data = NULL;
+   setPointers();
 }
 
 //-----------------------------------------------------------------
@@ -47,120 +50,337 @@ StateVector::StateVector(int n)
 */
 //-----------------------------------------------------------------
 
-StateVector::StateVector(int n)
+template<class T>
+StateVectorT<T>::StateVectorT(int n)
 {
    numParticles = n;
-   length = numParticles * 2;
-   states = new Vector3d[length]; // state properties stored in flat array
+   length = numParticles * 6;
+   data = (length > 0) ? new T[length] : NULL; // state properties stored in flat array
+   setPointers();
 }
 
 //-----------------------------------------------------------------
 /*
-StateVector::fillConstant()
+void StateVector::setPointers()
 *
-* PURPOSE : 
-* INPUTS : NONE           
-* OUTPUTS : NONE 
+* PURPOSE : Point the component arrays at their blocks within data
+* INPUTS :  NONE
+* OUTPUTS : NONE
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StateVectorT<T>::setPointers()
+{
+   x = data;
+   y = (data == NULL) ? NULL : data + numParticles;
+   z = (data == NULL) ? NULL : data + 2 * numParticles;
+   vx = (data == NULL) ? NULL : data + 3 * numParticles;
+   vy = (data == NULL) ? NULL : data + 4 * numParticles;
+   vz = (data == NULL) ? NULL : data + 5 * numParticles;
+}
+
+//-----------------------------------------------------------------
+/*
+StateVector::~StateVector()
+*
+* PURPOSE : Destructor, releases the state array
+* INPUTS :  NONE
+* OUTPUTS : NONE
 */
 //-----------------------------------------------------------------
-void StateVector::fillConstant(float c)
+
+template<class T>
+StateVectorT<T>::~StateVectorT()
 {
+   delete[] data;
+}
+
+//-----------------------------------------------------------------
+/*
+StateVector::StateVector(const StateVector& other)
+*
+* PURPOSE : Copy constructor, deep copies the state array
+* INPUTS :  const StateVector& other, state vector to copy
+* OUTPUTS : NONE
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+StateVectorT<T>::StateVectorT(const StateVectorT& other)
+{
+   numParticles = other.numParticles;
+   length = other.length;
+   data = (length > 0) ? new T[length] : NULL;
    for (int i = 0; i < length; i++)
    {
-      states[i].set(c, c, c);
+      data[i] = other.data[i];
    }
+   setPointers();
 }
 
 //-----------------------------------------------------------------
 /*
-void StateVector::copyFromSV(Boid* boids)
+StateVector::StateVector(StateVector&& other)
 *
-* PURPOSE : 
-* INPUTS : NONE           
-* OUTPUTS : NONE 
+* PURPOSE : Move constructor, takes ownership of the state array
+* INPUTS :  StateVector&& other, state vector to move from
+* OUTPUTS : NONE
 */
 //-----------------------------------------------------------------
 
-void StateVector::copyFromSV(Particle* particles)
+template<class T>
+StateVectorT<T>::StateVectorT(StateVectorT&& other)
 {
-   for (int i=0; i < numParticles; i++)
+   numParticles = other.numParticles;
+   length = other.length;
+   data = other.data;
+   setPointers();
+
+   other.numParticles = 0;
+   other.length = 0;
+   other.data = NULL;
+   other.setPointers();
+}
+
+//-----------------------------------------------------------------
+/*
+StateVector& StateVector::operator=(const StateVector& other)
+*
+* PURPOSE : Copy assignment, reuses the existing array when the
+*           lengths already match
+* INPUTS :  const StateVector& other, state vector to copy
+* OUTPUTS : StateVector&, this
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+StateVectorT<T>& StateVectorT<T>::operator=(const StateVectorT& other)
+{
+   if (this != &other)
    {
-      particles[i].position.set(states[i].x, states[i].y, states[i].z);
-      particles[i].velocity.set(states[i + numParticles].x, states[i + numParticles].y, states[i + numParticles].z);
+      resize(other.numParticles);
+      for (int i = 0; i < length; i++)
+      {
+         data[i] = other.data[i];
+      }
    }
+   return *this;
 }
 
 //-----------------------------------------------------------------
 /*
-void StateVector::copyToSV(Boid* boids)
+StateVector& StateVector::operator=(StateVector&& other)
+*
+* PURPOSE : Move assignment, takes ownership of the state array
+* INPUTS :  StateVector&& other, state vector to move from
+* OUTPUTS : StateVector&, this
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+StateVectorT<T>& StateVectorT<T>::operator=(StateVectorT&& other)
+{
+   if (this != &other)
+   {
+      delete[] data;
+      numParticles = other.numParticles;
+      length = other.length;
+      data = other.data;
+      setPointers();
+
+      other.numParticles = 0;
+      other.length = 0;
+      other.data = NULL;
+      other.setPointers();
+   }
+   return *this;
+}
+
+//-----------------------------------------------------------------
+/*
+void StateVector::resize(int np)
+*
+* PURPOSE : Size the state vector for np particles. The array is only
+*           reallocated if the particle count changes, so workspaces
+*           that are resized every step stay allocation free.
+* INPUTS :  int np, number of particles in the system
+* OUTPUTS : NONE, contents are undefined after a reallocation
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StateVectorT<T>::resize(int np)
+{
+   if (np == numParticles && data != NULL)
+      return;
+
+   delete[] data;
+   numParticles = np;
+   length = numParticles * 6;
+   data = (length > 0) ? new T[length] : NULL;
+   setPointers();
+}
+
+//-----------------------------------------------------------------
+/*
+void StateVector::swap(StateVector& other)
+*
+* PURPOSE : Exchange contents with another state vector without copying
+* INPUTS :  StateVector& other
+* OUTPUTS : NONE
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StateVectorT<T>::swap(StateVectorT& other)
+{
+   int np = numParticles;
+   int len = length;
+   T* d = data;
+
+   numParticles = other.numParticles;
+   length = other.length;
+   data = other.data;
+   setPointers();
+
+   other.numParticles = np;
+   other.length = len;
+   other.data = d;
+   other.setPointers();
+}
+
+//-----------------------------------------------------------------
+/*
+StateVector::fillConstant()
 *
 * PURPOSE : 
 * INPUTS : NONE           
 * OUTPUTS : NONE 
 */
 //-----------------------------------------------------------------
-
-void StateVector::copyToSV(Particle* particles)
+template<class T>
+void StateVectorT<T>::fillConstant(float c)
 {
-   for (int i=0; i < numParticles; i++)
+   for (int i = 0; i < length; i++)
    {
-      states[i].set(particles[i].position.x, particles[i].position.y, particles[i].position.z);
+      data[i] = c;
    }
+}
+
+//-----------------------------------------------------------------
+/*
+StateVector StateVector::add(const StateVector& s2)
+*
+* PURPOSE : Add this to another state vector
+* INPUTS : const StateVector& s2, state vector of the same length
+* OUTPUTS : StateVector, this + s2
+*/
+//-----------------------------------------------------------------
+template<class T>
+StateVectorT<T> StateVectorT<T>::add(const StateVectorT& s2) const // add this to another statevector
+{
+   StateVectorT result = StateVectorT(numParticles);
+   result.setSum(*this, s2, 1.0);
+   return result;
+}
+//-----------------------------------------------------------------
+/*
+StateVector StateVector::mult(float k)
+*
+* PURPOSE : Multiply this by a scalar
+* INPUTS : float k, scale factor
+* OUTPUTS : StateVector, k * this
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+StateVectorT<T> StateVectorT<T>::mult(float k) const // multiply this by a scalar
+{
+   StateVectorT result = StateVectorT(*this);
+   result.scale(k);
+   return result;   
+}
 
-   for (int j = numParticles; j < length; j++)
+//-----------------------------------------------------------------
+/*
+void StateVector::scale(double k)
+*
+* PURPOSE : In-place scalar multiply, this = k * this
+* INPUTS : double k, scale factor
+* OUTPUTS : NONE
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StateVectorT<T>::scale(double k)
+{
+   typedef typename Accum<T>::type A;
+   const A kk = (A)k;
+   for (int i = 0; i < length; i++)
    {
-      states[j].set(particles[j-numParticles].velocity.x, particles[j-numParticles].velocity.y, particles[j-numParticles].velocity.z);
+      data[i] = (T)(data[i] * kk);
    }
 }
 
 //-----------------------------------------------------------------
 /*
-StateVector StateVector::add(StateVector s2)
+void StateVector::addScaled(const StateVector& s2, double k)
 *
-* PURPOSE : 
-* INPUTS : NONE           
-* OUTPUTS : NONE 
+* PURPOSE : In-place axpy, this = this + k * s2
+* INPUTS : const StateVector& s2, state vector of the same length
+*          double k, scale factor applied to s2
+* OUTPUTS : NONE
 */
 //-----------------------------------------------------------------
-StateVector StateVector::add(StateVector s2) // add this to another statevector
+
+template<class T>
+void StateVectorT<T>::addScaled(const StateVectorT& s2, double k)
 {
-   StateVector result = StateVector(numParticles);
-   result.fillConstant(0.0);
    if (length != s2.getLength())
    {
       std::cerr<< "State vectors must be the same length in order to perform addition." << std::endl;
+      return;
    }
-   else{
-      for (int i = 0; i < length; i++)
-      {
-         Vector3d r = states[i] + s2.states[i];
-         result.states[i] = r;
-      }
-      
-      return result;
+
+   typedef typename Accum<T>::type A;
+   const A kk = (A)k;
+   const T* src = s2.data;
+   for (int i = 0; i < length; i++)
+   {
+      data[i] = (T)((A)data[i] + kk * (A)src[i]);
    }
 }
+
 //-----------------------------------------------------------------
 /*
-StateVector StateVector::mult(float k)
+void StateVector::setSum(const StateVector& s1, const StateVector& s2, double k)
 *
-* PURPOSE : 
-* INPUTS : NONE           
-* OUTPUTS : NONE 
+* PURPOSE : Fused axpy into this, this = s1 + k * s2. This must already
+*           be sized to match s1 and s2; it may alias s1.
+* INPUTS : const StateVector& s1, s2, state vectors of the same length
+*          double k, scale factor applied to s2
+* OUTPUTS : NONE
 */
 //-----------------------------------------------------------------
 
-StateVector StateVector::mult(float k) // multiply this by a scalar
+template<class T>
+void StateVectorT<T>::setSum(const StateVectorT& s1, const StateVectorT& s2, double k)
 {
-   StateVector result = StateVector(numParticles);
+   if (length != s1.getLength() || length != s2.getLength())
+   {
+      std::cerr<< "State vectors must be the same length in order to perform addition." << std::endl;
+      return;
+   }
 
+   typedef typename Accum<T>::type A;
+   const A kk = (A)k;
+   const T* a = s1.data;
+   const T* b = s2.data;
    for (int i = 0; i < length; i++)
    {
-      Vector3d r = states[i] * k;
-      result.states[i] = r;
+      data[i] = (T)((A)a[i] + kk * (A)b[i]);
    }
-   
-   return result;   
 }
 
 //-----------------------------------------------------------------
@@ -172,14 +392,18 @@ StateVector::print()
 * OUTPUTS : NONE
 */
 //-----------------------------------------------------------------
-void StateVector::print()
+template<class T>
+void StateVectorT<T>::print()
 {
-   for(int j = 0; j < (length); j++)
+   for(int j = 0; j < numParticles; j++)
    {
       std::cout << "index: " << j << std::endl;
-      std::cout << "(" << states[j].x << ", " << states[j].y << ", " << states[j].z << ")" << std::endl;
+      std::cout << "x (" << x[j] << ", " << y[j] << ", " << z[j] << ")" << std::endl;
+      std::cout << "v (" << vx[j] << ", " << vy[j] << ", " << vz[j] << ")" << std::endl;
       std::cout << " " << std::endl;
    }
 
 }
 
+template class StateVectorT<float>;
+template class StateVectorT<double>;
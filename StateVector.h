@@ -8,31 +8,62 @@
 #ifndef __STATEVECTOR_H__
 #define __STATEVECTOR_H__
 
-#include "Vector.h"
-#include "Particle.h"
+#include "Vec3.h"
+#include "Precision.h"
 
-class StateVector{
+// State is stored as structure of arrays: six contiguous blocks of
+// numParticles scalars, positions x, y, z followed by velocities vx, vy, vz.
+// The blocks are adjacent in one allocation, so whole-vector arithmetic
+// runs over a single flat array of length 6 * numParticles.
+template<class T>
+class StateVectorT{
 	private:
 		int numParticles;	
-                int length;
+                int length;		// number of scalars, 6 * numParticles
+                T* data;
+
+                void setPointers();
 	public:
-		StateVector();			
-                StateVector(int np);
+		StateVectorT();			
+                StateVectorT(int np);
+                ~StateVectorT();
+
+                StateVectorT(const StateVectorT& other);
+                StateVectorT(StateVectorT&& other);
+                StateVectorT& operator=(const StateVectorT& other);
+                StateVectorT& operator=(StateVectorT&& other);
 
-		Vector3d* states;	
+                T *x, *y, *z;      // positions
+                T *vx, *vy, *vz;   // velocities
 		
+                void resize(int np);   // reallocates only if the particle count changes
+                void swap(StateVectorT& other);
+
                 void fillConstant(float c);
-     		void copyFromSV(Particle* particles); 
-	        void copyToSV(Particle* particles); 
 
-                StateVector add(StateVector s2); // add this to another statevector
-                StateVector mult(float k); // multiply this by a scalar
+                Vec3T<T> position(int i) const {return Vec3T<T>(x[i], y[i], z[i]);}
+                Vec3T<T> velocity(int i) const {return Vec3T<T>(vx[i], vy[i], vz[i]);}
+                void setPosition(int i, const Vec3T<T>& p) {x[i] = p.x; y[i] = p.y; z[i] = p.z;}
+                void setVelocity(int i, const Vec3T<T>& v) {vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;}
+
+                StateVectorT add(const StateVectorT& s2) const; // add this to another statevector
+                StateVectorT mult(float k) const; // multiply this by a scalar
+
+                // in-place arithmetic, no allocation
+                void scale(double k);                                               // this = k * this
+                void addScaled(const StateVectorT& s2, double k);                    // this = this + k * s2
+                void setSum(const StateVectorT& s1, const StateVectorT& s2, double k); // this = s1 + k * s2
 
                 void print();
-                int getNumParticles(){return numParticles;}
-                int getLength(){return length;}
+                int getNumParticles() const {return numParticles;}
+                int getLength() const {return length;}
+                T* getData() {return data;}
+                const T* getData() const {return data;}
 
 };	
 
+// the state vector the simulation runs in
+typedef StateVectorT<Real> StateVector;
+
 #endif
 
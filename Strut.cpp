@@ -1,5 +1,5 @@
 /*
-* Particle.cpp
+* Strut.cpp
 * CPSC 8170 Physically Based Animation
 * Author: Caroline Requierme (crequie@clemson.edu)
 * Date: 10/09/2018
@@ -8,85 +8,477 @@
 */
 
 #include "Strut.h"
-#include "Particle.h"
-#include "Vector.h"
-#include <math.h>
+#include "StateVector.h"
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#  include <immintrin.h>
+#endif
+
 using namespace std;
 
 //-----------------------------------------------------------------
 /*
-Strut::Strut()
-* PURPOSE : Default constructor
+StrutSet::StrutSet()
+* PURPOSE : Default constructor, an empty set
 * INPUTS :  None
 * OUTPUTS : None
 */
 //-----------------------------------------------------------------
 
-Strut::Strut()
+template<class T>
+StrutSetT<T>::StrutSetT()
+{
+   numStruts = 0;
+   capacity = 0;
+   numColors = 0;
+   colorStart = NULL;
+   i0 = i1 = NULL;
+   k = d = l_rest = NULL;
+   fx = fy = fz = NULL;
+}
+
+template<class T>
+StrutSetT<T>::~StrutSetT()
+{
+   delete[] i0;
+   delete[] i1;
+   delete[] k;
+   delete[] d;
+   delete[] l_rest;
+   delete[] fx;
+   delete[] fy;
+   delete[] fz;
+   delete[] colorStart;
+}
+
+//-----------------------------------------------------------------
+/*
+StrutSet::reserve(int n)
+* PURPOSE : Make room for n struts, keeping the ones already added
+* INPUTS :  int n, required capacity
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template <class T>
+static void growArray(T*& arr, int used, int n)
+{
+   T* grown = new T[n];
+   for (int i = 0; i < used; i++)
+      grown[i] = arr[i];
+   delete[] arr;
+   arr = grown;
+}
+
+template<class T>
+void StrutSetT<T>::reserve(int n)
+{
+   if (n <= capacity)
+      return;
+
+   growArray(i0, numStruts, n);
+   growArray(i1, numStruts, n);
+   growArray(k, numStruts, n);
+   growArray(d, numStruts, n);
+   growArray(l_rest, numStruts, n);
+   growArray(fx, numStruts, n);
+   growArray(fy, numStruts, n);
+   growArray(fz, numStruts, n);
+   capacity = n;
+}
+
+template<class T>
+void StrutSetT<T>::clear()
+{
+   numStruts = 0;
+   numColors = 0;
+}
+
+//-----------------------------------------------------------------
+/*
+StrutSet::add(int p1, int p2, double k_const, double d_const, double lrest)
+* PURPOSE : Append a strut connecting particles p1 and p2
+* INPUTS :  int p1, p2, end particle indices
+            double k_const, d_const, spring and damping constants
+            double lrest, rest length
+* OUTPUTS : int, index of the new strut
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+int StrutSetT<T>::add(int p1, int p2, double k_const, double d_const, double lrest)
 {
-   k = 0;
-   d = 0;
-   l_rest = 0;
-   v_indices[0] = -1; // negative one indicates empty space
-   v_indices[1] = -1;
+   if (numStruts == capacity)
+      reserve(capacity > 0 ? 2 * capacity : 64);
+
+   i0[numStruts] = p1;
+   i1[numStruts] = p2;
+   k[numStruts] = k_const;
+   d[numStruts] = d_const;
+   l_rest[numStruts] = lrest;
+   fx[numStruts] = fy[numStruts] = fz[numStruts] = 0.0;
+   return numStruts++;
 }
 
-Strut::Strut(float k_const, float d_const, float l)
+//-----------------------------------------------------------------
+/*
+StrutSet::colorBatches(int np)
+* PURPOSE : Greedy edge coloring of the strut graph. Each strut takes the
+            lowest color not yet used at either of its end particles, so
+            at most 2 * maxdegree - 1 colors are needed. The struts are
+            then reordered so each color is one contiguous batch.
+* INPUTS :  int np, number of particles in the system
+* OUTPUTS : None, permutes the strut arrays and fills colorStart
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StrutSetT<T>::colorBatches(int np)
 {
-   k = k_const;
-   d = d_const;
-   l_rest = l;
+   vector<int> degree(np, 0);
+   int maxDegree = 0;
+   for (int s = 0; s < numStruts; s++)
+   {
+      if (++degree[i0[s]] > maxDegree) maxDegree = degree[i0[s]];
+      if (++degree[i1[s]] > maxDegree) maxDegree = degree[i1[s]];
+   }
+   int words = (2 * maxDegree - 1) / 64 + 1;
+
+   // colors already taken at each particle, one bit per color
+   vector<unsigned long long> used((size_t)np * words, 0);
+   vector<int> color(numStruts);
+   numColors = 0;
+   for (int s = 0; s < numStruts; s++)
+   {
+      unsigned long long* ui = &used[(size_t)i0[s] * words];
+      unsigned long long* uj = &used[(size_t)i1[s] * words];
+      int c = 0;
+      for (int w = 0; w < words; w++)
+      {
+         unsigned long long freeBits = ~(ui[w] | uj[w]);
+         if (freeBits != 0){
+            c = 64 * w + __builtin_ctzll(freeBits);
+            break;
+         }
+      }
+      ui[c / 64] |= 1ULL << (c % 64);
+      uj[c / 64] |= 1ULL << (c % 64);
+      color[s] = c;
+      if (c + 1 > numColors) numColors = c + 1;
+   }
+
+   // counting sort of the struts by color
+   delete[] colorStart;
+   colorStart = new int[numColors + 1];
+   for (int c = 0; c <= numColors; c++)
+      colorStart[c] = 0;
+   for (int s = 0; s < numStruts; s++)
+      colorStart[color[s] + 1]++;
+   for (int c = 0; c < numColors; c++)
+      colorStart[c + 1] += colorStart[c];
 
-   v_indices[0] = -1;
-   v_indices[1] = -1;
+   vector<int> order(numStruts);
+   vector<int> fill(colorStart, colorStart + numColors);
+   for (int s = 0; s < numStruts; s++)
+      order[fill[color[s]]++] = s;
+
+   int* ni0 = new int[capacity];
+   int* ni1 = new int[capacity];
+   T* nk = new T[capacity];
+   T* nd = new T[capacity];
+   T* nl = new T[capacity];
+   for (int s = 0; s < numStruts; s++)
+   {
+      ni0[s] = i0[order[s]];
+      ni1[s] = i1[order[s]];
+      nk[s] = k[order[s]];
+      nd[s] = d[order[s]];
+      nl[s] = l_rest[order[s]];
+   }
+   delete[] i0; i0 = ni0;
+   delete[] i1; i1 = ni1;
+   delete[] k; k = nk;
+   delete[] d; d = nd;
+   delete[] l_rest; l_rest = nl;
 }
 
+//-----------------------------------------------------------------
+/*
+StrutSet::computeForcesSIMD(const StateVector& state, int begin, int end)
+* PURPOSE : Vector part of computeForces for double struts. Eight (AVX-512)
+            or four (AVX2) struts are handled per instruction.
+* INPUTS :  const StateVector& state, positions and velocities to evaluate
+            int begin, end, range of struts
+* OUTPUTS : int, first strut not handled, begin for builds without
+            vector extensions
+*/
+//-----------------------------------------------------------------
 
-void Strut::connectVerts(int p1_i, int p2_i)
+template<>
+int StrutSetT<double>::computeForcesSIMD(const StateVectorT<double>& state, int begin, int end)
 {
-   v_indices[0] = p1_i;
-   v_indices[1] = p2_i;
+#if defined(__AVX512F__) || defined(__AVX2__)
+   const double* X = state.x;
+   const double* Y = state.y;
+   const double* Z = state.z;
+   const double* VX = state.vx;
+   const double* VY = state.vy;
+   const double* VZ = state.vz;
+#endif
+   int s = begin;
+
+#if defined(__AVX512F__)
+   const __m512d one = _mm512_set1_pd(1.0);
+   for (; s + 8 <= end; s += 8)
+   {
+      __m256i vi = _mm256_loadu_si256((const __m256i*)(i0 + s));
+      __m256i vj = _mm256_loadu_si256((const __m256i*)(i1 + s));
+
+      __m512d dx = _mm512_sub_pd(_mm512_i32gather_pd(vj, X, 8), _mm512_i32gather_pd(vi, X, 8));
+      __m512d dy = _mm512_sub_pd(_mm512_i32gather_pd(vj, Y, 8), _mm512_i32gather_pd(vi, Y, 8));
+      __m512d dz = _mm512_sub_pd(_mm512_i32gather_pd(vj, Z, 8), _mm512_i32gather_pd(vi, Z, 8));
+      __m512d l = _mm512_sqrt_pd(dx * dx + dy * dy + dz * dz);
+      __m512d inv = _mm512_div_pd(one, l);
+      __m512d ux = dx * inv;
+      __m512d uy = dy * inv;
+      __m512d uz = dz * inv;
+
+      __m512d dvx = _mm512_sub_pd(_mm512_i32gather_pd(vj, VX, 8), _mm512_i32gather_pd(vi, VX, 8));
+      __m512d dvy = _mm512_sub_pd(_mm512_i32gather_pd(vj, VY, 8), _mm512_i32gather_pd(vi, VY, 8));
+      __m512d dvz = _mm512_sub_pd(_mm512_i32gather_pd(vj, VZ, 8), _mm512_i32gather_pd(vi, VZ, 8));
+      __m512d dot = dvx * ux + dvy * uy + dvz * uz;
+
+      __m512d mag = _mm512_loadu_pd(k + s) * (l - _mm512_loadu_pd(l_rest + s)) + _mm512_loadu_pd(d + s) * dot;
+      _mm512_storeu_pd(fx + s, mag * ux);
+      _mm512_storeu_pd(fy + s, mag * uy);
+      _mm512_storeu_pd(fz + s, mag * uz);
+   }
+#elif defined(__AVX2__)
+   const __m256d one = _mm256_set1_pd(1.0);
+   for (; s + 4 <= end; s += 4)
+   {
+      __m128i vi = _mm_loadu_si128((const __m128i*)(i0 + s));
+      __m128i vj = _mm_loadu_si128((const __m128i*)(i1 + s));
+
+      __m256d dx = _mm256_sub_pd(_mm256_i32gather_pd(X, vj, 8), _mm256_i32gather_pd(X, vi, 8));
+      __m256d dy = _mm256_sub_pd(_mm256_i32gather_pd(Y, vj, 8), _mm256_i32gather_pd(Y, vi, 8));
+      __m256d dz = _mm256_sub_pd(_mm256_i32gather_pd(Z, vj, 8), _mm256_i32gather_pd(Z, vi, 8));
+      __m256d l = _mm256_sqrt_pd(dx * dx + dy * dy + dz * dz);
+      __m256d inv = _mm256_div_pd(one, l);
+      __m256d ux = dx * inv;
+      __m256d uy = dy * inv;
+      __m256d uz = dz * inv;
+
+      __m256d dvx = _mm256_sub_pd(_mm256_i32gather_pd(VX, vj, 8), _mm256_i32gather_pd(VX, vi, 8));
+      __m256d dvy = _mm256_sub_pd(_mm256_i32gather_pd(VY, vj, 8), _mm256_i32gather_pd(VY, vi, 8));
+      __m256d dvz = _mm256_sub_pd(_mm256_i32gather_pd(VZ, vj, 8), _mm256_i32gather_pd(VZ, vi, 8));
+      __m256d dot = dvx * ux + dvy * uy + dvz * uz;
+
+      __m256d mag = _mm256_loadu_pd(k + s) * (l - _mm256_loadu_pd(l_rest + s)) + _mm256_loadu_pd(d + s) * dot;
+      _mm256_storeu_pd(fx + s, mag * ux);
+      _mm256_storeu_pd(fy + s, mag * uy);
+      _mm256_storeu_pd(fz + s, mag * uz);
+   }
+#else
+   (void)state;
+   (void)end;
+#endif
+   return s;
 }
 
-void Strut::computeVertForces(Particle* particles)
+//-----------------------------------------------------------------
+/*
+StrutSet::computeForcesSIMD(const StateVector& state, int begin, int end)
+* PURPOSE : Vector part of computeForces for float struts. Sixteen
+            (AVX-512) or eight (AVX2) struts are handled per instruction.
+* INPUTS :  const StateVector& state, positions and velocities to evaluate
+            int begin, end, range of struts
+* OUTPUTS : int, first strut not handled, begin for builds without
+            vector extensions
+*/
+//-----------------------------------------------------------------
+
+template<>
+int StrutSetT<float>::computeForcesSIMD(const StateVectorT<float>& state, int begin, int end)
 {
-   int i_index = v_indices[0];
-   int j_index = v_indices[1];
+#if defined(__AVX512F__) || defined(__AVX2__)
+   const float* X = state.x;
+   const float* Y = state.y;
+   const float* Z = state.z;
+   const float* VX = state.vx;
+   const float* VY = state.vy;
+   const float* VZ = state.vz;
+#endif
+   int s = begin;
+
+#if defined(__AVX512F__)
+   const __m512 one = _mm512_set1_ps(1.0f);
+   for (; s + 16 <= end; s += 16)
+   {
+      __m512i vi = _mm512_loadu_si512((const void*)(i0 + s));
+      __m512i vj = _mm512_loadu_si512((const void*)(i1 + s));
 
-   Particle i = particles[i_index];
-   Particle j = particles[j_index];
+      __m512 dx = _mm512_sub_ps(_mm512_i32gather_ps(vj, X, 4), _mm512_i32gather_ps(vi, X, 4));
+      __m512 dy = _mm512_sub_ps(_mm512_i32gather_ps(vj, Y, 4), _mm512_i32gather_ps(vi, Y, 4));
+      __m512 dz = _mm512_sub_ps(_mm512_i32gather_ps(vj, Z, 4), _mm512_i32gather_ps(vi, Z, 4));
+      __m512 l = _mm512_sqrt_ps(dx * dx + dy * dy + dz * dz);
+      __m512 inv = _mm512_div_ps(one, l);
+      __m512 ux = dx * inv;
+      __m512 uy = dy * inv;
+      __m512 uz = dz * inv;
 
-   Vector3d x_ij = {(j.position.x - i.position.x), (j.position.y - i.position.y), (j.position.z - i.position.z)};
-   float l_ij = sqrt(pow(x_ij.x, 2) + pow(x_ij.y, 2) + pow(x_ij.z, 2));
-   Vector3d u_ij = {(x_ij.x/l_ij), (x_ij.y/ l_ij), (x_ij.z/l_ij)};
-   float delta_length = l_ij - l_rest;
-   
-   Vector3d Fs_ij = {(k * delta_length * u_ij.x), (k * delta_length * u_ij.y), (k * delta_length * u_ij.z)};
-   Vector3d Fs_ji = {-Fs_ij.x, -Fs_ij.y, -Fs_ij.z};
+      __m512 dvx = _mm512_sub_ps(_mm512_i32gather_ps(vj, VX, 4), _mm512_i32gather_ps(vi, VX, 4));
+      __m512 dvy = _mm512_sub_ps(_mm512_i32gather_ps(vj, VY, 4), _mm512_i32gather_ps(vi, VY, 4));
+      __m512 dvz = _mm512_sub_ps(_mm512_i32gather_ps(vj, VZ, 4), _mm512_i32gather_ps(vi, VZ, 4));
+      __m512 dot = dvx * ux + dvy * uy + dvz * uz;
 
-   Vector3d delta_velocity = {(j.velocity.x - i.velocity.x), (j.velocity.y - i.velocity.y), (j.velocity.z - i.velocity.z)};
-   float dot = delta_velocity * u_ij;
+      __m512 mag = _mm512_loadu_ps(k + s) * (l - _mm512_loadu_ps(l_rest + s)) + _mm512_loadu_ps(d + s) * dot;
+      _mm512_storeu_ps(fx + s, mag * ux);
+      _mm512_storeu_ps(fy + s, mag * uy);
+      _mm512_storeu_ps(fz + s, mag * uz);
+   }
+#elif defined(__AVX2__)
+   const __m256 one = _mm256_set1_ps(1.0f);
+   for (; s + 8 <= end; s += 8)
+   {
+      __m256i vi = _mm256_loadu_si256((const __m256i*)(i0 + s));
+      __m256i vj = _mm256_loadu_si256((const __m256i*)(i1 + s));
 
-   Vector3d Fd_ij = {(d * dot * u_ij.x), (d * dot * u_ij.y), (d * dot * u_ij.z)};
-   Vector3d Fd_ji = {-Fd_ij.x, -Fd_ij.y, -Fd_ij.z};
+      __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(X, vj, 4), _mm256_i32gather_ps(X, vi, 4));
+      __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(Y, vj, 4), _mm256_i32gather_ps(Y, vi, 4));
+      __m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(Z, vj, 4), _mm256_i32gather_ps(Z, vi, 4));
+      __m256 l = _mm256_sqrt_ps(dx * dx + dy * dy + dz * dz);
+      __m256 inv = _mm256_div_ps(one, l);
+      __m256 ux = dx * inv;
+      __m256 uy = dy * inv;
+      __m256 uz = dz * inv;
 
-   Vector3d Fi = {(Fs_ij.x + Fd_ij.x), (Fs_ij.y + Fd_ij.y), (Fs_ij.z + Fd_ij.z)};
-   Vector3d Fj = {(Fs_ji.x + Fd_ji.x), (Fs_ji.y + Fd_ji.y), (Fs_ji.z + Fd_ji.z)};
+      __m256 dvx = _mm256_sub_ps(_mm256_i32gather_ps(VX, vj, 4), _mm256_i32gather_ps(VX, vi, 4));
+      __m256 dvy = _mm256_sub_ps(_mm256_i32gather_ps(VY, vj, 4), _mm256_i32gather_ps(VY, vi, 4));
+      __m256 dvz = _mm256_sub_ps(_mm256_i32gather_ps(VZ, vj, 4), _mm256_i32gather_ps(VZ, vi, 4));
+      __m256 dot = dvx * ux + dvy * uy + dvz * uz;
 
-   if (particles[i_index].isPinned == true){
-      Fi.set(0.0, 0.0, 0.0);
+      __m256 mag = _mm256_loadu_ps(k + s) * (l - _mm256_loadu_ps(l_rest + s)) + _mm256_loadu_ps(d + s) * dot;
+      _mm256_storeu_ps(fx + s, mag * ux);
+      _mm256_storeu_ps(fy + s, mag * uy);
+      _mm256_storeu_ps(fz + s, mag * uz);
    }
+#else
+   (void)state;
+   (void)end;
+#endif
+   return s;
+}
+
+//-----------------------------------------------------------------
+/*
+StrutSet::computeForces(const StateVector& state, int begin, int end)
+* PURPOSE : Evaluate the spring and damper force of struts [begin, end) for
+            the given state. As many struts as the vector extensions allow
+            are handled per instruction, with a scalar loop for the
+            remainder and for builds without vector extensions.
+* INPUTS :  const StateVector& state, positions and velocities to evaluate
+            int begin, end, range of struts
+* OUTPUTS : None, fills fx, fy, fz with the force on each strut's i0 end
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StrutSetT<T>::computeForces(const StateVectorT<T>& state, int begin, int end)
+{
+   const T* X = state.x;
+   const T* Y = state.y;
+   const T* Z = state.z;
+   const T* VX = state.vx;
+   const T* VY = state.vy;
+   const T* VZ = state.vz;
+   int s = computeForcesSIMD(state, begin, end);
+
+   // scalar fallback and remainder
+   for (; s < end; s++)
+   {
+      int i = i0[s];
+      int j = i1[s];
+
+      T dx = X[j] - X[i];
+      T dy = Y[j] - Y[i];
+      T dz = Z[j] - Z[i];
+      T l = sqrt(dx * dx + dy * dy + dz * dz);
+      T inv = 1 / l;
+      T ux = dx * inv;
+      T uy = dy * inv;
+      T uz = dz * inv;
+
+      T dot = (VX[j] - VX[i]) * ux + (VY[j] - VY[i]) * uy + (VZ[j] - VZ[i]) * uz;
+      T mag = k[s] * (l - l_rest[s]) + d[s] * dot;   // spring + damper along u_ij
 
-   if (particles[j_index].isPinned == true){
-      Fj.set(0.0, 0.0, 0.0);
+      fx[s] = mag * ux;
+      fy[s] = mag * uy;
+      fz[s] = mag * uz;
    }
+}
 
-   particles[i_index].addForce(Fi);
-   particles[j_index].addForce(Fj);
+//-----------------------------------------------------------------
+/*
+StrutSet::scatterForces(ParticleStore& particles, int begin, int end)
+* PURPOSE : Add the forces of struts [begin, end) to their end particles.
+            Safe to run concurrently on disjoint ranges of one color batch.
+            Forces on pinned particles are discarded by their zero inverse
+            mass.
+* INPUTS :  ParticleStore& particles, holds the force accumulators
+            int begin, end, range of struts
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
 
+template<class T>
+void StrutSetT<T>::scatterForces(ParticleStoreT<T>& particles, int begin, int end) const
+{
+   typedef typename ParticleStoreT<T>::Force Force;
+   Force* pfx = particles.fx;
+   Force* pfy = particles.fy;
+   Force* pfz = particles.fz;
+   for (int s = begin; s < end; s++)
+   {
+      int i = i0[s];
+      int j = i1[s];
+      pfx[i] += fx[s];
+      pfy[i] += fy[s];
+      pfz[i] += fz[s];
+      pfx[j] -= fx[s];
+      pfy[j] -= fy[s];
+      pfz[j] -= fz[s];
+   }
 }
 
-void Strut::setLRest(float lrest)
+//-----------------------------------------------------------------
+/*
+StrutSet::applyForces(const StateVector& state, ParticleStore& particles, ThreadPool& pool)
+* PURPOSE : Add every strut force for the given state to the particles.
+            Color batches run one after another; the struts within a batch
+            are split across the pool's threads.
+* INPUTS :  const StateVector& state, positions and velocities to evaluate
+            ParticleStore& particles, holds the force accumulators
+            ThreadPool& pool, threads to use
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+template<class T>
+void StrutSetT<T>::applyForces(const StateVectorT<T>& state, ParticleStoreT<T>& particles, ThreadPool& pool)
 {
-   l_rest = lrest;
+   for (int c = 0; c < numColors; c++)
+   {
+      pool.parallelFor(colorStart[c], colorStart[c + 1], [&](int b, int e){
+         computeForces(state, b, e);
+         scatterForces(particles, b, e);
+      }, 256);
+   }
 }
+
+template class StrutSetT<float>;
+template class StrutSetT<double>;
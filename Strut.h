@@ -9,22 +9,62 @@
 #ifndef __STRUT_H__
 #define __STRUT_H__
 
-#include "Vector.h"
-#include "Particle.h"
+#include "StateVector.h"
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include "Precision.h"
+
+// All struts of the system packed as structure of arrays, so spring forces
+// can be evaluated several struts at a time with SIMD. Struts are grouped by
+// graph coloring into batches in which no two struts share a particle; each
+// batch is a contiguous index range whose forces can be scattered to the
+// particles from many threads at once without atomics or locks. Compiled
+// for float and double; a float set runs twice as many struts per SIMD
+// instruction.
+template<class T>
+class StrutSetT{
+	private:
+            int numStruts;
+            int capacity;
+
+            int numColors;
+            int* colorStart;		// batch c is struts [colorStart[c], colorStart[c + 1])
+
+            // vector part of computeForces, returns the first strut left over
+            int computeForcesSIMD(const StateVectorT<T>& state, int begin, int end);
+
+            friend class Checkpoint;	// saves and restores the private state
 
-class Strut{				// Particle attributes are made public for benefit of the View
 	public:
-            float k;
-            float d;
-            float l_rest;
-                
-            int v_indices[2];
-            Strut();					// Default constructor
-            Strut(float k_const, float d_const, float l);
-            
-            void connectVerts(int p1_i, int p2_i);
-            void computeVertForces(Particle* particles);
-            void setLRest(float lrest);
+            int* i0;			// end particle indices
+            int* i1;
+            T* k;			// spring constant
+            T* d;			// damping constant
+            T* l_rest;			// rest length
+
+            T* fx;			// per strut force on i0, i1 receives the negation
+            T* fy;
+            T* fz;
+
+            StrutSetT();
+            ~StrutSetT();
+
+            void reserve(int n);
+            void clear();
+            int add(int p1, int p2, double k_const, double d_const, double lrest);
+            void colorBatches(int np);				// reorder struts into conflict free batches
+
+            void computeForces(const StateVectorT<T>& state, int begin, int end);		// fills fx, fy, fz
+            void scatterForces(ParticleStoreT<T>& particles, int begin, int end) const;	// adds them to the particles
+            void applyForces(const StateVectorT<T>& state, ParticleStoreT<T>& particles, ThreadPool& pool);
+
+            int getNumStruts() const {return numStruts;}
+            int getNumColors() const {return numColors;}
+            int colorBegin(int c) const {return colorStart[c];}
+            int colorEnd(int c) const {return colorStart[c + 1];}
 };
 
+// the strut set the simulation runs in
+typedef StrutSetT<Real> StrutSet;
+
 #endif
@@ -0,0 +1,178 @@
+/*
+* ThreadPool.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* The calling thread always takes a share of the work, so a pool of
+* one thread runs every loop inline with no synchronization at all.
+*/
+
+#include "ThreadPool.h"
+#include <cstdlib>
+
+using namespace std;
+
+//-----------------------------------------------------------------
+/*
+ThreadPool::ThreadPool(int nthreads)
+* PURPOSE : Start nthreads - 1 workers; the caller is the last thread
+* INPUTS :  int nthreads, total threads, 0 for one per hardware core
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+ThreadPool::ThreadPool(int nthreads)
+{
+   job = NULL;
+   jobContext = NULL;
+   jobBegin = jobEnd = jobChunks = 0;
+   nextChunk = 0;
+   pending = 0;
+   generation = 0;
+   stopping = false;
+   resize(nthreads);
+}
+
+ThreadPool::~ThreadPool()
+{
+   stop();
+}
+
+void ThreadPool::stop()
+{
+   {
+      unique_lock<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+   workers.clear();
+   stopping = false;
+}
+
+//-----------------------------------------------------------------
+/*
+ThreadPool::resize(int nthreads)
+* PURPOSE : Change the number of threads, must not be called while a
+            parallelFor is running
+* INPUTS :  int nthreads, total threads, 0 for one per hardware core
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void ThreadPool::resize(int nthreads)
+{
+   if (nthreads <= 0)
+      nthreads = (int)thread::hardware_concurrency();
+   if (nthreads <= 0)
+      nthreads = 1;
+
+   stop();
+   for (int i = 1; i < nthreads; i++)
+      workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+void ThreadPool::runChunk(int c)
+{
+   int n = jobEnd - jobBegin;
+   int b = jobBegin + (int)((long long)n * c / jobChunks);
+   int e = jobBegin + (int)((long long)n * (c + 1) / jobChunks);
+   if (b < e)
+      job(jobContext, b, e);
+}
+
+void ThreadPool::workerLoop()
+{
+   unsigned long seen = 0;
+   unique_lock<mutex> guard(lock);
+   for (;;)
+   {
+      wake.wait(guard, [&]{return stopping || generation != seen;});
+      if (stopping)
+         return;
+      seen = generation;
+
+      while (nextChunk < jobChunks)
+      {
+         int c = nextChunk++;
+         guard.unlock();
+         runChunk(c);
+         guard.lock();
+         if (--pending == 0)
+            done.notify_one();
+      }
+   }
+}
+
+//-----------------------------------------------------------------
+/*
+ThreadPool::run(int begin, int end, void (*fn)(const void*, int, int), const void* context, int grain)
+* PURPOSE : Split [begin, end) into one contiguous chunk per thread and run
+            fn on each, returning once all chunks are done. The body of
+            parallelFor, which passes its callable as context.
+* INPUTS :  int begin, end, index range
+            fn, called as fn(context, chunk_begin, chunk_end)
+            const void* context, the caller's callable
+            int grain, minimum items per thread worth waking workers for
+* OUTPUTS : None
+*/
+//-----------------------------------------------------------------
+
+void ThreadPool::run(int begin, int end, void (*fn)(const void*, int, int), const void* context, int grain)
+{
+   int n = end - begin;
+   if (n <= 0)
+      return;
+
+   int chunks = getNumThreads();
+   if (grain < 1)
+      grain = 1;
+   if (n / grain < chunks)
+      chunks = n / grain;
+   if (chunks <= 1)
+   {
+      fn(context, begin, end);
+      return;
+   }
+
+   unique_lock<mutex> guard(lock);
+   job = fn;
+   jobContext = context;
+   jobBegin = begin;
+   jobEnd = end;
+   jobChunks = chunks;
+   nextChunk = 0;
+   pending = chunks;
+   generation++;
+   wake.notify_all();
+
+   // the caller works through chunks alongside the workers
+   while (nextChunk < jobChunks)
+   {
+      int c = nextChunk++;
+      guard.unlock();
+      runChunk(c);
+      guard.lock();
+      pending--;
+   }
+   done.wait(guard, [&]{return pending == 0;});
+   job = NULL;
+   jobContext = NULL;
+}
+
+//-----------------------------------------------------------------
+/*
+ThreadPool& ThreadPool::shared()
+* PURPOSE : Process wide pool. Its size can be set with the
+            LATTICE_THREADS environment variable, default one per core.
+* INPUTS :  None
+* OUTPUTS : ThreadPool&, the shared pool
+*/
+//-----------------------------------------------------------------
+
+ThreadPool& ThreadPool::shared()
+{
+   static ThreadPool pool(getenv("LATTICE_THREADS") ? atoi(getenv("LATTICE_THREADS")) : 0);
+   return pool;
+}
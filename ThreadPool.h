@@ -0,0 +1,61 @@
+/*
+* ThreadPool.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Fixed set of worker threads used to split loops over particles,
+* struts and mesh vertices across cores. parallelFor blocks until
+* every chunk has finished, so successive calls act as barriers.
+* The loop body is passed through as a plain function pointer and a
+* pointer to the caller's callable, never wrapped in std::function,
+* so a parallel loop allocates nothing.
+*/
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool{
+	private:
+		std::vector<std::thread> workers;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		// current job, valid while pending > 0: job(jobContext, b, e)
+		void (*job)(const void*, int, int);
+		const void* jobContext;
+		int jobBegin, jobEnd, jobChunks;
+		int nextChunk;
+		int pending;
+		unsigned long generation;
+		bool stopping;
+
+		void workerLoop();
+		void runChunk(int c);
+		void stop();
+		void run(int begin, int end, void (*fn)(const void*, int, int), const void* context, int grain);
+
+		template<class Fn>
+		static void invoke(const void* context, int b, int e) {(*(const Fn*)context)(b, e);}
+
+	public:
+		ThreadPool(int nthreads = 0);	// 0 uses one thread per hardware core
+		~ThreadPool();
+
+		void resize(int nthreads);
+		int getNumThreads() const {return (int)workers.size() + 1;}	// workers plus the caller
+
+		// Call fn(b, e) over disjoint subranges covering [begin, end). Ranges
+		// shorter than grain items per thread run on the calling thread alone.
+		template<class Fn>
+		void parallelFor(int begin, int end, const Fn& fn, int grain = 1) {run(begin, end, &invoke<Fn>, &fn, grain);}
+
+		static ThreadPool& shared();	// process wide pool used by the simulation and viewer
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*
+* Vec3.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Small vectors for the simulation and deformation code, defined
+* entirely in this header so every operation inlines into the loop
+* using it, across translation units. Vec3T holds three packed
+* scalars. The Vector classes of Vector.h remain for the camera and
+* viewer.
+*/
+
+#ifndef __VEC3_H__
+#define __VEC3_H__
+
+#include "Precision.h"
+
+#include <cmath>
+
+template<class T>
+struct Vec3T{
+   T x, y, z;
+
+   constexpr Vec3T() : x(0), y(0), z(0) {}
+   constexpr Vec3T(T vx, T vy, T vz) : x(vx), y(vy), z(vz) {}
+   template<class U>
+   explicit constexpr Vec3T(const Vec3T<U>& v) : x((T)v.x), y((T)v.y), z((T)v.z) {}
+
+   T& operator[](int i) {return (&x)[i];}
+   const T& operator[](int i) const {return (&x)[i];}
+
+   Vec3T& operator+=(const Vec3T& v) {x += v.x; y += v.y; z += v.z; return *this;}
+   Vec3T& operator-=(const Vec3T& v) {x -= v.x; y -= v.y; z -= v.z; return *this;}
+   Vec3T& operator*=(T s) {x *= s; y *= s; z *= s; return *this;}
+
+   friend constexpr Vec3T operator-(const Vec3T& v) {return Vec3T(-v.x, -v.y, -v.z);}
+   friend constexpr Vec3T operator+(const Vec3T& a, const Vec3T& b) {return Vec3T(a.x + b.x, a.y + b.y, a.z + b.z);}
+   friend constexpr Vec3T operator-(const Vec3T& a, const Vec3T& b) {return Vec3T(a.x - b.x, a.y - b.y, a.z - b.z);}
+   friend constexpr Vec3T operator*(const Vec3T& v, T s) {return Vec3T(v.x * s, v.y * s, v.z * s);}
+   friend constexpr Vec3T operator*(T s, const Vec3T& v) {return Vec3T(s * v.x, s * v.y, s * v.z);}
+   friend constexpr Vec3T operator/(const Vec3T& v, T s) {return Vec3T(v.x / s, v.y / s, v.z / s);}
+   friend constexpr bool operator==(const Vec3T& a, const Vec3T& b) {return a.x == b.x && a.y == b.y && a.z == b.z;}
+
+   friend constexpr T dot(const Vec3T& a, const Vec3T& b) {return a.x * b.x + a.y * b.y + a.z * b.z;}
+   friend constexpr Vec3T cross(const Vec3T& a, const Vec3T& b)
+      {return Vec3T(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);}
+   friend constexpr Vec3T cwiseMul(const Vec3T& a, const Vec3T& b) {return Vec3T(a.x * b.x, a.y * b.y, a.z * b.z);}
+   friend constexpr Vec3T cwiseMin(const Vec3T& a, const Vec3T& b)
+      {return Vec3T(b.x < a.x ? b.x : a.x, b.y < a.y ? b.y : a.y, b.z < a.z ? b.z : a.z);}
+   friend constexpr Vec3T cwiseMax(const Vec3T& a, const Vec3T& b)
+      {return Vec3T(b.x > a.x ? b.x : a.x, b.y > a.y ? b.y : a.y, b.z > a.z ? b.z : a.z);}
+
+   friend T norm(const Vec3T& v) {return std::sqrt(dot(v, v));}
+   friend Vec3T normalize(const Vec3T& v) {T n = norm(v); return (n > 0) ? v / n : v;}
+};
+
+typedef Vec3T<float> Vec3f;
+typedef Vec3T<double> Vec3d;
+typedef Vec3T<Real> Vec3;		// in the simulation's precision
+
+#endif
@@ -51,17 +51,23 @@ Vector::Vector(const Vector& V){
 
 Vector::Vector(double vx, double vy){
   setsize(2);
-  set(vx, vy);
+  v[0] = vx;
+  v[1] = vy;
 }
 
 Vector::Vector(double vx, double vy, double vz){
   setsize(3);
-  set(vx, vy, vz);
+  v[0] = vx;
+  v[1] = vy;
+  v[2] = vz;
 }
 
 Vector::Vector(double vx, double vy, double vz, double vw){
   setsize(4);
-  set(vx, vy, vz, vw);
+  v[0] = vx;
+  v[1] = vy;
+  v[2] = vz;
+  v[3] = vw;
 }
 
 // Destructor
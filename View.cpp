@@ -14,9 +14,12 @@
 #  pragma clang diagnostic ignored "-Wdeprecated-declarations"
 #  include <GLUT/glut.h>
 #else
+#  define GL_GLEXT_PROTOTYPES   // buffer object entry points
 #  include <GL/glut.h>
+#  include <GL/glext.h>
 #endif
 
+#include <vector>
 #include <cstdlib>
 #include <iostream>
 
@@ -78,51 +81,114 @@ View::View(Model *model):
   Width = width;
   Height = height;
 
-  // load in obj model
-  objloader = ObjLoader();
-  objloader.LoadObj("skeleton.obj");
-  obj = objloader.ReturnObj();
-
-  // compute bounding box of the obj
-  float minX, maxX, minY, maxY, minZ, maxZ;
-  minX = obj.VertexArray[0].X;
-  minY = obj.VertexArray[0].Y;
-  minZ = obj.VertexArray[0].Z;
-  maxX = minX;
-  maxY = minY;
-  maxZ = minZ;
-  for (int i = 1; i < obj.NumVertex; i ++)
-  {
-      if (obj.VertexArray[i].X < minX){minX = obj.VertexArray[i].X;}
-      if (obj.VertexArray[i].Y < minY){minY = obj.VertexArray[i].Y;}
-      if (obj.VertexArray[i].Z < minZ){minZ = obj.VertexArray[i].Z;}
-      if (obj.VertexArray[i].X > maxX){maxX = obj.VertexArray[i].X;}
-      if (obj.VertexArray[i].Y > maxY){maxY = obj.VertexArray[i].Y;}
-      if (obj.VertexArray[i].Z > maxZ){maxZ = obj.VertexArray[i].Z;}
-  }
+  ShowLattice = false;
+
+  numDrawVertices = numDrawIndices = 0;
+  drawPositions = drawNormals = NULL;
+  latticePositions = NULL;
+  for(int i = 0; i < 3; i++)
+    meshBuffers[i] = 0;
+  latticeBuffers[0] = latticeBuffers[1] = 0;
+  buffersReady = false;
+
+  playing = playPaused = false;
+  playFrame = playClockFrame = 0;
+  playFrameTime = 0;
+}
 
-  float thresh = 0.02;
+//
+// Load the obj mesh to be deformed, build the model's lattice around it and
+// bind every mesh vertex to the lattice cell that contains it. When playing
+// back a lattice cache the lattice is the one the cache was recorded with,
+// which must enclose the mesh.
+//
+void View::loadModel(const char *filename){
+  if(!mesh.load(filename))
+    exit(1);
+  if(!playing){
+    mesh.fitLattice(themodel);
+    buildDrawArrays();
+    return;
+  }
 
-  themodel->setBoundingBox(minX - thresh, minY - thresh, minZ - thresh, maxX + thresh, maxY + thresh, maxZ + thresh);
+  const float *b = playback.getBounds();
+  Vec3f lo, hi;
+  mesh.getBounds(lo, hi);
+  if(lo.x < b[0] || lo.y < b[1] || lo.z < b[2] || hi.x > b[3] || hi.y > b[4] || hi.z > b[5]){
+    std::cerr << "Lattice cache was not recorded for " << filename << ", the mesh lies outside its lattice" << std::endl;
+    exit(1);
+  }
+  themodel->setBoundingBox(b[0], b[1], b[2], b[3], b[4], b[5]);
   themodel->constructLattice();
-  Lattice* L = themodel->getLPointer();
-  Particle* P = themodel->getParticles();
-
-  meshVertices = new MeshVertex[obj.NumVertex];
-
-  for (int j = 0; j < obj.NumVertex; j ++)
-  {
-     int index = L->searchCellIndex(obj.VertexArray[j].X, obj.VertexArray[j].Y, obj.VertexArray[j].Z);
-     meshVertices[j].cellIndex = index;
-     int p0 = L->cells[index].vertIndices[0];
-     int p1 = L->cells[index].vertIndices[1];
-     int p2 = L->cells[index].vertIndices[2];
-     int p4 = L->cells[index].vertIndices[4];
-
-     meshVertices[j].u = (obj.VertexArray[j].X - P[p0].position.x)/(P[p1].position.x - P[p0].position.x);
-     meshVertices[j].v = (obj.VertexArray[j].Y - P[p0].position.y)/(P[p2].position.y - P[p0].position.y);
-     meshVertices[j].w = (obj.VertexArray[j].Z - P[p0].position.z)/(P[p4].position.z - P[p0].position.z);
+  if(playback.getNumParticles() != themodel->getNumParticles()){
+    std::cerr << "Lattice cache does not match the lattice built for " << filename << std::endl;
+    exit(1);
+  }
+  mesh.bind(themodel);
+  buildDrawArrays();
+}
+
+//
+// Set up the draw vertices from the loader's welded (position, normal,
+// texture coordinate) corners, so the mesh is drawn with its single index
+// buffer in one indexed call
+//
+void View::buildDrawArrays(){
+  const ObjModel& obj = mesh.getObj();
+
+  delete[] drawPositions;
+  delete[] drawNormals;
+  numDrawVertices = obj.NumWelded;
+  numDrawIndices = 3 * obj.NumTriangle;
+  drawNormals = new float[3 * numDrawVertices];
+  for(int i = 0; i < numDrawVertices; i++){
+    int n = obj.WeldedArray[i].Normal;
+    drawNormals[3 * i] = (n >= 0) ? obj.NormalArray[n].X : 0;
+    drawNormals[3 * i + 1] = (n >= 0) ? obj.NormalArray[n].Y : 0;
+    drawNormals[3 * i + 2] = (n >= 0) ? obj.NormalArray[n].Z : 1;
   }
+  drawPositions = new float[3 * numDrawVertices];
+
+  delete[] latticePositions;
+  latticePositions = new float[3 * themodel->getNumParticles()];
+  buffersReady = false;
+}
+
+//
+// Create the buffer objects and upload everything that stays fixed while the
+// simulation runs. Needs a current GL context, so it is done on first draw.
+// The buffer objects are made once; a reloaded mesh or rebuilt lattice only
+// refills them.
+//
+void View::uploadBuffers(){
+  if(meshBuffers[0] == 0){
+    glGenBuffers(3, meshBuffers);
+    glGenBuffers(2, latticeBuffers);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, meshBuffers[0]);
+  glBufferData(GL_ARRAY_BUFFER, 3 * numDrawVertices * sizeof(float), NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, meshBuffers[1]);
+  glBufferData(GL_ARRAY_BUFFER, 3 * numDrawVertices * sizeof(float), drawNormals, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffers[2]);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, numDrawIndices * sizeof(unsigned int), mesh.getObj().IndexArray, GL_STATIC_DRAW);
+
+  // strut end points as line indices into the lattice positions
+  StrutSet* ST = themodel->getStruts();
+  int ns = ST->getNumStruts();
+  vector<unsigned int> lines(2 * ns);
+  for(int st = 0; st < ns; st++){
+    lines[2 * st] = ST->i0[st];
+    lines[2 * st + 1] = ST->i1[st];
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, latticeBuffers[0]);
+  glBufferData(GL_ARRAY_BUFFER, 3 * themodel->getNumParticles() * sizeof(float), NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, latticeBuffers[1]);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, lines.size() * sizeof(unsigned int), lines.empty() ? NULL : &lines[0], GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  buffersReady = true;
 }
 
 //
@@ -238,128 +304,137 @@ void View::toggleBackColor(){
 void View::toggleLattice(){
    ShowLattice = !ShowLattice;
 }
-// draw the box, and also the ball, if the simulation is running
+
+//
+// Lattice cache playback: open the cache and size the lattice to match it
+//
+bool View::openPlayback(const char *filename){
+  if(!playback.open(filename))
+    return false;
+  if(playback.getNumFrames() == 0){
+    std::cerr << "Lattice cache " << filename << " has no frames" << std::endl;
+    return false;
+  }
+  themodel->setResolution(playback.getNumPlanes(), playback.getNumRows(), playback.getNumCols());
+  playing = true;
+  playPaused = false;
+  playFrame = playClockFrame = 0;
+  playFrameTime = playback.getFrameInterval() * (double)playback.getTimeStep();
+  playClock = std::chrono::steady_clock::now();
+  return true;
+}
+
+//
+// Show the frame due by the wall clock, so the cache plays back at the speed
+// it was simulated, frameInterval time steps per frame, however fast the
+// idle callback runs. A cache without a time step shows one frame per call.
+//
+bool View::advancePlayback(){
+  if(!playing || playPaused)
+    return false;
+  int previous = playFrame;
+  if(playFrameTime > 0){
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - playClock).count();
+    playFrame = (playClockFrame + (long long)(elapsed / playFrameTime)) % playback.getNumFrames();
+  }
+  else
+    playFrame = (playFrame + 1) % playback.getNumFrames();
+  return playFrame != previous;
+}
+
+void View::stepPlayback(int frames){
+  if(!playing)
+    return;
+  playFrame += frames;
+  if(playFrame < 0) playFrame = 0;
+  if(playFrame > playback.getNumFrames() - 1) playFrame = playback.getNumFrames() - 1;
+  playClockFrame = playFrame;
+  playClock = std::chrono::steady_clock::now();
+}
+
+void View::togglePlaybackPause(){
+  playPaused = !playPaused;
+  playClockFrame = playFrame;         // resume from the frame shown
+  playClock = std::chrono::steady_clock::now();
+}
+
+// draw the deformed mesh, and also the lattice, if the simulation is running
+// or a lattice cache is being played back
 void View::drawModel(){
 
   // nothing to do if the simulation is not running
-  if(themodel->isSimRunning()){
+  if(themodel->isSimRunning() || playing){
 
+     // lattice positions come from the simulation state or the cache frame
      StateVector* S = themodel->getSPointer();
-     int np = S->getNumParticles();
+     int np = playing ? playback.getNumParticles() : S->getNumParticles();
      int ns = themodel->getNumStruts();
-     Strut* ST = themodel->getStruts();
-     Particle* P = themodel->getParticles();
-     Lattice* L = themodel->getLPointer();
-
-    
-     
-     glBegin(GL_TRIANGLES);
-        for (int t = 0; t < obj.NumTriangle; t++){
-           int v0 = obj.TriangleArray[t].Vertex[0]; 
-           int v1 = obj.TriangleArray[t].Vertex[1]; 
-           int v2 = obj.TriangleArray[t].Vertex[2];
-
-           int n0 = obj.TriangleArray[t].Normal[0];
-           int n1 = obj.TriangleArray[t].Normal[1];
-           int n2 = obj.TriangleArray[t].Normal[2];
-
-           int cell_i_v0 = meshVertices[v0].cellIndex;
-           Particle p0_v0 = P[L->cells[cell_i_v0].vertIndices[0]];
-           Particle p1_v0 = P[L->cells[cell_i_v0].vertIndices[1]];
-           Particle p2_v0 = P[L->cells[cell_i_v0].vertIndices[2]];
-           Particle p3_v0 = P[L->cells[cell_i_v0].vertIndices[3]];
-           Particle p4_v0 = P[L->cells[cell_i_v0].vertIndices[4]];
-           Particle p5_v0 = P[L->cells[cell_i_v0].vertIndices[5]];
-           Particle p6_v0 = P[L->cells[cell_i_v0].vertIndices[6]];
-           Particle p7_v0 = P[L->cells[cell_i_v0].vertIndices[7]];
-           float u_v0 = meshVertices[v0].u;
-           float v_v0 = meshVertices[v0].v;
-           float w_v0 = meshVertices[v0].w;
-
-           Vector3d v0prime;
-           v0prime.set(((1 - u_v0) * (1 - v_v0) * w_v0 * p4_v0.position) + (u_v0 * (1 - v_v0) * w_v0 * p5_v0.position)
-                        + ((1 - u_v0) * v_v0 * w_v0 * p6_v0.position) + (u_v0 * v_v0 * w_v0 * p7_v0.position)
-                        + ((1 - u_v0) * (1 - v_v0) * (1 - w_v0) * p0_v0.position) + (u_v0 * (1 - v_v0) * (1 - w_v0) * p1_v0.position)
-                        + ((1 - u_v0) * v_v0 * (1 - w_v0) * p2_v0.position) + (u_v0 * v_v0 * (1 - w_v0) * p3_v0.position));
-           Vector3d v0Trans;
-           v0Trans.set(v0prime.x - obj.VertexArray[v0].X, v0prime.y - obj.VertexArray[v0].Y, v0prime.z - obj.VertexArray[v0].Z);
-
-           //===========================================================================
-
-	   int cell_i_v1 = meshVertices[v1].cellIndex;
-           Particle p0_v1 = P[L->cells[cell_i_v1].vertIndices[0]];
-           Particle p1_v1 = P[L->cells[cell_i_v1].vertIndices[1]];
-           Particle p2_v1 = P[L->cells[cell_i_v1].vertIndices[2]];
-           Particle p3_v1 = P[L->cells[cell_i_v1].vertIndices[3]];
-           Particle p4_v1 = P[L->cells[cell_i_v1].vertIndices[4]];
-           Particle p5_v1 = P[L->cells[cell_i_v1].vertIndices[5]];
-           Particle p6_v1 = P[L->cells[cell_i_v1].vertIndices[6]];
-           Particle p7_v1 = P[L->cells[cell_i_v1].vertIndices[7]];
-           float u_v1 = meshVertices[v1].u;
-           float v_v1 = meshVertices[v1].v;
-           float w_v1 = meshVertices[v1].w;
-
-           Vector3d v1prime;
-           v1prime.set(((1 - u_v1) * (1 - v_v1) * w_v1 * p4_v1.position) + (u_v1 * (1 - v_v1) * w_v1 * p5_v1.position)
-                        + ((1 - u_v1) * v_v1 * w_v1 * p6_v1.position) + (u_v1 * v_v1 * w_v1 * p7_v1.position)
-                        + ((1 - u_v1) * (1 - v_v1) * (1 - w_v1) * p0_v1.position) + (u_v1 * (1 - v_v1) * (1 - w_v1) * p1_v1.position)
-                        + ((1 - u_v1) * v_v1 * (1 - w_v1) * p2_v1.position) + (u_v1 * v_v1 * (1 - w_v1) * p3_v1.position));
-           Vector3d v1Trans;
-           v1Trans.set(v1prime.x - obj.VertexArray[v1].X, v1prime.y - obj.VertexArray[v1].Y, v1prime.z - obj.VertexArray[v1].Z);
-
-           //===========================================================================
-
-	   int cell_i_v2 = meshVertices[v2].cellIndex;
-           Particle p0_v2 = P[L->cells[cell_i_v2].vertIndices[0]];
-           Particle p1_v2 = P[L->cells[cell_i_v2].vertIndices[1]];
-           Particle p2_v2 = P[L->cells[cell_i_v2].vertIndices[2]];
-           Particle p3_v2 = P[L->cells[cell_i_v2].vertIndices[3]];
-           Particle p4_v2 = P[L->cells[cell_i_v2].vertIndices[4]];
-           Particle p5_v2 = P[L->cells[cell_i_v2].vertIndices[5]];
-           Particle p6_v2 = P[L->cells[cell_i_v2].vertIndices[6]];
-           Particle p7_v2 = P[L->cells[cell_i_v2].vertIndices[7]];
-           float u_v2 = meshVertices[v2].u;
-           float v_v2 = meshVertices[v2].v;
-           float w_v2 = meshVertices[v2].w;
-
-           Vector3d v2prime;
-           v2prime.set(((1 - u_v2) * (1 - v_v2) * w_v2 * p4_v2.position) + (u_v2 * (1 - v_v2) * w_v2 * p5_v2.position)
-                        + ((1 - u_v2) * v_v2 * w_v2 * p6_v2.position) + (u_v2 * v_v2 * w_v2 * p7_v2.position)
-                        + ((1 - u_v2) * (1 - v_v2) * (1 - w_v2) * p0_v2.position) + (u_v2 * (1 - v_v2) * (1 - w_v2) * p1_v2.position)
-                        + ((1 - u_v2) * v_v2 * (1 - w_v2) * p2_v2.position) + (u_v2 * v_v2 * (1 - w_v2) * p3_v2.position));
-           Vector3d v2Trans;
-           v2Trans.set(v2prime.x - obj.VertexArray[v2].X, v2prime.y - obj.VertexArray[v2].Y, v2prime.z - obj.VertexArray[v2].Z);
-
-           glNormal3f(obj.NormalArray[n0].X, obj.NormalArray[n0].Y, obj.NormalArray[n0].Z);
-           glVertex3f(obj.VertexArray[v0].X + v0Trans.x, obj.VertexArray[v0].Y + v0Trans.y, obj.VertexArray[v0].Z + v0Trans.z);
-           glNormal3f(obj.NormalArray[n1].X, obj.NormalArray[n1].Y, obj.NormalArray[n1].Z);
-           glVertex3f(obj.VertexArray[v1].X + v1Trans.x, obj.VertexArray[v1].Y + v1Trans.y, obj.VertexArray[v1].Z + v1Trans.z);
-           glNormal3f(obj.NormalArray[n2].X, obj.NormalArray[n2].Y, obj.NormalArray[n2].Z);
-           glVertex3f(obj.VertexArray[v2].X + v2Trans.x, obj.VertexArray[v2].Y + v2Trans.y, obj.VertexArray[v2].Z + v2Trans.z);
 
+     if(!buffersReady)
+        uploadBuffers();
+
+     // deform each mesh vertex once, then refresh only the draw positions
+     if(playing)
+        mesh.deform(playback.getX(playFrame), playback.getY(playFrame), playback.getZ(playFrame));
+     else
+        mesh.deform(themodel);
+     const float* V = mesh.getPositions();
+     const ObjWeldedVertex* welded = mesh.getObj().WeldedArray;
+     for (int i = 0; i < numDrawVertices; i++){
+        const float* src = V + 3 * welded[i].Vertex;
+        drawPositions[3 * i] = src[0];
+        drawPositions[3 * i + 1] = src[1];
+        drawPositions[3 * i + 2] = src[2];
      }
-     glEnd();
+
+     glEnableClientState(GL_VERTEX_ARRAY);
+     glEnableClientState(GL_NORMAL_ARRAY);
+
+     glBindBuffer(GL_ARRAY_BUFFER, meshBuffers[0]);
+     glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * numDrawVertices * sizeof(float), drawPositions);
+     glVertexPointer(3, GL_FLOAT, 0, 0);
+     glBindBuffer(GL_ARRAY_BUFFER, meshBuffers[1]);
+     glNormalPointer(GL_FLOAT, 0, 0);
+     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffers[2]);
+     glDrawElements(GL_TRIANGLES, numDrawIndices, GL_UNSIGNED_INT, 0);
+
+     glDisableClientState(GL_NORMAL_ARRAY);
 
      glDisable(GL_LIGHTING);
 
 if (ShowLattice == true){
-     glPointSize(4.0f);
-     glBegin(GL_POINTS);
-     glColor4f(0, 0.380, 0.352, 1.0);
-     for (int i=0; i < np; i++){
-        glVertex3f(S->states[i].x, S->states[i].y, S->states[i].z);
+     if(playing){
+        const float *px = playback.getX(playFrame);
+        const float *py = playback.getY(playFrame);
+        const float *pz = playback.getZ(playFrame);
+        for (int i=0; i < np; i++){
+           latticePositions[3 * i] = px[i];
+           latticePositions[3 * i + 1] = py[i];
+           latticePositions[3 * i + 2] = pz[i];
+        }
      }
-     glEnd();
-
-     glBegin(GL_LINES);
-        for (int st=0; st < ns; st++){
-           int p1 = ST[st].v_indices[0];
-           int p2 = ST[st].v_indices[1];
-           glVertex3f(P[p1].position.x, P[p1].position.y, P[p1].position.z);
-           glVertex3f(P[p2].position.x, P[p2].position.y, P[p2].position.z);
+     else{
+        for (int i=0; i < np; i++){
+           latticePositions[3 * i] = S->x[i];
+           latticePositions[3 * i + 1] = S->y[i];
+           latticePositions[3 * i + 2] = S->z[i];
         }
-     glEnd();
+     }
+     glBindBuffer(GL_ARRAY_BUFFER, latticeBuffers[0]);
+     glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * np * sizeof(float), latticePositions);
+     glVertexPointer(3, GL_FLOAT, 0, 0);
+
+     glPointSize(4.0f);
+     glColor4f(0, 0.380, 0.352, 1.0);
+     glDrawArrays(GL_POINTS, 0, np);
+
+     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, latticeBuffers[1]);
+     glDrawElements(GL_LINES, 2 * ns, GL_UNSIGNED_INT, 0);
 }
+     glDisableClientState(GL_VERTEX_ARRAY);
+     glBindBuffer(GL_ARRAY_BUFFER, 0);
+     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
           glEnable(GL_LIGHTING);
   }
 }
@@ -9,21 +9,16 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <chrono>
 
 #include "Camera.h"
 #include "Model.h"
+#include "DeformedMesh.h"
+#include "LatticeCache.h"
 
 #ifndef __VIEW_H__
 #define __VIEW_H__
 
-struct MeshVertex
-{
-   int cellIndex; // lattice cell that a vertex belongs to
-   float u;
-   float v;
-   float w;
-};
-
 class View{
   private:
     const int width;                // initial window dimensions
@@ -55,11 +50,20 @@ class View{
     // The simulation model
     Model *themodel;
 
-    // Obj mesh
-    ObjLoader objloader;
-    ObjModel obj;
-
-    MeshVertex* meshVertices;
+    // Obj mesh carried by the lattice
+    DeformedMesh mesh;
+
+    // Retained vertex buffers. The mesh is drawn indexed over the obj's welded
+    // vertices; indices and normals are uploaded once and only positions are
+    // refreshed each frame.
+    int numDrawVertices;
+    int numDrawIndices;
+    float* drawPositions;         // x y z per draw vertex, refreshed each frame
+    float* drawNormals;           // x y z per draw vertex
+    float* latticePositions;      // x y z per lattice particle, refreshed each frame
+    unsigned int meshBuffers[3];  // positions, normals, indices; 0 until generated
+    unsigned int latticeBuffers[2]; // positions, strut end indices
+    bool buffersReady;
 
     // Switches to turn lights on and off
     bool KeyOn;
@@ -72,6 +76,15 @@ class View{
     // Toggle lattice
     bool ShowLattice;
 
+    // Lattice cache playback, replaces the running simulation when on
+    LatticeCacheReader playback;
+    bool playing;
+    bool playPaused;
+    int playFrame;
+    double playFrameTime;           // seconds of simulated time per cached frame
+    int playClockFrame;             // frame shown when the playback clock was last set
+    std::chrono::steady_clock::time_point playClock;
+
     // Current window dimensions
     int Width;
     int Height;
@@ -81,9 +94,16 @@ class View{
   
    // draw the model, never called outside of this class
     void drawModel();
+
+    // build the draw vertex arrays for the loaded mesh, and upload them
+    void buildDrawArrays();
+    void uploadBuffers();
   
   public:
     View(Model *model = NULL);
+
+    // load the mesh to deform and build the model's lattice around it
+    void loadModel(const char *filename);
   
     // initialize the state of the viewer to start-up defaults
     void setInitialView();
@@ -99,6 +119,15 @@ class View{
     // Toggle Lattice
     void toggleLattice();
 
+    // Play back a lattice cache instead of simulating. Must be called
+    // before loadModel, which then rebuilds the lattice the cache was
+    // recorded with around the mesh.
+    bool openPlayback(const char *filename);
+    bool isPlayingBack(){return playing;}
+    bool advancePlayback();		// frame due by the wall clock unless paused, wrapping at the end; true if it changed
+    void stepPlayback(int frames);	// scrub by a number of frames
+    void togglePlaybackPause();
+
     // Handlers for mouse events
     void handleButtons(int button, int state, int x, int y, bool shiftkey);
     void handleMotion(int x, int y);
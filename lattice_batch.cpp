@@ -0,0 +1,266 @@
+/*
+ lattice_batch.cpp
+
+ CPSC 8170 Physically Based Animation
+ Headless batch driver for the lattice deformer. Loads a mesh, builds
+ the lattice around it and runs the simulation for a fixed number of
+ steps as fast as possible, with no window or OpenGL context, writing
+ the deformed mesh out periodically. Suitable for render farm nodes
+ and automated runs.
+
+ usage: lattice_batch [-steps n] [-every k] [-out prefix] [-pc2 file] [-lcache file]
+                      [-lcache_error e] [-lattice planes rows cols] [-springs k d] [-mass m]
+                      [-integrator rk4|implicit|symplectic|verlet|dopri|projective] [-h dt]
+                      [-tol e] [-iterations n]
+                      [-checkpoint file] [-checkpoint_every k] [-checkpoint_error e]
+                      [-restart file] [mesh.obj]
+   -steps:   step number to run the simulation up to (default 100)
+   -every:   write the deformed mesh every k steps, 0 for never (default 0)
+   -out:     deformed meshes are written to prefix_NNNNNN.obj (default deformed)
+   -pc2:     stream the deformed vertex positions to a PC2 point cache instead
+             of obj files, every k steps with -every, otherwise every step
+   -lcache:  record only the lattice positions, for playback with
+             spooky_springy_mesh -play; frames are taken as for -pc2
+   -lcache_error: compress the lattice cache, keeping positions within e
+             (default 0, uncompressed)
+   -lattice: number of lattice cells along z, y and x (default 2 12 4)
+   -springs: strut spring and damping constants (default 11.1 2.8)
+   -mass:    total mass of the lattice (default 1000)
+   -integrator: rk4, explicit 4th order Runge Kutta; implicit, backward
+             Euler with a conjugate gradient solve, which stays stable at
+             much larger time steps; symplectic, semi-implicit Euler, or
+             verlet, velocity Verlet, with one force evaluation per step
+             instead of four, for quick previews; dopri, Dormand-Prince
+             5(4) with adaptive substeps; projective, projective dynamics
+             with a prefactored system, stable at large time steps for
+             stiff lattices (default rk4)
+   -h:       simulation time step (default 0.05); with dopri the interval
+             the adaptive substeps cover
+   -tol:     error allowed per dopri substep, relative and absolute
+             (default 1e-4)
+   -iterations: local global iterations per projective step (default 10)
+   -checkpoint: save the simulation state to this file periodically
+   -checkpoint_every: steps between checkpoints (default 500)
+   -checkpoint_error: compress the checkpointed state, keeping positions
+             within e; a restart then no longer repeats the run exactly
+             (default 0, exact)
+   -restart: resume from a checkpoint made with the same mesh; the lattice
+             options, integrator and time step are then taken from the
+             checkpoint. Cannot be combined with -pc2 or -lcache, which
+             would start their files over
+   mesh.obj: mesh to deform (default skeleton.obj)
+*/
+
+#include "Model.h"
+#include "DeformedMesh.h"
+#include "PointCache.h"
+#include "Checkpoint.h"
+#include "LatticeCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static void usage(const char *prog){
+  cerr << "usage: " << prog << " [-steps n] [-every k] [-out prefix] [-pc2 file] [-lcache file]" << endl;
+  cerr << "       [-lcache_error e] [-lattice planes rows cols] [-springs k d] [-mass m]" << endl;
+  cerr << "       [-integrator rk4|implicit|symplectic|verlet|dopri|projective] [-h dt]" << endl;
+  cerr << "       [-tol e] [-iterations n]" << endl;
+  cerr << "       [-checkpoint file] [-checkpoint_every k] [-checkpoint_error e]" << endl;
+  cerr << "       [-restart file] [mesh.obj]" << endl;
+  exit(1);
+}
+
+//
+// write the current deformed mesh as prefix_NNNNNN.obj, numbered by step
+//
+static void writeFrame(DeformedMesh &mesh, Model &model, const string &prefix, int step){
+  char filename[1024];
+  snprintf(filename, sizeof(filename), "%s_%06d.obj", prefix.c_str(), step);
+  mesh.deform(&model);
+  if(!mesh.writeObj(filename))
+    exit(1);
+}
+
+//
+// queue the current deformed positions on the point cache; the writes
+// happen on the cache's own thread
+//
+static void cacheFrame(DeformedMesh &mesh, Model &model, PointCacheWriter &cache, const char *filename){
+  mesh.deform(&model);
+  if(!cache.addFrame(mesh.getPositions())){
+    cerr << "Could not write point cache " << filename << endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char* argv[]){
+  Model model;
+  DeformedMesh mesh;
+
+  const char *meshfile = "skeleton.obj";
+  string prefix = "deformed";
+  const char *pc2file = NULL;
+  const char *lcachefile = NULL;
+  const char *checkpointfile = NULL;
+  const char *restartfile = NULL;
+  int checkpointEvery = 500;
+  double lcacheError = 0;
+  double checkpointError = 0;
+  int steps = 100;
+  int every = 0;
+
+  for(int i = 1; i < argc; i++){
+    string arg = argv[i];
+    if(arg == "-steps" && i + 1 < argc)
+      steps = atoi(argv[++i]);
+    else if(arg == "-every" && i + 1 < argc)
+      every = atoi(argv[++i]);
+    else if(arg == "-out" && i + 1 < argc)
+      prefix = argv[++i];
+    else if(arg == "-pc2" && i + 1 < argc)
+      pc2file = argv[++i];
+    else if(arg == "-lcache" && i + 1 < argc)
+      lcachefile = argv[++i];
+    else if(arg == "-lcache_error" && i + 1 < argc)
+      lcacheError = atof(argv[++i]);
+    else if(arg == "-checkpoint" && i + 1 < argc)
+      checkpointfile = argv[++i];
+    else if(arg == "-checkpoint_every" && i + 1 < argc)
+      checkpointEvery = atoi(argv[++i]);
+    else if(arg == "-checkpoint_error" && i + 1 < argc)
+      checkpointError = atof(argv[++i]);
+    else if(arg == "-restart" && i + 1 < argc)
+      restartfile = argv[++i];
+    else if(arg == "-lattice" && i + 3 < argc){
+      model.setResolution(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+      i += 3;
+    }
+    else if(arg == "-springs" && i + 2 < argc){
+      model.setSpringConstants(atof(argv[i + 1]), atof(argv[i + 2]));
+      i += 2;
+    }
+    else if(arg == "-mass" && i + 1 < argc)
+      model.setLatticeMass(atof(argv[++i]));
+    else if(arg == "-integrator" && i + 1 < argc){
+      Model::Integrator method;
+      if(!Model::findIntegrator(argv[++i], method)){
+        cerr << "Unknown integrator " << argv[i] << endl;
+        usage(argv[0]);
+      }
+      model.setIntegrator(method);
+    }
+    else if(arg == "-h" && i + 1 < argc)
+      model.setTimeStep(atof(argv[++i]));
+    else if(arg == "-tol" && i + 1 < argc)
+      model.setErrorTolerance(atof(argv[++i]));
+    else if(arg == "-iterations" && i + 1 < argc)
+      model.getProjectiveSolver()->setIterations(atoi(argv[++i]));
+    else if(arg[0] != '-')
+      meshfile = argv[i];
+    else
+      usage(argv[0]);
+  }
+
+  // the caches are created fresh, so resuming into one would throw away
+  // the frames recorded before the checkpoint
+  if(restartfile != NULL && (pc2file != NULL || lcachefile != NULL)){
+    cerr << "-restart cannot be combined with -pc2 or -lcache" << endl;
+    return 1;
+  }
+
+  if(!mesh.load(meshfile))
+    return 1;
+
+  // a restart brings back the lattice, the mesh binding and the clock
+  if(restartfile != NULL){
+    if(!Checkpoint::read(restartfile, model, &mesh))
+      return 1;
+  }
+  else{
+    mesh.fitLattice(&model);
+    model.initSimulation();
+    model.startSimulation();
+  }
+  int first = model.getStep();
+
+  // with a point or lattice cache, frames are one simulation step apart
+  // unless -every is given, and no obj files are written
+  bool writeObjs = (pc2file == NULL && lcachefile == NULL);
+  if(!writeObjs && every <= 0)
+    every = 1;
+
+  PointCacheWriter cache;
+  if(pc2file != NULL && !cache.open(pc2file, mesh.getNumVertices(), 0, every))
+    return 1;
+  LatticeCacheWriter lcache;
+  if(lcachefile != NULL && !lcache.open(lcachefile, model, every, lcacheError))
+    return 1;
+
+  auto outputFrame = [&](int n){
+    if(writeObjs)
+      writeFrame(mesh, model, prefix, n);
+    if(pc2file != NULL)
+      cacheFrame(mesh, model, cache, pc2file);
+    if(lcachefile != NULL && !lcache.addFrame(*model.getSPointer())){
+      cerr << "Could not write lattice cache " << lcachefile << endl;
+      exit(1);
+    }
+  };
+
+  double simSeconds = 0;
+  int frames = 0;
+  int checkpoints = 0;
+  if(every > 0 && first == 0){
+    outputFrame(0);
+    frames++;
+  }
+
+  for(int n = first + 1; n <= steps; n++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    model.timeStep();
+    simSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(!model.isSimRunning()){
+      cerr << Model::integratorName(model.getIntegrator()) << " step " << n << " failed, simulation stopped" << endl;
+      return 1;
+    }
+
+    if(every > 0 && n % every == 0){
+      outputFrame(n);
+      frames++;
+    }
+
+    if(checkpointfile != NULL && checkpointEvery > 0 && n % checkpointEvery == 0){
+      if(!Checkpoint::write(checkpointfile, model, &mesh, checkpointError))
+        return 1;
+      checkpoints++;
+    }
+  }
+
+  if(pc2file != NULL){
+    if(!cache.close())
+      return 1;
+    cout << cache.getNumSamples() << " frames cached to " << pc2file << endl;
+  }
+
+  if(lcachefile != NULL){
+    if(!lcache.close())
+      return 1;
+    cout << lcache.getNumFrames() << " lattice frames cached to " << lcachefile << endl;
+  }
+
+  int ran = steps > first ? steps - first : 0;
+  cout << ran << " " << Model::integratorName(model.getIntegrator()) << " steps of " << model.getNumParticles()
+       << " particles and " << model.getNumStruts() << " struts in " << simSeconds << " s (" << (simSeconds > 0 ? ran / simSeconds : 0) << " steps/s), "
+       << frames << " frames written";
+  if(checkpointfile != NULL)
+    cout << ", " << checkpoints << " checkpoints";
+  if(ran > 0 && model.getNumEvaluations() > 0)
+    cout << ", " << (double)model.getNumEvaluations() / ran << " force evaluations per step";
+  cout << endl;
+  return 0;
+}
@@ -4,10 +4,18 @@
 // at Texas A&M University
 //
 #include "objtriloader.h"
+#include "ThreadPool.h"
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <cstdlib>
 #include <cmath>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -23,131 +31,197 @@ ObjModel::ObjModel()
 	ObjModel::TexCoordArray = NULL;
 	ObjModel::TriangleArray = NULL;
 	ObjModel::VertexArray = NULL;
+	ObjModel::NumWelded = 0;
+	ObjModel::WeldedArray = NULL;
+	ObjModel::IndexArray = NULL;
 	ObjModel::vertex_buffer = NULL;
 	ObjModel::normal_buffer = NULL;
 	ObjModel::texcoord_buffer = NULL;
+	ObjModel::Mapping = NULL;
+	ObjModel::MappingSize = 0;
 }
 
 ObjModel::~ObjModel()
 {
-	//free up data
-	delete[] NormalArray;
-	delete[] TexCoordArray;
-	delete[] TriangleArray;
-	delete[] VertexArray;
-	delete[] vertex_buffer;
-	delete[] normal_buffer;
-	delete[] texcoord_buffer;
+	Clear();
 }
 
-ObjModel::ObjModel(const ObjModel &copy)
+void ObjModel::Clear(void)
 {
-	int i, j, tCounter, txCounter;
-
-	//make room for the new data
-	NormalArray = new ObjNormal[copy.NumNormal];
-	TexCoordArray = new ObjTexCoord[copy.NumTexCoord];
-	TriangleArray = new ObjTriangle[copy.NumTriangle];
-	VertexArray = new ObjVertex[copy.NumVertex];
-	vertex_buffer = new float[copy.NumTriangle * 3 * 3];
-	normal_buffer = new float[copy.NumTriangle * 3 * 3];
-	texcoord_buffer = new float[copy.NumTriangle * 3 * 2];
-	NumNormal = copy.NumNormal;
-	NumTexCoord = copy.NumTexCoord;
-	NumTriangle = copy.NumTriangle;
-	NumVertex = copy.NumVertex;
-
+	//arrays inside a mapped file go away with the mapping
+	if (Mapping != NULL)
+		munmap(Mapping, MappingSize);
+	else
+	{
+		free(NormalArray);
+		free(TexCoordArray);
+		free(TriangleArray);
+		free(VertexArray);
+		free(WeldedArray);
+		free(IndexArray);
+	}
+	free(vertex_buffer);
+	free(normal_buffer);
+	free(texcoord_buffer);
+
+	NumNormal = NumTexCoord = NumTriangle = NumVertex = 0;
+	NormalArray = NULL;
+	TexCoordArray = NULL;
+	TriangleArray = NULL;
+	VertexArray = NULL;
+	NumWelded = 0;
+	WeldedArray = NULL;
+	IndexArray = NULL;
+	vertex_buffer = normal_buffer = texcoord_buffer = NULL;
+	Mapping = NULL;
+	MappingSize = 0;
+}
 
-	//Grab data from the copy to the current class
-	for (i = 0; i < NumVertex; i++)
-		VertexArray[i] = copy.VertexArray[i];
+//take over the data of another model, leaving it empty
+ObjModel::ObjModel(ObjModel &&other)
+{
+	NumNormal = NumTexCoord = NumTriangle = NumVertex = 0;
+	NormalArray = NULL;
+	TexCoordArray = NULL;
+	TriangleArray = NULL;
+	VertexArray = NULL;
+	NumWelded = 0;
+	WeldedArray = NULL;
+	IndexArray = NULL;
+	vertex_buffer = normal_buffer = texcoord_buffer = NULL;
+	Mapping = NULL;
+	MappingSize = 0;
+	*this = std::move(other);
+}
 
-	for (i = 0; i < NumNormal; i++)
-		NormalArray[i] = copy.NormalArray[i];
+ObjModel& ObjModel::operator=(ObjModel &&right)
+{
+	if (this == &right)
+		return *this;
 
-	for (i = 0; i < NumTexCoord; i++)
-		TexCoordArray[i] = copy.TexCoordArray[i];
+	//free current data; if we have it
+	Clear();
 
-	tCounter = txCounter = 0;
+	NumNormal = right.NumNormal;
+	NumTexCoord = right.NumTexCoord;
+	NumTriangle = right.NumTriangle;
+	NumVertex = right.NumVertex;
+	NormalArray = right.NormalArray;
+	TexCoordArray = right.TexCoordArray;
+	TriangleArray = right.TriangleArray;
+	VertexArray = right.VertexArray;
+	NumWelded = right.NumWelded;
+	WeldedArray = right.WeldedArray;
+	IndexArray = right.IndexArray;
+	vertex_buffer = right.vertex_buffer;
+	normal_buffer = right.normal_buffer;
+	texcoord_buffer = right.texcoord_buffer;
+	Mapping = right.Mapping;
+	MappingSize = right.MappingSize;
+
+	right.NumNormal = right.NumTexCoord = right.NumTriangle = right.NumVertex = 0;
+	right.NormalArray = NULL;
+	right.TexCoordArray = NULL;
+	right.TriangleArray = NULL;
+	right.VertexArray = NULL;
+	right.NumWelded = 0;
+	right.WeldedArray = NULL;
+	right.IndexArray = NULL;
+	right.vertex_buffer = right.normal_buffer = right.texcoord_buffer = NULL;
+	right.Mapping = NULL;
+	right.MappingSize = 0;
+	return *this;
+}
 
-	for (i = 0; i < NumTriangle; i++)
+//weld the triangle corners: a hash table keyed on (vertex, normal, texture
+//coordinate) gives each distinct combination one entry, in order of first use
+void ObjModel::BuildWelded(void)
+{
+	int ncorners = 3 * NumTriangle;
+
+	free(WeldedArray);
+	free(IndexArray);
+	WeldedArray = (ObjWeldedVertex*)malloc((ncorners > 0 ? ncorners : 1) * sizeof(ObjWeldedVertex));
+	IndexArray = (unsigned int*)malloc((ncorners > 0 ? ncorners : 1) * sizeof(unsigned int));
+	NumWelded = 0;
+
+	//open addressing, at most half full
+	unsigned int capacity = 16;
+	while (capacity < 2 * (unsigned int)ncorners)
+		capacity *= 2;
+	int *table = (int*)malloc(capacity * sizeof(int));
+	memset(table, 0xff, capacity * sizeof(int));
+
+	for (int i = 0; i < NumTriangle; i++)
 	{
-		TriangleArray[i] = copy.TriangleArray[i];
-
-		for (j = 0; j < 3; j++) 
+		for (int j = 0; j < 3; j++)
 		{
-			vertex_buffer[tCounter] = VertexArray[TriangleArray[i].Vertex[j]].X;
-			vertex_buffer[tCounter + 1] = VertexArray[TriangleArray[i].Vertex[j]].Y;
-			vertex_buffer[tCounter + 2] = VertexArray[TriangleArray[i].Vertex[j]].Z;
-			normal_buffer[tCounter] = NormalArray[TriangleArray[i].Normal[j]].X;
-			normal_buffer[tCounter + 1] = NormalArray[TriangleArray[i].Normal[j]].Y;
-			normal_buffer[tCounter + 2] = NormalArray[TriangleArray[i].Normal[j]].Z;
-			tCounter += 3;
+			ObjWeldedVertex key = {TriangleArray[i].Vertex[j], TriangleArray[i].Normal[j],
+				TriangleArray[i].TexCoord[j]};
 
-			texcoord_buffer[txCounter] = TexCoordArray[TriangleArray[i].TexCoord[j]].U;
-			texcoord_buffer[txCounter + 1] = TexCoordArray[TriangleArray[i].TexCoord[j]].V;
-			txCounter += 2;
+			unsigned int h = (unsigned int)key.Vertex * 0x9e3779b1u;
+			h ^= (unsigned int)key.Normal * 0x85ebca77u + (h << 6) + (h >> 2);
+			h ^= (unsigned int)key.TexCoord * 0xc2b2ae3du + (h << 6) + (h >> 2);
+
+			unsigned int slot = h & (capacity - 1);
+			while (table[slot] >= 0)
+			{
+				const ObjWeldedVertex &w = WeldedArray[table[slot]];
+				if (w.Vertex == key.Vertex && w.Normal == key.Normal && w.TexCoord == key.TexCoord)
+					break;
+				slot = (slot + 1) & (capacity - 1);
+			}
+			if (table[slot] < 0)
+			{
+				table[slot] = NumWelded;
+				WeldedArray[NumWelded++] = key;
+			}
+			IndexArray[3 * i + j] = (unsigned int)table[slot];
 		}
 	}
+	free(table);
+
+	WeldedArray = (ObjWeldedVertex*)realloc(WeldedArray, (NumWelded > 0 ? NumWelded : 1) * sizeof(ObjWeldedVertex));
 }
 
-ObjModel& ObjModel::operator=(const ObjModel &right)
+//fill the de-indexed per corner buffers, once, on first request
+void ObjModel::BuildBuffers(void)
 {
 	int i, j, tCounter, txCounter;
 
-	//free current data; if we have it
-	delete[] NormalArray;
-	delete[] TexCoordArray;
-	delete[] TriangleArray;
-	delete[] VertexArray;
-	delete[] vertex_buffer;
-	delete[] normal_buffer;
-	delete[] texcoord_buffer;
-
-	//make room for the new data
-	NormalArray = new ObjNormal[right.NumNormal];
-	TexCoordArray = new ObjTexCoord[right.NumTexCoord];
-	TriangleArray = new ObjTriangle[right.NumTriangle];
-	VertexArray = new ObjVertex[right.NumVertex];
-	vertex_buffer = new float[right.NumTriangle * 3 * 3];
-	normal_buffer = new float[right.NumTriangle * 3 * 3];
-	texcoord_buffer = new float[right.NumTriangle * 3 * 2];
-	NumNormal = right.NumNormal;
-	NumTexCoord = right.NumTexCoord;
-	NumTriangle = right.NumTriangle;
-	NumVertex = right.NumVertex;
-
-
-	//Grab data from the copy to the current class
-	for (i = 0; i < NumVertex; i++)
-		VertexArray[i] = right.VertexArray[i];
-
-	for (i = 0; i < NumNormal; i++)
-		NormalArray[i] = right.NormalArray[i];
+	if (vertex_buffer != NULL || NumTriangle == 0)
+		return;
 
-	for (i = 0; i < NumTexCoord; i++)
-		TexCoordArray[i] = right.TexCoordArray[i];
+	vertex_buffer = (float*)malloc(NumTriangle * 3 * 3 * sizeof(float));
+	normal_buffer = (float*)malloc(NumTriangle * 3 * 3 * sizeof(float));
+	texcoord_buffer = (float*)malloc(NumTriangle * 3 * 2 * sizeof(float));
 
 	tCounter = txCounter = 0;
 
 	for (i = 0; i < NumTriangle; i++)
 	{
-		TriangleArray[i] = right.TriangleArray[i];
-		for (j = 0; j < 3; j++) {
+		for (j = 0; j < 3; j++)
+		{
 			vertex_buffer[tCounter] = VertexArray[TriangleArray[i].Vertex[j]].X;
 			vertex_buffer[tCounter + 1] = VertexArray[TriangleArray[i].Vertex[j]].Y;
 			vertex_buffer[tCounter + 2] = VertexArray[TriangleArray[i].Vertex[j]].Z;
-			normal_buffer[tCounter] = NormalArray[TriangleArray[i].Normal[j]].X;
-			normal_buffer[tCounter + 1] = NormalArray[TriangleArray[i].Normal[j]].Y;
-			normal_buffer[tCounter + 2] = NormalArray[TriangleArray[i].Normal[j]].Z;
+			ObjNormal n = {0, 0, 0};
+			ObjTexCoord tc = {0, 0};
+			if (TriangleArray[i].Normal[j] >= 0)
+				n = NormalArray[TriangleArray[i].Normal[j]];
+			if (TriangleArray[i].TexCoord[j] >= 0)
+				tc = TexCoordArray[TriangleArray[i].TexCoord[j]];
+
+			normal_buffer[tCounter] = n.X;
+			normal_buffer[tCounter + 1] = n.Y;
+			normal_buffer[tCounter + 2] = n.Z;
 			tCounter += 3;
 
-			texcoord_buffer[txCounter] = TexCoordArray[TriangleArray[i].TexCoord[j]].U;
-			texcoord_buffer[txCounter + 1] = TexCoordArray[TriangleArray[i].TexCoord[j]].V;
+			texcoord_buffer[txCounter] = tc.U;
+			texcoord_buffer[txCounter + 1] = tc.V;
 			txCounter += 2;
 		}
 	}
-	return *this;
 }
 
 //ObjLoader Class
@@ -166,12 +240,16 @@ void ObjLoader::FreeObj(void)
 {
 	if (fileName != NULL) delete fileName;
 	if (theObj != NULL)   delete theObj;
+	fileName = NULL;
+	theObj = NULL;
 }
 
+//hand the loaded model over to the caller; the loader is left empty
 ObjModel ObjLoader::ReturnObj(void)
 {
-	ObjModel ret(*theObj);
-	return ret;
+	if (theObj == NULL)
+		return ObjModel();
+	return std::move(*theObj);
 }
 
 ObjLoader::ObjLoader(string file)
@@ -189,155 +267,422 @@ void ObjLoader::LoadObj(string file)
 	ReadData();
 }
 
-void ObjLoader::ReadData(void)
+//growable array used while parsing; storage is handed to the ObjModel
+template <class T>
+struct ObjGrowArray
 {
-	ifstream input(fileName->c_str());
-	string buffer;
+	T *data;
+	int size, capacity;
 
-	//make sure file opens correctly
-	if (!input.is_open())
-		return;
+	ObjGrowArray() : data(NULL), size(0), capacity(0) {}
 
-	//Setup our ObjModel arrays
-	//read one line at a time of file
-	while (!input.eof())
+	T& push()
 	{
-		getline(input, buffer);
-
-		if (buffer.substr(0, 2) == "vn")
-			theObj->NumNormal++;
-
-		else if (buffer.substr(0, 2) == "vt")
-			theObj->NumTexCoord++;
+		if (size == capacity)
+		{
+			capacity = (capacity > 0) ? 2 * capacity : 1024;
+			data = (T*)realloc(data, capacity * sizeof(T));
+		}
+		return data[size++];
+	}
 
-		else if (buffer.substr(0, 1) == "v")
-			theObj->NumVertex++;
+	//give up the storage, trimmed to size
+	T* release()
+	{
+		T *ret = (T*)realloc(data, (size > 0 ? size : 1) * sizeof(T));
+		data = NULL;
+		size = capacity = 0;
+		return ret;
+	}
 
-		else if (buffer.substr(0, 1) == "f")
-			theObj->NumTriangle++;
+	void reset()
+	{
+		free(data);
+		data = NULL;
+		size = capacity = 0;
 	}
 
-	//Make the arrays the right size
-	theObj->NormalArray = new ObjNormal[theObj->NumNormal + 1];
-	theObj->TexCoordArray = new ObjTexCoord[theObj->NumTexCoord + 1];
-	theObj->TriangleArray = new ObjTriangle[theObj->NumTriangle + 1];
-	theObj->VertexArray = new ObjVertex[theObj->NumVertex + 1];
+	ObjGrowArray(const ObjGrowArray&) = delete;
+	ObjGrowArray& operator=(const ObjGrowArray&) = delete;
+	~ObjGrowArray() { free(data); }
+};
 
-	//close file
-	input.close();
+//numeric conversion straight from the file buffer, no copies or allocation
+static inline bool ObjIsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-	//reopen file
-	input.open(fileName->c_str());
+static inline const char* ObjSkipSpace(const char *p, const char *end)
+{
+	while (p < end && ObjIsSpace(*p))
+		p++;
+	return p;
+}
 
-	input.clear();
+static const char* ObjParseInt(const char *p, const char *end, int &value, bool &ok)
+{
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+
+	const char *start = p;
+	long v = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		v = 10 * v + (*p++ - '0');
+
+	ok = (p != start);
+	value = (int)(neg ? -v : v);
+	return p;
+}
 
-	//make sure we got the file opened up ok...
-	if (!input.is_open())
-		return;
+static const char* ObjParseFloat(const char *p, const char *end, float &value)
+{
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-	//counters
-	int nC, vC, tC, fC;
-	nC = vC = tC = fC = 0;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
 
-	//get the hard data, and load up arrays
-	//read one line at a time of file
-	while (!input.eof())
+	//up to 19 significant digits fit in the mantissa, the rest only scale it
+	unsigned long long mant = 0;
+	int digits = 0, exp10 = 0;
+	while (p < end && *p >= '0' && *p <= '9')
 	{
-		getline(input, buffer);
-		istringstream line(buffer);
-		string temp;
-		string f1, f2, f3;
-
-		if (buffer.substr(0, 2) == "vn")
+		if (digits < 19) { mant = 10 * mant + (*p - '0'); if (mant > 0) digits++; }
+		else exp10++;
+		p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
 		{
-			line >> temp >> f1 >> f2 >> f3;
-			theObj->NormalArray[nC].X = atof(f1.c_str());
-			theObj->NormalArray[nC].Y = atof(f2.c_str());
-			theObj->NormalArray[nC].Z = atof(f3.c_str());
-			nC++;
+			if (digits < 19) { mant = 10 * mant + (*p - '0'); if (mant > 0) digits++; exp10--; }
+			p++;
 		}
-		else if (buffer.substr(0, 2) == "vt")
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int e;
+		bool ok;
+		const char *q = ObjParseInt(p + 1, end, e, ok);
+		if (ok) { exp10 += e; p = q; }
+	}
+
+	double v = (double)mant;
+	if (exp10 < 0)
+		v = (-exp10 <= 22) ? v / pow10[-exp10] : v * pow(10.0, exp10);
+	else if (exp10 > 0)
+		v = (exp10 <= 22) ? v * pow10[exp10] : v * pow(10.0, exp10);
+
+	value = (float)(neg ? -v : v);
+	return p;
+}
+
+//obj indices are 1 based, or negative relative to the current end of the list
+static inline int ObjResolveIndex(int idx, int count)
+{
+	if (idx > 0) return idx - 1;
+	if (idx < 0) return count + idx;
+	return -1;
+}
+
+//parse one face corner of the form v, v/vt, v//vn or v/vt/vn; bit k of
+//relative is set when field k was given as a negative (relative) index
+static const char* ObjParseCorner(const char *p, const char *end, int counts[3], int corner[3],
+	int &relative, bool &ok)
+{
+	int idx;
+	bool got;
+
+	corner[0] = corner[1] = corner[2] = -1;
+	relative = 0;
+	p = ObjParseInt(p, end, idx, ok);
+	if (!ok)
+		return p;
+	corner[0] = ObjResolveIndex(idx, counts[0]);
+	relative |= (idx < 0);
+
+	if (p < end && *p == '/')
+	{
+		p = ObjParseInt(p + 1, end, idx, got);
+		if (got)
 		{
-			line >> temp >> f1 >> f2;
-			theObj->TexCoordArray[tC].U = atof(f1.c_str());
-			theObj->TexCoordArray[tC].V = atof(f2.c_str());
-			tC++;
+			corner[1] = ObjResolveIndex(idx, counts[1]);
+			relative |= (idx < 0) << 1;
 		}
-		else if (buffer.substr(0, 1) == "v")
+
+		if (p < end && *p == '/')
 		{
-			line >> temp >> f1 >> f2 >> f3;
-			theObj->VertexArray[vC].X = atof(f1.c_str());
-			theObj->VertexArray[vC].Y = atof(f2.c_str());
-			theObj->VertexArray[vC].Z = atof(f3.c_str());
-			vC++;
+			p = ObjParseInt(p + 1, end, idx, got);
+			if (got)
+			{
+				corner[2] = ObjResolveIndex(idx, counts[2]);
+				relative |= (idx < 0) << 2;
+			}
 		}
-		else if (buffer.substr(0, 1) == "f")
-		{
-			line >> temp >> f1 >> f2 >> f3;
+	}
+	return p;
+}
 
-			int sPos = 0;
-			int ePos = sPos;
-			string temp;
-			ePos = f1.find_first_of("/");
+//map the whole file read only; falls back to reading it if mapping fails
+struct ObjFileView
+{
+	const char *data;
+	size_t size;
+	bool mapped;
 
-			//we have a line with the format of "f %d/%d/%d %d/%d/%d %d/%d/%d"
-			if (ePos != string::npos)
-			{
-				temp = f1.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Vertex[0] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f1.find("/", sPos);
-				temp = f1.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].TexCoord[0] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f1.length();
-				temp = f1.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Normal[0] = atoi(temp.c_str()) - 1;
-			}
+	ObjFileView() : data(NULL), size(0), mapped(false) {}
+
+	bool open(const char *name)
+	{
+		int fd = ::open(name, O_RDONLY);
+		if (fd < 0)
+			return false;
 
-			sPos = 0;
-			ePos = f2.find_first_of("/");
+		struct stat st;
+		if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+		size = (size_t)st.st_size;
 
-			//we have a line with the format of "f %d/%d/%d %d/%d/%d %d/%d/%d"
-			if (ePos != string::npos)
+		if (size > 0)
+		{
+			void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (m != MAP_FAILED)
+			{
+				madvise(m, size, MADV_SEQUENTIAL);
+				data = (const char*)m;
+				mapped = true;
+			}
+			else
 			{
-				temp = f2.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Vertex[1] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f2.find("/", sPos + 1);
-				temp = f2.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].TexCoord[1] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f2.length();
-				temp = f2.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Normal[1] = atoi(temp.c_str()) - 1;
+				char *buf = (char*)malloc(size);
+				size_t got = 0;
+				ssize_t r;
+				while (got < size && (r = read(fd, buf + got, size - got)) > 0)
+					got += (size_t)r;
+				data = buf;
+				size = got;
 			}
+		}
+		::close(fd);
+		return true;
+	}
+
+	~ObjFileView()
+	{
+		if (mapped)
+			munmap((void*)data, size);
+		else
+			free((void*)data);
+	}
+};
 
-			sPos = 0;
-			ePos = f3.find_first_of("/");
+//everything parsed from one piece of the file. Relative face indices are
+//resolved against the piece's own counts, and where they were used is
+//recorded in fixups so they can be offset once the earlier pieces are known.
+struct ObjParseChunk
+{
+	ObjGrowArray<ObjVertex> vertices;
+	ObjGrowArray<ObjNormal> normals;
+	ObjGrowArray<ObjTexCoord> texcoords;
+	ObjGrowArray<ObjTriangle> triangles;
+	ObjGrowArray<int> fixups;	//9 * triangle + position of the int in ObjTriangle
+};
+
+//parse the whole lines in [p, end): vertex, normal and texture coordinate
+//lines are appended as they come, and every face polygon is fan triangulated
+static void ObjParseLines(const char *p, const char *end, ObjParseChunk &chunk)
+{
+	while (p < end)
+	{
+		p = ObjSkipSpace(p, end);
+		const char *eol = (const char*)memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
 
-			//we have a line with the format of "f %d/%d/%d %d/%d/%d %d/%d/%d"
-			if (ePos != string::npos)
+		if (p + 1 < eol && p[0] == 'v' && ObjIsSpace(p[1]))
+		{
+			ObjVertex &v = chunk.vertices.push();
+			const char *q = ObjSkipSpace(p + 1, eol);
+			q = ObjSkipSpace(ObjParseFloat(q, eol, v.X), eol);
+			q = ObjSkipSpace(ObjParseFloat(q, eol, v.Y), eol);
+			ObjParseFloat(q, eol, v.Z);
+		}
+		else if (p + 2 < eol && p[0] == 'v' && p[1] == 'n' && ObjIsSpace(p[2]))
+		{
+			ObjNormal &n = chunk.normals.push();
+			const char *q = ObjSkipSpace(p + 2, eol);
+			q = ObjSkipSpace(ObjParseFloat(q, eol, n.X), eol);
+			q = ObjSkipSpace(ObjParseFloat(q, eol, n.Y), eol);
+			ObjParseFloat(q, eol, n.Z);
+		}
+		else if (p + 2 < eol && p[0] == 'v' && p[1] == 't' && ObjIsSpace(p[2]))
+		{
+			ObjTexCoord &t = chunk.texcoords.push();
+			const char *q = ObjSkipSpace(p + 2, eol);
+			q = ObjSkipSpace(ObjParseFloat(q, eol, t.U), eol);
+			ObjParseFloat(q, eol, t.V);
+		}
+		else if (p + 1 < eol && p[0] == 'f' && ObjIsSpace(p[1]))
+		{
+			int counts[3] = {chunk.vertices.size, chunk.texcoords.size, chunk.normals.size};
+			int first[3], prev[3], cur[3];
+			int firstRel = 0, prevRel = 0, curRel;
+			int n = 0;
+			bool ok;
+
+			const char *q = ObjSkipSpace(p + 1, eol);
+			while (q < eol)
 			{
-				temp = f3.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Vertex[2] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f3.find("/", sPos + 1);
-				temp = f3.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].TexCoord[2] = atoi(temp.c_str()) - 1;
-
-				sPos = ePos + 1;
-				ePos = f3.length();
-				temp = f3.substr(sPos, ePos - sPos);
-				theObj->TriangleArray[fC].Normal[2] = atoi(temp.c_str()) - 1;
+				q = ObjParseCorner(q, eol, counts, cur, curRel, ok);
+				if (!ok)
+					break;
+				q = ObjSkipSpace(q, eol);
+
+				if (n == 0)
+				{
+					memcpy(first, cur, sizeof(first));
+					firstRel = curRel;
+				}
+				else if (n >= 2)
+				{
+					int tri = chunk.triangles.size;
+					ObjTriangle &t = chunk.triangles.push();
+					const int *c[3] = {first, prev, cur};
+					const int rel[3] = {firstRel, prevRel, curRel};
+					for (int k = 0; k < 3; k++)
+					{
+						t.Vertex[k] = c[k][0];
+						t.TexCoord[k] = c[k][1];
+						t.Normal[k] = c[k][2];
+						if (rel[k] & 1) chunk.fixups.push() = 9 * tri + k;
+						if (rel[k] & 2) chunk.fixups.push() = 9 * tri + 6 + k;
+						if (rel[k] & 4) chunk.fixups.push() = 9 * tri + 3 + k;
+					}
+				}
+				memcpy(prev, cur, sizeof(prev));
+				prevRel = curRel;
+				n++;
 			}
-			fC++;
 		}
+
+		p = eol + 1;
 	}
 }
 
+//copy one chunk's array into its place in the final array
+template <class T>
+static void ObjCopyChunk(T *dst, const ObjGrowArray<T> &src, int offset)
+{
+	if (src.size > 0)
+		memcpy(dst + offset, src.data, src.size * sizeof(T));
+}
+
+//large files are split on line boundaries into about a megabyte or more per
+//piece, and the pieces are parsed in parallel on the shared thread pool. The
+//results are joined at prefix summed offsets, with relative face indices
+//shifted by the number of items in the earlier pieces.
+void ObjLoader::ReadData(void)
+{
+	ObjFileView file;
+
+	//make sure file opens correctly
+	if (!file.open(fileName->c_str()))
+		return;
+
+	ThreadPool &pool = ThreadPool::shared();
+	size_t nchunks = file.size >> 20;
+	if (nchunks > (size_t)(4 * pool.getNumThreads()))
+		nchunks = 4 * pool.getNumThreads();
+	if (nchunks < 1)
+		nchunks = 1;
+
+	const char *end = file.data + file.size;
+	vector<const char*> bounds(nchunks + 1);
+	bounds[0] = file.data;
+	bounds[nchunks] = end;
+	for (size_t c = 1; c < nchunks; c++)
+	{
+		const char *p = file.data + c * (file.size / nchunks);
+		if (p < bounds[c - 1])
+			p = bounds[c - 1];
+		const char *eol = (const char*)memchr(p, '\n', end - p);
+		bounds[c] = (eol == NULL) ? end : eol + 1;
+	}
+
+	vector<ObjParseChunk> chunks(nchunks);
+	pool.parallelFor(0, (int)nchunks, [&](int b, int e){
+		for (int c = b; c < e; c++)
+			ObjParseLines(bounds[c], bounds[c + 1], chunks[c]);
+	});
+
+	if (nchunks == 1)
+	{
+		//nothing to join, keep the arrays as parsed
+		theObj->NumVertex = chunks[0].vertices.size;
+		theObj->NumNormal = chunks[0].normals.size;
+		theObj->NumTexCoord = chunks[0].texcoords.size;
+		theObj->NumTriangle = chunks[0].triangles.size;
+		theObj->VertexArray = chunks[0].vertices.release();
+		theObj->NormalArray = chunks[0].normals.release();
+		theObj->TexCoordArray = chunks[0].texcoords.release();
+		theObj->TriangleArray = chunks[0].triangles.release();
+		theObj->BuildWelded();
+		return;
+	}
+
+	//where each chunk's items start in the joined arrays
+	vector<int> vertexStart(nchunks), normalStart(nchunks), texcoordStart(nchunks), triangleStart(nchunks);
+	int nv = 0, nn = 0, nt = 0, ntri = 0;
+	for (size_t c = 0; c < nchunks; c++)
+	{
+		vertexStart[c] = nv;
+		normalStart[c] = nn;
+		texcoordStart[c] = nt;
+		triangleStart[c] = ntri;
+		nv += chunks[c].vertices.size;
+		nn += chunks[c].normals.size;
+		nt += chunks[c].texcoords.size;
+		ntri += chunks[c].triangles.size;
+	}
+
+	theObj->NumVertex = nv;
+	theObj->NumNormal = nn;
+	theObj->NumTexCoord = nt;
+	theObj->NumTriangle = ntri;
+	theObj->VertexArray = (ObjVertex*)malloc((nv > 0 ? nv : 1) * sizeof(ObjVertex));
+	theObj->NormalArray = (ObjNormal*)malloc((nn > 0 ? nn : 1) * sizeof(ObjNormal));
+	theObj->TexCoordArray = (ObjTexCoord*)malloc((nt > 0 ? nt : 1) * sizeof(ObjTexCoord));
+	theObj->TriangleArray = (ObjTriangle*)malloc((ntri > 0 ? ntri : 1) * sizeof(ObjTriangle));
+
+	ObjModel *obj = theObj;
+	pool.parallelFor(0, (int)nchunks, [&](int b, int e){
+		for (int c = b; c < e; c++)
+		{
+			ObjParseChunk &chunk = chunks[c];
+			ObjCopyChunk(obj->VertexArray, chunk.vertices, vertexStart[c]);
+			ObjCopyChunk(obj->NormalArray, chunk.normals, normalStart[c]);
+			ObjCopyChunk(obj->TexCoordArray, chunk.texcoords, texcoordStart[c]);
+
+			//relative indices counted only this chunk's items
+			ObjTriangle *tris = chunk.triangles.data;
+			const int offset[3] = {vertexStart[c], normalStart[c], texcoordStart[c]};
+			for (int f = 0; f < chunk.fixups.size; f++)
+			{
+				int *slot = (int*)tris + chunk.fixups.data[f];
+				*slot += offset[(chunk.fixups.data[f] % 9) / 3];
+			}
+			ObjCopyChunk(obj->TriangleArray, chunk.triangles, triangleStart[c]);
+
+			//free each piece as soon as it has been joined
+			chunk.vertices.reset();
+			chunk.normals.reset();
+			chunk.texcoords.reset();
+			chunk.triangles.reset();
+		}
+	});
+
+	theObj->BuildWelded();
+}
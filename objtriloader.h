@@ -9,6 +9,7 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <cstddef>
 
 using namespace std;
 
@@ -36,14 +37,28 @@ struct ObjTriangle
 	int TexCoord[3];
 };
 
+//one distinct (vertex, normal, texture coordinate) corner combination
+struct ObjWeldedVertex
+{
+	int Vertex;
+	int Normal;
+	int TexCoord;
+};
+
 class ObjModel
 {
 public:
 	ObjModel();
 	~ObjModel();
 
-	ObjModel(const ObjModel& copy);
-	ObjModel& operator=(const ObjModel& right);
+	//models own large arrays, so they are moved rather than copied
+	ObjModel(const ObjModel& copy) = delete;
+	ObjModel& operator=(const ObjModel& right) = delete;
+	ObjModel(ObjModel&& other);
+	ObjModel& operator=(ObjModel&& right);
+
+	//release all data and return to the empty model
+	void Clear(void);
 
 	int NumVertex, NumNormal, NumTexCoord, NumTriangle;
 
@@ -53,9 +68,25 @@ public:
 
 	ObjTriangle *TriangleArray;
 
+	//welded corners: every distinct corner once, and three indices per
+	//triangle into that table, so the model can be drawn with a single
+	//index buffer. ObjWeldedVertex::Vertex maps back to VertexArray.
+	int NumWelded;
+	ObjWeldedVertex *WeldedArray;
+	unsigned int *IndexArray;
+	void BuildWelded(void);
+
+	//per corner (de-indexed) copies of the arrays above, only filled
+	//by BuildBuffers
 	float *vertex_buffer;
 	float *normal_buffer;
 	float *texcoord_buffer;
+	void BuildBuffers(void);
+
+	//when set, the arrays above point into this mapped file
+	//(see MeshCache) and are released by unmapping it
+	void *Mapping;
+	size_t MappingSize;
 };
 
 //class to load .obj files
@@ -66,9 +97,11 @@ public:
 	~ObjLoader();
 
 	ObjLoader(string file);
+	ObjLoader(const ObjLoader& copy) = delete;
+	ObjLoader& operator=(const ObjLoader& right) = delete;
 	void LoadObj(string file);
 	void FreeObj(void);
-	ObjModel ReturnObj(void);
+	ObjModel ReturnObj(void);	//moves the model out of the loader
 
 protected:
 	string *fileName;
@@ -16,8 +16,14 @@
    f: toggle fill light on and off
    r: toggle back (rim) light on and off
    g: toggle window background color between grey and black
+   m: switch to the next integrator
    i: reinitialize (reset program to initial default state)
    q or Esc: quit
+
+ When playing back a lattice cache (-play):
+   p: pause and resume playback
+   , and .: step one frame back or forward
+   < and >: step ten frames back or forward
  
  Camera and model controls following the mouse:k
  model yaw   - left-button, horizontal motion, rotation of the model around its y axis
@@ -26,7 +32,19 @@
  camera raise	 - middle-button, vertical motion
  trolly    - right-button, vertical or horizontal motion, trolly camera in and out
  
- usage: 
+ usage: spooky_springy_mesh [-lattice planes rows cols] [-springs k d] [-mass m]
+                            [-integrator rk4|implicit|symplectic|verlet|dopri|projective] [-h dt]
+                            [-tol e] [-play cache] [mesh.obj]
+   -lattice: number of lattice cells along z, y and x (default 2 12 4)
+   -springs: strut spring and damping constants (default 11.1 2.8)
+   -mass:    total mass of the lattice (default 1000)
+   -integrator: time integration method, as for lattice_batch (default rk4);
+             symplectic and verlet cost a quarter of rk4 per step
+   -h:       simulation time step (default 0.05)
+   -tol:     error allowed per dopri substep (default 1e-4)
+   -play:    play back a lattice cache made by lattice_batch -lcache instead
+             of simulating; the lattice resolution comes from the cache
+   mesh.obj: mesh to deform (default skeleton.obj)
 */
 
 #include "Model.h"
@@ -74,7 +92,7 @@ void handleKey(unsigned char key, int x, int y){
   
   switch(key){
     case 's':          
-      if(!particleSystem.isSimRunning()){  
+      if(!particleSystem.isSimRunning() && !psView.isPlayingBack()){  
         particleSystem.initSimulation();     // reinitialize the simulation
         particleSystem.startSimulation();        // start the action
       }
@@ -100,6 +118,28 @@ void handleKey(unsigned char key, int x, int y){
       psView.toggleLattice();
       break;
 
+    case 'm':           // cycle through the integrators
+      particleSystem.setIntegrator((Model::Integrator)((particleSystem.getIntegrator() + 1) % Model::NUM_INTEGRATORS));
+      cout << "integrator " << Model::integratorName(particleSystem.getIntegrator()) << endl;
+      break;
+
+    case 'p':           // pause or resume lattice cache playback
+      psView.togglePlaybackPause();
+      break;
+
+    case ',':           // scrub the lattice cache playback
+      psView.stepPlayback(-1);
+      break;
+    case '.':
+      psView.stepPlayback(1);
+      break;
+    case '<':
+      psView.stepPlayback(-10);
+      break;
+    case '>':
+      psView.stepPlayback(10);
+      break;
+
     case 'i':			// I -- reinitialize view
     case 'I':
       psView.setInitialView();
@@ -154,6 +194,13 @@ void doReshape(int width, int height){
 void doSimulation(){
   static int count = 0;
 
+  // playback shows the cached frame due instead of simulating
+  if(psView.isPlayingBack()){
+    if(psView.advancePlayback())
+      glutPostRedisplay();
+    return;
+  }
+
   particleSystem.timeStep();
 
   if(count == 0)         // only update the display after every displayInterval time steps
@@ -162,6 +209,59 @@ void doSimulation(){
   count = (count + 1) % particleSystem.displayInterval();
 }
 
+//
+// Parse the command line options, configuring the model and returning the
+// name of the mesh to load
+//
+const char *parseArgs(int argc, char* argv[]){
+  const char *meshfile = "skeleton.obj";
+  const char *playfile = NULL;
+
+  for(int i = 1; i < argc; i++){
+    string arg = argv[i];
+    if(arg == "-lattice" && i + 3 < argc){
+      particleSystem.setResolution(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+      i += 3;
+    }
+    else if(arg == "-springs" && i + 2 < argc){
+      particleSystem.setSpringConstants(atof(argv[i + 1]), atof(argv[i + 2]));
+      i += 2;
+    }
+    else if(arg == "-mass" && i + 1 < argc){
+      particleSystem.setLatticeMass(atof(argv[i + 1]));
+      i += 1;
+    }
+    else if(arg == "-integrator" && i + 1 < argc){
+      Model::Integrator method;
+      if(!Model::findIntegrator(argv[++i], method)){
+        cerr << "Unknown integrator " << argv[i] << endl;
+        exit(1);
+      }
+      particleSystem.setIntegrator(method);
+    }
+    else if(arg == "-h" && i + 1 < argc)
+      particleSystem.setTimeStep(atof(argv[++i]));
+    else if(arg == "-tol" && i + 1 < argc)
+      particleSystem.setErrorTolerance(atof(argv[++i]));
+    else if(arg == "-play" && i + 1 < argc)
+      playfile = argv[++i];
+    else if(arg[0] != '-')
+      meshfile = argv[i];
+    else{
+      cerr << "usage: " << argv[0] << " [-lattice planes rows cols] [-springs k d] [-mass m]" << endl;
+      cerr << "       [-integrator rk4|implicit|symplectic|verlet|dopri|projective] [-h dt]" << endl;
+      cerr << "       [-tol e] [-play cache] [mesh.obj]" << endl;
+      exit(1);
+    }
+  }
+
+  // the cache decides the lattice resolution, so it is opened before the mesh
+  if(playfile != NULL && !psView.openPlayback(playfile))
+    exit(1);
+
+  return meshfile;
+}
+
 //
 // Main program to create window, initiate GLUT, setup callbacks,
 // and initialize Model and View
@@ -171,6 +271,10 @@ int main(int argc, char* argv[]){
   
   // start up the glut utilities
   glutInit(&argc, argv);
+
+  // configure the lattice, then load the mesh and build the lattice around it
+  const char *meshfile = parseArgs(argc, argv);
+  psView.loadModel(meshfile);
   
   // create the graphics window, giving width, height, and title text
   // and establish double buffering, RGBA color
@@ -0,0 +1,47 @@
+/*
+* Check.h
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Minimal support for the behavior tests run by make check. Each
+* test is a small program; CHECK reports every failed condition and
+* checkResult turns the count into the exit status.
+*/
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+static int checkFailures = 0;
+
+#define CHECK(cond) \
+   do{ \
+      if (!(cond)){ \
+         fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+         checkFailures++; \
+      } \
+   } while (0)
+
+// a path for scratch files, in TMPDIR if it is set and unique to this run
+static inline std::string checkTempPath(const char *name)
+{
+   const char *dir = getenv("TMPDIR");
+   char prefix[32];
+   snprintf(prefix, sizeof(prefix), "/check%d_", (int)getpid());
+   return std::string((dir != NULL && dir[0] != '\0') ? dir : "/tmp") + prefix + name;
+}
+
+static inline int checkResult(const char *test)
+{
+   if (checkFailures > 0)
+      fprintf(stderr, "%s: %d checks failed\n", test, checkFailures);
+   else
+      printf("%s: passed\n", test);
+   return checkFailures > 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+* check_allocations.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* Once warmed up, Model::timeStep must not touch the heap with any
+* integrator. Every operator new in the program is counted, and the
+* count may not move over a run of steps after the first few.
+*/
+
+#include "Check.h"
+#include "../Model.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+static atomic<long> allocations(0);
+
+void* operator new(size_t size)
+{
+   allocations++;
+   void *p = malloc(size > 0 ? size : 1);
+   if (p == NULL)
+      throw bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size)
+{
+   return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+   free(p);
+}
+
+static const int WARMUP = 3;
+static const int STEPS = 100;
+
+int main()
+{
+   for (int m = 0; m < Model::NUM_INTEGRATORS; m++){
+      Model::Integrator method = (Model::Integrator)m;
+
+      Model model;
+      model.setResolution(2, 6, 4);
+      model.setBoundingBox(0, 0, 0, 1.5, 2, 1);
+      model.setIntegrator(method);
+      model.constructLattice();
+      model.initSimulation();
+      model.startSimulation();
+
+      // the solvers build their structures on the first step
+      for (int n = 0; n < WARMUP; n++)
+         model.timeStep();
+
+      long before = allocations;
+      for (int n = 0; n < STEPS; n++)
+         model.timeStep();
+      long made = allocations - before;
+
+      CHECK(model.isSimRunning());
+      if (made != 0){
+         fprintf(stderr, "%s: %ld allocations in %d steps\n", Model::integratorName(method), made, STEPS);
+         checkFailures++;
+      }
+   }
+
+   return checkResult("check_allocations");
+}
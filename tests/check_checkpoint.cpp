@@ -0,0 +1,98 @@
+/*
+* check_checkpoint.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* A run restored from a checkpoint must continue bit for bit as the
+* original, with every integrator.
+*/
+
+#include "Check.h"
+#include "../Model.h"
+#include "../Checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+static const int STEPS = 40;	// before and again after the checkpoint
+
+static void buildModel(Model &model, Model::Integrator method)
+{
+   model.setResolution(2, 4, 3);
+   model.setSpringConstants(400, 6);
+   model.setBoundingBox(0, 0, 0, 1.5, 2, 1);
+   model.setIntegrator(method);
+   model.setErrorTolerance(1.0e-7);	// so Dormand-Prince takes uneven substeps
+   model.constructLattice();
+   model.initSimulation();
+   model.startSimulation();
+}
+
+static void run(Model &model, int steps)
+{
+   for (int n = 0; n < steps; n++)
+      model.timeStep();
+}
+
+int main()
+{
+   string path = checkTempPath("restart.ckpt");
+
+   for (int m = 0; m < Model::NUM_INTEGRATORS; m++){
+      Model::Integrator method = (Model::Integrator)m;
+      const char *name = Model::integratorName(method);
+
+      Model original;
+      buildModel(original, method);
+      run(original, STEPS);
+      CHECK(Checkpoint::write(path.c_str(), original));
+      run(original, STEPS);
+
+      // the restored model starts from a different lattice, all of which
+      // the checkpoint has to replace
+      Model restored;
+      restored.setResolution(1, 1, 1);
+      if (!Checkpoint::read(path.c_str(), restored)){
+         fprintf(stderr, "%s: checkpoint not read\n", name);
+         checkFailures++;
+         continue;
+      }
+      CHECK(restored.getIntegrator() == method);
+      CHECK(restored.getNumParticles() == original.getNumParticles());
+      CHECK(restored.getNumStruts() == original.getNumStruts());
+      run(restored, STEPS);
+      CHECK(restored.getStep() == original.getStep());
+      CHECK(restored.isSimRunning() && original.isSimRunning());
+
+      const StateVector &a = *original.getSPointer();
+      const StateVector &b = *restored.getSPointer();
+      if (a.getLength() != b.getLength()){
+         fprintf(stderr, "%s: state lengths differ\n", name);
+         checkFailures++;
+         continue;
+      }
+      if (memcmp(a.getData(), b.getData(), a.getLength() * sizeof(Real)) != 0){
+         fprintf(stderr, "%s: restored run differs from the original\n", name);
+         checkFailures++;
+      }
+   }
+
+   // a damaged file is refused and leaves the model alone
+   FILE *fp = fopen(path.c_str(), "r+b");
+   CHECK(fp != NULL);
+   if (fp != NULL){
+      fputc('X', fp);
+      fclose(fp);
+   }
+   Model untouched;
+   buildModel(untouched, Model::RK4_INTEGRATOR);
+   int np = untouched.getNumParticles();
+   CHECK(!Checkpoint::read(path.c_str(), untouched));
+   CHECK(untouched.getNumParticles() == np && untouched.getStep() == 0);
+
+   remove(path.c_str());
+   return checkResult("check_checkpoint");
+}
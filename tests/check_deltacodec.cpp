@@ -0,0 +1,99 @@
+/*
+* check_deltacodec.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* A trajectory pushed through quantization and the delta code must
+* decode to the very same quantized values, and so back to within
+* the error bound of every original value, for smooth motion and
+* sudden jumps alike. Decoding may start at any keyframe, and a
+* damaged frame or a delta frame with no history is refused.
+*/
+
+#include "Check.h"
+#include "../DeltaCodec.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+static const int NUM_VALUES = 300;	// not a multiple of the Rice block
+static const int NUM_FRAMES = 60;
+static const int KEY_EVERY = 16;
+static const double ERROR_BOUND = 1.0e-4;
+
+// value i of frame f: slow swinging, with a jump at frame 30 and some
+// values far from the reference throughout
+static double sample(int f, int i)
+{
+   double v = 0.5 * sin(0.05 * f + 0.1 * i) + 0.01 * i;
+   if (f >= 30)
+      v += 3.0;
+   if (i % 97 == 0)
+      v += 1.0e6;
+   return v;
+}
+
+int main()
+{
+   vector<double> ref(NUM_VALUES), frame(NUM_VALUES), decoded(NUM_VALUES);
+   for (int i = 0; i < NUM_VALUES; i++)
+      ref[i] = 0.01 * i;
+
+   double step = DeltaCodec::quantStep(ERROR_BOUND);
+   vector<int64_t> q(NUM_VALUES), back(NUM_VALUES);
+   vector<vector<unsigned char> > code(NUM_FRAMES);
+   vector<vector<int64_t> > quantized(NUM_FRAMES);
+
+   DeltaCodec encoder, decoder;
+   encoder.reset(NUM_VALUES);
+   decoder.reset(NUM_VALUES);
+   int wrongCodes = 0, outOfBound = 0;
+   double worst = 0;
+   for (int f = 0; f < NUM_FRAMES; f++){
+      for (int i = 0; i < NUM_VALUES; i++)
+         frame[i] = sample(f, i);
+      DeltaCodec::quantize(&frame[0], &ref[0], NUM_VALUES, step, &q[0]);
+      quantized[f] = q;
+      encoder.encode(&q[0], f % KEY_EVERY == 0, code[f]);
+      CHECK(DeltaCodec::isKeyframe(&code[f][0], code[f].size()) == (f % KEY_EVERY == 0));
+
+      CHECK(decoder.decode(&code[f][0], code[f].size(), &back[0]));
+      if (back != q)
+         wrongCodes++;
+      DeltaCodec::dequantize(&back[0], &ref[0], NUM_VALUES, step, &decoded[0]);
+      for (int i = 0; i < NUM_VALUES; i++){
+         double e = fabs(decoded[i] - frame[i]);
+         worst = fmax(worst, e);
+         if (!(e <= ERROR_BOUND * (1 + 1.0e-9) + 1.0e-15 * fabs(frame[i])))
+            outOfBound++;
+      }
+   }
+   CHECK(wrongCodes == 0);
+   CHECK(outOfBound == 0);
+   if (outOfBound > 0)
+      fprintf(stderr, "largest error %g for a bound of %g\n", worst, ERROR_BOUND);
+
+   // for smooth motion a delta frame codes smaller than a keyframe
+   CHECK(code[KEY_EVERY + 5].size() < code[KEY_EVERY].size());
+
+   // decoding may start at any keyframe, but not at a delta frame
+   DeltaCodec late;
+   late.reset(NUM_VALUES);
+   CHECK(!late.decode(&code[KEY_EVERY + 1][0], code[KEY_EVERY + 1].size(), &back[0]));
+   bool same = true;
+   for (int f = KEY_EVERY; f < NUM_FRAMES; f++){
+      CHECK(late.decode(&code[f][0], code[f].size(), &back[0]));
+      same = same && back == quantized[f];
+   }
+   CHECK(same);
+
+   // a truncated frame is refused
+   DeltaCodec cut;
+   cut.reset(NUM_VALUES);
+   CHECK(!cut.decode(&code[0][0], code[0].size() / 2, &back[0]));
+   CHECK(!cut.decode(&code[0][0], 0, &back[0]));
+
+   return checkResult("check_deltacodec");
+}
@@ -0,0 +1,108 @@
+/*
+* check_implicit.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* The conjugate gradient solve of the backward Euler step, checked
+* against an exact solution. A chain of particles along a diagonal
+* line, moving and pulled along that line only, stays on it, so the
+* step's block system collapses to a tridiagonal one that is solved
+* directly here. The solver's velocities must match it to the
+* tolerance asked for, and the residual it reports must be met.
+*/
+
+#include "Check.h"
+#include "../ImplicitSolver.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+static const int NUM_PARTICLES = 60;	// particle 0 is pinned
+static const double K = 50, D = 2, REST = 1, H = 0.1, GRAVITY = 0.3;
+
+// largest velocity error of a solve at tolerance tol, relative to the
+// largest exact velocity; also returns the solver's own figures
+static double solveChain(double tol, double &residual, int &iterations)
+{
+   Vec3d u(1.0 / 3, 2.0 / 3, 2.0 / 3);		// unit direction of the chain
+
+   ParticleStoreT<double> particles(NUM_PARTICLES);
+   StateVectorT<double> state(NUM_PARTICLES);
+   StrutSetT<double> struts;
+   particles.gravity = GRAVITY * u;
+   vector<double> mass(NUM_PARTICLES), s(NUM_PARTICLES), v0(NUM_PARTICLES);
+   for (int i = 0; i < NUM_PARTICLES; i++){
+      mass[i] = 1 + 0.5 * sin(1.0 * i);
+      particles.setMass(i, mass[i]);
+      particles.setPinned(i, i == 0);
+      s[i] = (i == 0) ? 0 : s[i - 1] + REST * (1 + 0.05 * sin(3.0 * i));	// stretched and compressed
+      v0[i] = (i == 0) ? 0 : 0.3 * cos(2.0 * i);
+      state.setPosition(i, s[i] * u);
+      state.setVelocity(i, v0[i] * u);
+   }
+   for (int i = 0; i + 1 < NUM_PARTICLES; i++)
+      struts.add(i, i + 1, K, D, REST);
+   struts.colorBatches(NUM_PARTICLES);
+
+   // along the chain the step is the tridiagonal system
+   // (m + h d + h^2 k per strut) v1 = m (v0 + h g) + h k (stretch) for the
+   // free particles, solved by elimination
+   int n = NUM_PARTICLES - 1;
+   double c = H * D + H * H * K;
+   vector<double> diag(n), off(n), rhs(n);
+   for (int r = 0; r < n; r++){
+      int i = r + 1;
+      diag[r] = mass[i] + c * ((i + 1 < NUM_PARTICLES) ? 2 : 1);
+      off[r] = -c;
+      rhs[r] = mass[i] * (v0[i] + H * GRAVITY) - H * K * (s[i] - s[i - 1] - REST);
+      if (i + 1 < NUM_PARTICLES)
+         rhs[r] += H * K * (s[i + 1] - s[i] - REST);
+   }
+   for (int r = 1; r < n; r++){
+      double w = off[r - 1] / diag[r - 1];
+      diag[r] -= w * off[r - 1];
+      rhs[r] -= w * rhs[r - 1];
+   }
+   vector<double> exact(NUM_PARTICLES, 0.0);
+   for (int r = n - 1; r >= 0; r--)
+      exact[r + 1] = (rhs[r] - ((r + 1 < n) ? off[r] * exact[r + 2] : 0)) / diag[r];
+
+   ImplicitSolverT<double> solver;
+   solver.setTolerance(tol, 1000);
+   solver.step(state, particles, struts, H, ThreadPool::shared());
+   residual = solver.getResidual();
+   iterations = solver.getIterations();
+
+   double worst = 0, largest = 0;
+   for (int i = 0; i < NUM_PARTICLES; i++){
+      Vec3d expect = exact[i] * u;
+      worst = fmax(worst, norm(state.velocity(i) - expect));
+      worst = fmax(worst, norm(state.position(i) - (s[i] * u + H * expect)) / H);
+      largest = fmax(largest, fabs(exact[i]));
+   }
+   return worst / largest;
+}
+
+int main()
+{
+   double residual;
+   int iterations;
+
+   // the default tolerance
+   double error = solveChain(1.0e-5, residual, iterations);
+   CHECK(residual <= 1.0e-5);
+   CHECK(iterations > 0 && iterations < 1000);
+   CHECK(error < 1.0e-3);
+
+   // a tight tolerance converges to the exact solution
+   error = solveChain(1.0e-12, residual, iterations);
+   CHECK(residual <= 1.0e-12);
+   CHECK(iterations < 1000);
+   if (!(error < 1.0e-9))
+      fprintf(stderr, "velocity error %g at tolerance 1e-12\n", error);
+   CHECK(error < 1.0e-9);
+
+   return checkResult("check_implicit");
+}
@@ -0,0 +1,154 @@
+/*
+* check_meshcache.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* MeshCache must load a cache that matches its obj, keep it when the
+* obj is only touched, and reject it when the obj's contents change,
+* whether or not the size changes, or when the cache itself is
+* damaged or inconsistent.
+*/
+
+#include "Check.h"
+#include "../MeshCache.h"
+#include "../objtriloader.h"
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace std;
+
+static const char *TETRA =
+   "v 0 0 0\n"
+   "v 1 0 0\n"
+   "v 0 1 0\n"
+   "v 0 0 1\n"
+   "vn 0 0 1\n"
+   "f 1//1 2//1 3//1\n"
+   "f 1//1 2//1 4//1\n"
+   "f 1//1 3//1 4//1\n"
+   "f 2//1 3//1 4//1\n";
+
+static bool writeFile(const string &path, const string &text)
+{
+   FILE *fp = fopen(path.c_str(), "wb");
+   if (fp == NULL)
+      return false;
+   bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+   return (fclose(fp) == 0) && ok;
+}
+
+// move the file's modification time by seconds, leaving its contents alone
+static bool shiftTime(const string &path, int seconds)
+{
+   struct stat st;
+   if (stat(path.c_str(), &st) != 0)
+      return false;
+   struct timeval tv[2];
+   tv[0].tv_sec = tv[1].tv_sec = st.st_mtime + seconds;
+   tv[0].tv_usec = tv[1].tv_usec = 0;
+   return utimes(path.c_str(), tv) == 0;
+}
+
+// load the cache for path, and if it loads, check it against a fresh parse
+static bool loadCache(const string &path)
+{
+   ObjModel cached;
+   if (!MeshCache::load(path.c_str(), cached))
+      return false;
+   ObjLoader loader(path);
+   ObjModel parsed = loader.ReturnObj();
+   CHECK(cached.NumVertex == parsed.NumVertex);
+   CHECK(cached.NumTriangle == parsed.NumTriangle);
+   CHECK(cached.NumWelded == parsed.NumWelded);
+   for (int i = 0; i < cached.NumVertex && i < parsed.NumVertex; i++)
+      CHECK(cached.VertexArray[i].X == parsed.VertexArray[i].X &&
+            cached.VertexArray[i].Y == parsed.VertexArray[i].Y &&
+            cached.VertexArray[i].Z == parsed.VertexArray[i].Z);
+   return true;
+}
+
+int main()
+{
+   string obj = checkTempPath("tetra.obj");
+   string cache = MeshCache::cachePath(obj.c_str());
+   CHECK(writeFile(obj, TETRA));
+
+   // no cache yet
+   remove(cache.c_str());
+   CHECK(!loadCache(obj));
+
+   // a fresh cache loads
+   {
+      ObjLoader loader(obj);
+      ObjModel model = loader.ReturnObj();
+      CHECK(model.NumVertex == 4 && model.NumTriangle == 4);
+      CHECK(MeshCache::write(obj.c_str(), model));
+   }
+   CHECK(loadCache(obj));
+
+   // touching the obj changes the stamp, but the checksum still matches
+   CHECK(shiftTime(obj, 10));
+   CHECK(loadCache(obj));
+
+   // same size, different contents, different time: the checksum rejects it
+   string edited = TETRA;
+   edited.replace(edited.find("v 1 0 0"), 7, "v 2 0 0");
+   CHECK(edited.size() == string(TETRA).size());
+   CHECK(writeFile(obj, edited));
+   CHECK(shiftTime(obj, 20));
+   CHECK(!loadCache(obj));
+
+   // a new size is rejected outright
+   CHECK(writeFile(obj, string(TETRA) + "v 5 5 5\n"));
+   CHECK(!loadCache(obj));
+
+   // a rebuilt cache loads again, but not once its header is damaged
+   {
+      ObjLoader loader(obj);
+      ObjModel model = loader.ReturnObj();
+      CHECK(MeshCache::write(obj.c_str(), model));
+   }
+   CHECK(loadCache(obj));
+   FILE *fp = fopen(cache.c_str(), "r+b");
+   CHECK(fp != NULL);
+   if (fp != NULL){
+      fputc('X', fp);
+      fclose(fp);
+   }
+   CHECK(!loadCache(obj));
+
+   // as is one holding fewer indices than its triangles need; the index
+   // count is the last of the header's six counts, 60 bytes in
+   {
+      ObjLoader loader(obj);
+      ObjModel model = loader.ReturnObj();
+      CHECK(MeshCache::write(obj.c_str(), model));
+   }
+   CHECK(loadCache(obj));
+   fp = fopen(cache.c_str(), "r+b");
+   CHECK(fp != NULL);
+   if (fp != NULL){
+      int32_t indices = 3 * 4 - 3;
+      CHECK(fseek(fp, 60, SEEK_SET) == 0 && fwrite(&indices, sizeof(indices), 1, fp) == 1);
+      fclose(fp);
+   }
+   CHECK(!loadCache(obj));
+
+   // and a truncated cache
+   {
+      ObjLoader loader(obj);
+      ObjModel model = loader.ReturnObj();
+      CHECK(MeshCache::write(obj.c_str(), model));
+   }
+   struct stat st;
+   CHECK(stat(cache.c_str(), &st) == 0 && truncate(cache.c_str(), st.st_size - 8) == 0);
+   CHECK(!loadCache(obj));
+
+   remove(cache.c_str());
+   remove(obj.c_str());
+   return checkResult("check_meshcache");
+}
@@ -0,0 +1,82 @@
+/*
+* check_objchunks.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* An obj large enough to be parsed in several chunks, whose faces
+* use relative (negative) indices reaching back across the chunk
+* boundaries, must load with the same absolute indices a serial
+* parse would give.
+*/
+
+#include "Check.h"
+#include "../objtriloader.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int NUM_GROUPS = 80000;	// about 5 MB, so the loader splits it
+
+int main()
+{
+   string path = checkTempPath("chunks.obj");
+   FILE *fp = fopen(path.c_str(), "wb");
+   CHECK(fp != NULL);
+   if (fp == NULL)
+      return checkResult("check_objchunks");
+
+   // every group adds one vertex, texture coordinate and normal, then a
+   // face on the newest three, written relative, and every seventh group
+   // a face reaching much further back, also relative; expected holds the
+   // absolute 0 based vertex index of every corner, which here is also
+   // its normal and texture coordinate index
+   vector<int> expected;
+   int count = 0;
+   for (int g = 0; g < NUM_GROUPS; g++){
+      fprintf(fp, "v %d %d.5 -%d\nvt 0.%d 0.5\nvn 0 0 1\n", g, g % 100, g % 17, g % 10);
+      count++;
+      if (count >= 3){
+         fprintf(fp, "f -1/-1/-1 -2/-2/-2 -3/-3/-3\n");
+         expected.push_back(count - 1);
+         expected.push_back(count - 2);
+         expected.push_back(count - 3);
+      }
+      if (g % 7 == 6 && count > 5000){
+         fprintf(fp, "f -5000/-5000/-5000 %d/%d/%d -1/-1/-1\n", 1, 1, 1);
+         expected.push_back(count - 5000);
+         expected.push_back(0);
+         expected.push_back(count - 1);
+      }
+   }
+   CHECK(fclose(fp) == 0);
+
+   ObjLoader loader(path);
+   ObjModel model = loader.ReturnObj();
+   CHECK(model.NumVertex == NUM_GROUPS);
+   CHECK(model.NumNormal == NUM_GROUPS);
+   CHECK(model.NumTexCoord == NUM_GROUPS);
+   CHECK(3 * model.NumTriangle == (int)expected.size());
+
+   int wrong = 0;
+   for (int t = 0; t < model.NumTriangle && 3 * t < (int)expected.size(); t++){
+      const ObjTriangle &tri = model.TriangleArray[t];
+      for (int k = 0; k < 3; k++){
+         int e = expected[3 * t + k];
+         if (tri.Vertex[k] != e || tri.Normal[k] != e || tri.TexCoord[k] != e)
+            wrong++;
+      }
+   }
+   CHECK(wrong == 0);
+
+   // the vertices themselves keep their order across the chunks
+   bool ordered = true;
+   for (int i = 0; i < model.NumVertex; i++)
+      ordered = ordered && model.VertexArray[i].X == (float)i;
+   CHECK(ordered);
+
+   remove(path.c_str());
+   return checkResult("check_objchunks");
+}
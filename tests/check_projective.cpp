@@ -0,0 +1,164 @@
+/*
+* check_projective.cpp
+* CPSC 8170 Physically Based Animation
+* Version 1.0
+*
+* The factored global solve of the projective dynamics step, checked
+* against an exact solution. The particles lie, move and are pulled
+* along one diagonal line, with struts to their next and third next
+* neighbors, and are numbered out of chain order so the reordering
+* matters. Along the line every strut's projection is fixed, so a
+* single local global iteration must land on the backward Euler
+* solution, which is solved densely here; any error left is the
+* Cholesky factor's. A system that is not positive definite must be
+* refused without touching the state.
+*/
+
+#include "Check.h"
+#include "../ProjectiveSolver.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+static const int NUM_PARTICLES = 60;	// chain position 0 is pinned
+static const int SHUFFLE = 17;		// chain position c is particle SHUFFLE * c mod NUM_PARTICLES
+static const double K = 50, D = 2, REST = 1, GRAVITY = 0.3;
+
+struct Chain
+{
+   ParticleStoreT<double> particles;
+   StateVectorT<double> state;
+   StrutSetT<double> struts;
+   vector<double> mass, s, v0;		// by chain position
+   vector<int> id;			// particle of each chain position
+
+   Chain() : particles(NUM_PARTICLES), state(NUM_PARTICLES),
+             mass(NUM_PARTICLES), s(NUM_PARTICLES), v0(NUM_PARTICLES), id(NUM_PARTICLES) {}
+};
+
+static const Vec3d AXIS(1.0 / 3, 2.0 / 3, 2.0 / 3);
+
+static void buildChain(Chain &chain, double k)
+{
+   chain.particles.gravity = GRAVITY * AXIS;
+   for (int c = 0; c < NUM_PARTICLES; c++){
+      int i = chain.id[c] = (SHUFFLE * c) % NUM_PARTICLES;
+      chain.mass[c] = 1 + 0.5 * sin(1.0 * c);
+      chain.particles.setMass(i, chain.mass[c]);
+      chain.particles.setPinned(i, c == 0);
+      chain.s[c] = (c == 0) ? 0 : chain.s[c - 1] + REST * (1 + 0.05 * sin(3.0 * c));
+      chain.v0[c] = (c == 0) ? 0 : 0.3 * cos(2.0 * c);
+      chain.state.setPosition(i, chain.s[c] * AXIS);
+      chain.state.setVelocity(i, chain.v0[c] * AXIS);
+   }
+   chain.struts.clear();
+   for (int c = 0; c + 1 < NUM_PARTICLES; c++){
+      chain.struts.add(chain.id[c], chain.id[c + 1], k, D, REST);
+      if (c + 3 < NUM_PARTICLES)
+         chain.struts.add(chain.id[c], chain.id[c + 3], k, D, 3 * REST);
+   }
+   chain.struts.colorBatches(NUM_PARTICLES);
+}
+
+// backward Euler velocities along the chain, by chain position: for the
+// free positions (m + sum of h d + h^2 k) v1 - sum (h d + h^2 k) v1 of
+// the neighbors = m (v0 + h g) + h k (stretch toward each neighbor)
+static vector<double> exactVelocities(const Chain &chain, double h)
+{
+   int n = NUM_PARTICLES - 1;
+   double w = h * D + h * h * K;
+   vector<double> A(n * n, 0.0), b(n);
+   for (int c = 1; c < NUM_PARTICLES; c++){
+      A[(c - 1) * n + (c - 1)] = chain.mass[c];
+      b[c - 1] = chain.mass[c] * (chain.v0[c] + h * GRAVITY);
+   }
+   for (int c = 0; c + 1 < NUM_PARTICLES; c++){
+      for (int span = 1; span <= 3; span += 2){
+         int e = c + span;
+         if (e >= NUM_PARTICLES)
+            continue;
+         double stretch = chain.s[e] - chain.s[c] - span * REST;
+         if (c > 0){
+            A[(c - 1) * n + (c - 1)] += w;
+            A[(c - 1) * n + (e - 1)] -= w;
+            b[c - 1] += h * K * stretch;
+         }
+         A[(e - 1) * n + (e - 1)] += w;
+         if (c > 0)
+            A[(e - 1) * n + (c - 1)] -= w;
+         b[e - 1] -= h * K * stretch;
+      }
+   }
+
+   // Gaussian elimination; the matrix is symmetric positive definite
+   for (int r = 0; r < n; r++)
+      for (int q = r + 1; q < n; q++){
+         double f = A[q * n + r] / A[r * n + r];
+         for (int k = r; k < n; k++)
+            A[q * n + k] -= f * A[r * n + k];
+         b[q] -= f * b[r];
+      }
+   vector<double> v(NUM_PARTICLES, 0.0);
+   for (int r = n - 1; r >= 0; r--){
+      double sum = b[r];
+      for (int k = r + 1; k < n; k++)
+         sum -= A[r * n + k] * v[k + 1];
+      v[r + 1] = sum / A[r * n + r];
+   }
+   return v;
+}
+
+// largest error of one step of solver against backward Euler, relative
+// to the largest velocity
+static double stepError(ProjectiveSolverT<double> &solver, double h)
+{
+   Chain chain;
+   buildChain(chain, K);
+   vector<double> exact = exactVelocities(chain, h);
+   CHECK(solver.step(chain.state, chain.particles, chain.struts, h, ThreadPool::shared()));
+
+   double worst = 0, largest = 0;
+   for (int c = 0; c < NUM_PARTICLES; c++){
+      int i = chain.id[c];
+      Vec3d expect = exact[c] * AXIS;
+      worst = fmax(worst, norm(chain.state.velocity(i) - expect));
+      worst = fmax(worst, norm(chain.state.position(i) - (chain.s[c] * AXIS + h * expect)) / h);
+      largest = fmax(largest, fabs(exact[c]));
+   }
+   return worst / largest;
+}
+
+int main()
+{
+   ProjectiveSolverT<double> solver;
+
+   solver.setIterations(1);
+   double error = stepError(solver, 0.1);
+   if (!(error < 1.0e-10))
+      fprintf(stderr, "error %g after one iteration\n", error);
+   CHECK(error < 1.0e-10);
+   CHECK(solver.getFactorSize() > 0);
+
+   // a new h is factored again, and more iterations stay on the solution
+   solver.setIterations(4);
+   error = stepError(solver, 0.05);
+   if (!(error < 1.0e-10))
+      fprintf(stderr, "error %g after a change of h\n", error);
+   CHECK(error < 1.0e-10);
+
+   // struts pushing apart harder than the masses hold them leave no
+   // positive definite system
+   Chain chain;
+   buildChain(chain, -1000);
+   StateVectorT<double> before(chain.state);
+   ProjectiveSolverT<double> refused;
+   CHECK(!refused.step(chain.state, chain.particles, chain.struts, 0.1, ThreadPool::shared()));
+   bool same = true;
+   for (int i = 0; i < before.getLength(); i++)
+      same = same && before.getData()[i] == chain.state.getData()[i];
+   CHECK(same);
+
+   return checkResult("check_projective");
+}